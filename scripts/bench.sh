@@ -0,0 +1,21 @@
+#!/bin/bash
+
+SCRIPT_DIR=$( cd -- "$( dirname -- "${BASH_SOURCE[0]}" )" &> /dev/null && pwd )
+SRC_DIR=$SCRIPT_DIR/../src
+BIN_DIR=$SCRIPT_DIR/../bin
+OUTPUT=$SCRIPT_DIR/../bench_output.txt
+
+if [ ! -d $BIN_DIR ]; then
+	mkdir $BIN_DIR
+fi
+
+# Results are JSON lines in bench_output.txt. Keep a copy and run
+#   bin/fredc_bench --compare old.txt bench_output.txt
+# to see the change of every measurement.
+if gcc $SRC_DIR/bench.c -O2 -g -pthread -o $BIN_DIR/fredc_bench; then
+	if [ "$1" == "--compare" ]; then
+		$BIN_DIR/fredc_bench "$@"
+	else
+		$BIN_DIR/fredc_bench "$@" | tee $OUTPUT
+	fi
+fi
@@ -8,6 +8,6 @@ if [ ! -d $BIN_DIR ]; then
 	mkdir $BIN_DIR
 fi
 
-if gcc $SRC_DIR/test.c -g -o $BIN_DIR/fredc_test; then
+if gcc $SRC_DIR/test.c -g -pthread -o $BIN_DIR/fredc_test; then
 	$BIN_DIR/fredc_test
 fi
@@ -0,0 +1,558 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#define FREDC_IMPLEMENTATION
+#include "fredc.h"
+
+#define BENCH_DEFAULT_MB 8
+#define BENCH_MIN_SECONDS 0.2 // each measurement repeats until it took this long
+
+typedef struct bench_corpus {
+	const char* name;
+	str8 text;
+	bool lines; // one document per line
+} bench_corpus;
+
+typedef struct bench_result {
+	double seconds;
+	size_t reps, ops, bytes;
+	size_t allocs, reallocs, frees;
+} bench_result;
+
+static unsigned long long rng_state = 0x9e3779b97f4a7c15ull;
+static unsigned long long rng(void) {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+static void put(fredc_writer* w, const char* s) {
+	fredc_writer_put(w, s, strlen(s));
+}
+
+// Corpora
+// Each generator appends to w until it holds about size bytes.
+
+static void gen_nested(fredc_writer* w, size_t size) {
+	put(w, "[");
+	for (int i = 0; w->length < size; i++) {
+		put(w, i ? ",\n" : "\n");
+		int depth = 16 + (int)(rng() % 48);
+		for (int d = 0; d < depth; d++) {
+			put(w, d & 1 ? "{\"child\": [" : "{\"level\": 1, \"node\": ");
+		}
+		put(w, "null");
+		for (int d = depth-1; d >= 0; d--) {
+			put(w, d & 1 ? "]}" : "}");
+		}
+	}
+	put(w, "\n]");
+}
+
+static void gen_wide(fredc_writer* w, size_t size) {
+	char buf[64];
+	put(w, "[");
+	for (int i = 0; w->length < size; i++) {
+		put(w, i ? ",\n{" : "\n{");
+		for (int k = 0; k < 10000; k++) {
+			int n = snprintf(buf, sizeof(buf), "%s\"field_%i\": %i", k ? ", " : "", k, (int)(rng() % 1000));
+			fredc_writer_put(w, buf, n);
+		}
+		put(w, "}");
+	}
+	put(w, "\n]");
+}
+
+static void gen_numbers(fredc_writer* w, size_t size) {
+	char buf[FREDC_NUM_BUF+4];
+	put(w, "[");
+	for (int i = 0; w->length < size; i++) {
+		size_t n;
+		if (i % 3 == 0) {
+			n = fredc_format_int((int64_t)(rng() % 2000000) - 1000000, buf);
+		} else {
+			n = fredc_format_double((double)(rng() % 100000000) / 1000.0 - 5000.0, buf);
+		}
+		if (i) put(w, ",");
+		fredc_writer_put(w, buf, n);
+	}
+	put(w, "]");
+}
+
+static const char* words[] = {
+	"lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit",
+	"sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore", "magna",
+};
+
+static void gen_record(fredc_writer* w, int i) {
+	char buf[128];
+	int n = snprintf(buf, sizeof(buf), "{\"id\": %i, \"user\": \"user_%06i\", \"email\": \"user%i@example.com\", \"text\": \"", i, i, i);
+	fredc_writer_put(w, buf, n);
+	int count = 8 + (int)(rng() % 24);
+	for (int j = 0; j < count; j++) {
+		if (j) put(w, " ");
+		put(w, words[rng() % (sizeof(words)/sizeof(words[0]))]);
+	}
+	n = snprintf(buf, sizeof(buf), "\", \"tags\": [\"%s\", \"%s\"], \"active\": %s}",
+		words[i % 16], words[(i/16) % 16], i & 1 ? "true" : "false");
+	fredc_writer_put(w, buf, n);
+}
+
+static void gen_strings(fredc_writer* w, size_t size) {
+	put(w, "[");
+	for (int i = 0; w->length < size; i++) {
+		put(w, i ? ",\n" : "\n");
+		gen_record(w, i);
+	}
+	put(w, "\n]");
+}
+
+static void gen_ndjson(fredc_writer* w, size_t size) {
+	for (int i = 0; w->length < size; i++) {
+		gen_record(w, i);
+		put(w, "\n");
+	}
+}
+
+// Measurements
+
+static size_t peak_rss_kb(void) {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return (size_t)usage.ru_maxrss / 1024;
+#else
+	return (size_t)usage.ru_maxrss;
+#endif
+}
+
+static void report(const char* corpus, const char* op, bench_result r) {
+	double seconds = r.seconds / r.reps;
+	printf("{\"corpus\": \"%s\", \"op\": \"%s\", \"bytes\": %zu, \"seconds\": %.6f", corpus, op, r.bytes, seconds);
+	if (r.bytes) {
+		printf(", \"mb_s\": %.1f", r.bytes / seconds / 1e6);
+	}
+	if (r.ops) {
+		printf(", \"ops\": %zu, \"ops_s\": %.0f", r.ops, r.ops / seconds);
+	}
+	printf(", \"allocs\": %zu, \"reallocs\": %zu, \"frees\": %zu, \"peak_rss_kb\": %zu}\n",
+		r.allocs / r.reps, r.reallocs / r.reps, r.frees / r.reps, peak_rss_kb());
+	fflush(stdout);
+}
+
+typedef struct bench_mark {
+	size_t allocs, reallocs, frees;
+	unsigned long long start;
+} bench_mark;
+
+// Allocations are counted by the library itself, see fredc_mem_get_stats
+static bench_mark bench_start(void) {
+	fredc_mem_stats mem = fredc_mem_get_stats();
+	return (bench_mark){ mem.allocations, mem.reallocations, mem.frees, fredc_now_ns() };
+}
+
+static void bench_stop(bench_result* r, bench_mark m) {
+	r->seconds += (fredc_now_ns() - m.start) / 1e9;
+	fredc_mem_stats mem = fredc_mem_get_stats();
+	r->allocs += mem.allocations - m.allocs;
+	r->reallocs += mem.reallocations - m.reallocs;
+	r->frees += mem.frees - m.frees;
+	r->reps++;
+}
+
+static fredc_doc* parse_corpus(bench_corpus* c, size_t* records) {
+	if (!c->lines) {
+		*records = 1;
+		return fredc_doc_parse(c->text.data, c->text.length);
+	}
+
+	// NDJSON: parse record by record, the last document is returned
+	fredc_doc* doc = 0;
+	*records = 0;
+	for (size_t pos = 0; pos < c->text.length;) {
+		const char* nl = (const char*)memchr(c->text.data + pos, '\n', c->text.length - pos);
+		size_t end = nl ? (size_t)(nl - c->text.data) : c->text.length;
+		fredc_doc_free(doc);
+		doc = fredc_doc_parse(c->text.data + pos, end - pos);
+		(*records)++;
+		pos = end+1;
+	}
+	return doc;
+}
+
+static void bench_parse(bench_corpus* c) {
+	// Freeing is reported against the input size too, as MB/s of source text
+	bench_result parse = { .bytes = c->text.length }, heap = parse, free_doc = parse, free_heap = parse;
+
+	do {
+		size_t records;
+		bench_mark m_parse = bench_start();
+		fredc_doc* doc = parse_corpus(c, &records);
+		bench_stop(&parse, m_parse);
+		parse.ops = records;
+
+		bench_mark m_free_doc = bench_start();
+		fredc_doc_free(doc);
+		bench_stop(&free_doc, m_free_doc);
+	} while (parse.seconds < BENCH_MIN_SECONDS);
+	report(c->name, "parse", parse);
+	if (c->lines) {
+		return; // records are freed as they are parsed
+	}
+	report(c->name, "free", free_doc);
+
+	do {
+		bench_mark m_heap = bench_start();
+		fredc_val val = fredc_parse_val(c->text.data, c->text.length);
+		bench_stop(&heap, m_heap);
+
+		bench_mark m_free_heap = bench_start();
+		fredc_val_free(&val);
+		bench_stop(&free_heap, m_free_heap);
+	} while (heap.seconds < BENCH_MIN_SECONDS);
+	report(c->name, "parse_heap", heap);
+	report(c->name, "free_heap", free_heap);
+
+	bench_result validate = { .bytes = c->text.length };
+	do {
+		bench_mark m_validate = bench_start();
+		fredc_validate_result result = fredc_validate(c->text.data, c->text.length, 0);
+		bench_stop(&validate, m_validate);
+		if (!result.valid) {
+			fprintf(stderr, "%s: %s at byte %zu\n", c->name, result.error, result.offset);
+			return;
+		}
+	} while (validate.seconds < BENCH_MIN_SECONDS);
+	report(c->name, "validate", validate);
+}
+
+static void bench_stringify(bench_corpus* c) {
+	if (c->lines) {
+		return;
+	}
+	fredc_doc* doc = fredc_doc_parse(c->text.data, c->text.length);
+	bench_result compact = {}, indented = {};
+
+	do {
+		bench_mark m_compact = bench_start();
+		str8 out = fredc_val_to_str8(*doc->root, (fredc_write_opts){0});
+		bench_stop(&compact, m_compact);
+		compact.bytes = out.length;
+		fredc_free(out.data);
+	} while (compact.seconds < BENCH_MIN_SECONDS);
+	report(c->name, "stringify", compact);
+
+	do {
+		bench_mark m_indented = bench_start();
+		str8 out = fredc_val_to_str8(*doc->root, (fredc_write_opts){ .indent = INDENT_SIZE });
+		bench_stop(&indented, m_indented);
+		indented.bytes = out.length;
+		fredc_free(out.data);
+	} while (indented.seconds < BENCH_MIN_SECONDS);
+	report(c->name, "stringify_indent", indented);
+
+	// Republishing after a one-value change reuses the cached output of every
+	// container the change did not touch
+	const char* change = "[{\"op\":\"replace\",\"path\":\"/0\",\"value\":0}]";
+	fredc_doc* patch = fredc_doc_parse(change, strlen(change));
+	str8 warm = fredc_val_to_str8(*doc->root, (fredc_write_opts){ .cache = true });
+	fredc_free(warm.data);
+	bench_result patched = {};
+	do {
+		bench_mark m_patched = bench_start();
+		fredc_patch_apply(doc->root, *patch->root);
+		str8 out = fredc_val_to_str8(*doc->root, (fredc_write_opts){ .cache = true });
+		bench_stop(&patched, m_patched);
+		patched.bytes = out.length;
+		fredc_free(out.data);
+	} while (patched.seconds < BENCH_MIN_SECONDS);
+	report(c->name, "stringify_patched", patched);
+	fredc_doc_free(patch);
+
+	fredc_doc_free(doc);
+}
+
+// Hashing two versions of a document, then diffing them once hashed
+static void bench_diff(bench_corpus* c) {
+	if (c->lines) {
+		return;
+	}
+	const char* change = "[{\"op\":\"replace\",\"path\":\"/0\",\"value\":0}]";
+	fredc_doc* patch = fredc_doc_parse(change, strlen(change));
+	fredc_doc *from = 0, *to = 0;
+
+	// Fresh documents every time, as hashes are kept once computed
+	bench_result hash = { .bytes = 2*c->text.length }, diff = {};
+	do {
+		fredc_doc_free(from);
+		fredc_doc_free(to);
+		from = fredc_doc_parse(c->text.data, c->text.length);
+		to = fredc_doc_parse(c->text.data, c->text.length);
+		fredc_patch_apply(to->root, *patch->root);
+
+		bench_mark m_hash = bench_start();
+		fredc_val_hash(*from->root);
+		fredc_val_hash(*to->root);
+		bench_stop(&hash, m_hash);
+	} while (hash.seconds < BENCH_MIN_SECONDS);
+	report(c->name, "hash", hash);
+
+	do {
+		bench_mark m_diff = bench_start();
+		fredc_val ops = fredc_diff(*from->root, *to->root);
+		bench_stop(&diff, m_diff);
+		diff.ops = ops.list->length;
+		fredc_val_free(&ops);
+	} while (diff.seconds < BENCH_MIN_SECONDS);
+	report(c->name, "diff", diff);
+
+	fredc_doc_free(patch);
+	fredc_doc_free(to);
+	fredc_doc_free(from);
+}
+
+// Parsing and writing with FREDC_PARSE_PACK, and reducing a top level list
+// both as regular and as packed elements
+static void bench_pack(bench_corpus* c) {
+	if (c->lines) {
+		return;
+	}
+	bench_result parse = { .bytes = c->text.length }, compact = {};
+	fredc_doc* doc = 0;
+	do {
+		fredc_doc_free(doc);
+		bench_mark m_parse = bench_start();
+		doc = fredc_doc_parse_ex(c->text.data, c->text.length, FREDC_PARSE_PACK);
+		bench_stop(&parse, m_parse);
+	} while (parse.seconds < BENCH_MIN_SECONDS);
+	report(c->name, "parse_packed", parse);
+
+	do {
+		bench_mark m_compact = bench_start();
+		str8 out = fredc_val_to_str8(*doc->root, (fredc_write_opts){0});
+		bench_stop(&compact, m_compact);
+		compact.bytes = out.length;
+		fredc_free(out.data);
+	} while (compact.seconds < BENCH_MIN_SECONDS);
+	report(c->name, "stringify_packed", compact);
+
+	fredc_doc* plain = fredc_doc_parse(c->text.data, c->text.length);
+	if (doc->root->type == JSON_LIST && doc->root->list->packed) {
+		fredc_list* lists[] = { plain->root->list, doc->root->list };
+		const char* ops[] = { "sum", "sum_packed" };
+		for (int i = 0; i < 2; i++) {
+			bench_result sum = {};
+			volatile double result = 0;
+			do {
+				bench_mark m_sum = bench_start();
+				result += fredc_list_sum(lists[i]);
+				bench_stop(&sum, m_sum);
+				sum.ops = lists[i]->length;
+			} while (sum.seconds < BENCH_MIN_SECONDS);
+			report(c->name, ops[i], sum);
+		}
+	}
+	fredc_doc_free(plain);
+	fredc_doc_free(doc);
+}
+
+// Lookups and updates of object members, on a heap tree so sets can grow it
+static void bench_get_set(bench_corpus* c) {
+	if (c->lines) {
+		return;
+	}
+	fredc_val root = fredc_parse_val(c->text.data, c->text.length);
+	if (root.type != JSON_LIST || root.list->length == 0 || root.list->data[0].type != JSON_OBJ) {
+		fredc_val_free(&root);
+		return;
+	}
+
+	// Keys that exist in the first record, looked up in random records
+	fredc_obj* first = root.list->data[0].object;
+	size_t key_count = first->length;
+	char** keys = (char**)malloc(key_count * sizeof(char*));
+	for (size_t i = 0; i < key_count; i++) {
+		keys[i] = first->props[i].key.data;
+	}
+
+	enum { BATCH = 100000 };
+	bench_result get = {}, set = {}, path = {};
+	size_t found = 0;
+	do {
+		bench_mark m_get = bench_start();
+		for (int i = 0; i < BATCH; i++) {
+			fredc_obj* obj = root.list->data[rng() % root.list->length].object;
+			found += fredc_get_prop(obj, keys[rng() % key_count]).type != JSON_UNDEFINED;
+		}
+		bench_stop(&get, m_get);
+		get.ops = BATCH;
+	} while (get.seconds < BENCH_MIN_SECONDS);
+	report(c->name, "get", get);
+
+	do {
+		bench_mark m_set = bench_start();
+		for (int i = 0; i < BATCH; i++) {
+			fredc_obj* obj = root.list->data[rng() % root.list->length].object;
+			fredc_set_prop(obj, keys[rng() % key_count], (fredc_val){ .type = JSON_INT, .integer = i });
+		}
+		bench_stop(&set, m_set);
+		set.ops = BATCH;
+	} while (set.seconds < BENCH_MIN_SECONDS);
+	report(c->name, "set", set);
+
+	char buf[512];
+	snprintf(buf, sizeof(buf), "[%zu].%s", root.list->length/2, keys[key_count-1]);
+	fredc_path compiled = fredc_path_compile(buf);
+	do {
+		bench_mark m_path = bench_start();
+		for (int i = 0; i < BATCH; i++) {
+			found += fredc_path_get(root, &compiled).type != JSON_UNDEFINED;
+		}
+		bench_stop(&path, m_path);
+		path.ops = BATCH;
+	} while (path.seconds < BENCH_MIN_SECONDS);
+	report(c->name, "path_get", path);
+	fredc_path_free(&compiled);
+
+	// Snapshot, then change one member of a random record: the root list
+	// and that record are copied, every other record stays shared
+	enum { SNAPSHOTS = 16 };
+	bench_result snapshot = {};
+	do {
+		bench_mark m_snapshot = bench_start();
+		for (int i = 0; i < SNAPSHOTS; i++) {
+			fredc_val snap = fredc_val_share(root);
+			fredc_val_touch(root);
+			fredc_val record = root.list->data[rng() % root.list->length];
+			fredc_set_prop(record.object, keys[rng() % key_count], (fredc_val){ .type = JSON_INT, .integer = i });
+			fredc_val_free(&snap);
+		}
+		bench_stop(&snapshot, m_snapshot);
+		snapshot.ops = SNAPSHOTS;
+	} while (snapshot.seconds < BENCH_MIN_SECONDS);
+	report(c->name, "snapshot_set", snapshot);
+
+	if (found == 0) {
+		fprintf(stderr, "%s: no lookups succeeded\n", c->name);
+	}
+	free(keys);
+	fredc_val_free(&root);
+}
+
+// Compares two result files: prints the ratio new/old of every throughput
+static int compare(const char* old_path, const char* new_path) {
+	fredc_file files[2];
+	if (!fredc_file_open(files, old_path) || !fredc_file_open(files+1, new_path)) {
+		perror("(compare) fredc_file_open");
+		return 1;
+	}
+
+	fredc_doc* olds[1024];
+	size_t old_count = 0;
+	str8 text = files[0].contents;
+	for (size_t pos = 0; pos < text.length && old_count < 1024;) {
+		const char* nl = (const char*)memchr(text.data + pos, '\n', text.length - pos);
+		size_t end = nl ? (size_t)(nl - text.data) : text.length;
+		if (end > pos) {
+			olds[old_count++] = fredc_doc_parse(text.data + pos, end - pos);
+		}
+		pos = end+1;
+	}
+
+	printf("%-10s %-18s %12s %12s %8s\n", "corpus", "op", "old", "new", "ratio");
+	text = files[1].contents;
+	for (size_t pos = 0; pos < text.length;) {
+		const char* nl = (const char*)memchr(text.data + pos, '\n', text.length - pos);
+		size_t end = nl ? (size_t)(nl - text.data) : text.length;
+		fredc_doc* doc = fredc_doc_parse(text.data + pos, end - pos);
+		pos = end+1;
+		if (doc->root->type != JSON_OBJ) {
+			fredc_doc_free(doc);
+			continue;
+		}
+
+		fredc_val corpus = fredc_get_prop(doc->root->object, "corpus");
+		fredc_val op = fredc_get_prop(doc->root->object, "op");
+		const char* metric = fredc_get_prop(doc->root->object, "mb_s").type ? "mb_s" : "ops_s";
+		fredc_val now = fredc_get_prop(doc->root->object, metric);
+
+		for (size_t i = 0; i < old_count; i++) {
+			fredc_obj* old = olds[i]->root->object;
+			if (olds[i]->root->type != JSON_OBJ ||
+				!str8_cmp(fredc_get_prop(old, "corpus").string, corpus.string) ||
+				!str8_cmp(fredc_get_prop(old, "op").string, op.string)) {
+				continue;
+			}
+
+			fredc_val before = fredc_get_prop(old, metric);
+			double b = before.type == JSON_INT ? before.integer : before.number;
+			double a = now.type == JSON_INT ? now.integer : now.number;
+			printf("%-10.*s %-18.*s %12.1f %12.1f %7.2fx\n", (int)corpus.string.length, corpus.string.data,
+				(int)op.string.length, op.string.data, b, a, b > 0 ? a / b : 0);
+			break;
+		}
+		fredc_doc_free(doc);
+	}
+
+	for (size_t i = 0; i < old_count; i++) {
+		fredc_doc_free(olds[i]);
+	}
+	fredc_file_close(files);
+	fredc_file_close(files+1);
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	size_t size = BENCH_DEFAULT_MB;
+	const char* only = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--compare") == 0 && i+2 < argc) {
+			return compare(argv[i+1], argv[i+2]);
+		} else if (strcmp(argv[i], "--size") == 0 && i+1 < argc) {
+			size = (size_t)atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--corpus") == 0 && i+1 < argc) {
+			only = argv[++i];
+		} else {
+			fprintf(stderr, "usage: fredc_bench [--size MB] [--corpus name] | --compare old.txt new.txt\n");
+			return 1;
+		}
+	}
+	size *= 1024*1024;
+
+	struct {
+		const char* name;
+		void (*gen)(fredc_writer* w, size_t size);
+		bool lines;
+	} gens[] = {
+		{ "nested", gen_nested },
+		{ "wide", gen_wide },
+		{ "numbers", gen_numbers },
+		{ "strings", gen_strings },
+		{ "ndjson", gen_ndjson, true },
+	};
+
+	for (size_t i = 0; i < sizeof(gens)/sizeof(gens[0]); i++) {
+		if (only && strcmp(only, gens[i].name) != 0) {
+			continue;
+		}
+
+		fredc_writer w = {};
+		gens[i].gen(&w, size);
+		bench_corpus c = { gens[i].name, { w.data, w.length }, gens[i].lines };
+
+		bench_parse(&c);
+		bench_stringify(&c);
+		bench_diff(&c);
+		bench_pack(&c);
+		bench_get_set(&c);
+
+		fredc_writer_free(&w);
+	}
+
+	str8_free_pool();
+	return 0;
+}
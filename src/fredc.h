@@ -3,6 +3,8 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
 enum fredc_data_types {
 	JSON_UNDEFINED = 0,
@@ -11,7 +13,8 @@ enum fredc_data_types {
 	JSON_STRING,
 	JSON_BOOL,
 	JSON_OBJ,
-	JSON_LIST
+	JSON_LIST,
+	JSON_INT
 };
 
 typedef struct str8 {
@@ -28,9 +31,30 @@ typedef struct fredc_node fredc_node;
 typedef struct fredc_val fredc_val;
 typedef struct fredc_obj fredc_obj;
 
+typedef struct fredc_arena fredc_arena;
+typedef struct fredc_cache fredc_cache;
+typedef struct fredc_share fredc_share;
+
 typedef struct fredc_val_list {
-	fredc_val* data;
+	// Packed lists keep their elements in a plain array of packed type
+	// instead of data, see FREDC_PARSE_PACK
+	union {
+		fredc_val* data;
+		int64_t* ints;
+		double* nums;
+		bool* bools;
+	};
 	size_t length, capacity;
+	unsigned char packed; // JSON_INT, JSON_NUM or JSON_BOOL, 0 if not packed
+
+	fredc_arena* arena; // owning arena, 0 if heap allocated
+	fredc_cache* cache; // compact output, see fredc_write_opts.cache
+	uint64_t hash;      // content hash, see fredc_val_hash. 0 until computed
+	fredc_share* share; // storage shared with other containers, see fredc_val_share
+	// Container holding this one, recorded when that stores a hash or cache
+	// so that changes here reach it, see fredc_parents_dirty
+	fredc_obj* parent_obj;
+	struct fredc_val_list* parent_list;
 } fredc_list;
 
 typedef struct fredc_node_list {
@@ -38,21 +62,38 @@ typedef struct fredc_node_list {
 	size_t length, capacity;
 } fredc_node_list;
 
+// Hash map with a dense entries array in insertion order and an open
+// addressing index (linear probing) of entry positions. Small objects have
+// no index and are scanned instead, see FREDC_OBJ_FLAT.
 struct fredc_obj {
-	fredc_node* props; // hash map
-	size_t length;
+	fredc_node* props; // entries
+	size_t length, capacity;
 
-	fredc_node_list pool; // darr (dynamic array)
+	uint32_t* index; // entry position + 1, 0 marks an empty slot; 0 if small
+	size_t index_cap; // power of two
+
+	fredc_arena* arena; // owning arena, 0 if heap allocated
+	fredc_cache* cache; // compact output, see fredc_write_opts.cache
+	uint64_t hash;      // content hash, see fredc_val_hash. 0 until computed
+	fredc_share* share; // storage shared with other containers, see fredc_val_share
+	// Container holding this one, recorded when that stores a hash or cache
+	// so that changes here reach it, see fredc_parents_dirty
+	fredc_obj* parent_obj;
+	fredc_list* parent_list;
 };
 
+// A type tag and a 16 byte payload. Objects and lists live out of line, see
+// fredc_val_obj, so scalars and strings do not carry a container header and
+// values copied around refer to the same container.
 struct fredc_val {
 	enum fredc_data_types type;
 	union {
 		bool boolean;
 		double number;
+		int64_t integer;
 		str8 string;
-		fredc_obj object;
-		fredc_list list;
+		fredc_obj* object;
+		fredc_list* list;
 	};
 };
 
@@ -60,10 +101,172 @@ struct fredc_node {
 	str8 key;
 	fredc_val val;
 
-	fredc_node* next;
+	uint64_t hash; // fredc_hash_str8(key)
+};
+
+// Bump allocator backing a fredc_doc.
+// Memory is handed out from large chunks and released all at once.
+typedef struct fredc_arena_chunk fredc_arena_chunk;
+
+struct fredc_arena {
+	fredc_arena_chunk* head;
+	size_t chunk_size; // size of the next chunk to reserve
+
+	size_t bytes_used, bytes_reserved;
+	size_t chunks, allocations;
+
+	fredc_cache* caches; // serialization caches of the containers in the arena
+};
+
+typedef struct fredc_doc_stats {
+	size_t bytes_used;     // bytes handed out by the arena
+	size_t bytes_reserved; // bytes reserved in arena chunks
+	size_t bytes_scratch;  // peak temporary parser stack
+	size_t chunks, allocations;
+	size_t input_length;
+	unsigned long long parse_ns;
+} fredc_doc_stats;
+
+// A parsed document. Every node, key, string and list of the tree is
+// allocated from the document arena and is released by fredc_doc_free.
+// Values inside a document must not be passed to fredc_val_free.
+typedef struct fredc_doc {
+	fredc_arena arena;
+	fredc_val* root;
+	fredc_doc_stats stats;
+} fredc_doc;
+
+// Replacement for the C library allocator, see fredc_set_allocator. alloc and
+// free come as a pair. realloc may be 0, in which case it is done with alloc,
+// memcpy and free.
+typedef struct fredc_allocator {
+	void* (*alloc)(void* user, size_t size);
+	void* (*realloc)(void* user, void* ptr, size_t old_size, size_t new_size);
+	void (*free)(void* user, void* ptr);
+	void* user;
+} fredc_allocator;
+
+// Process wide allocation counters, see fredc_mem_get_stats
+typedef struct fredc_mem_stats {
+	size_t allocations, reallocations, frees;
+	size_t live;       // allocations not freed yet
+	size_t bytes_live; // bytes of those allocations, only counted with fredc_set_allocator
+	size_t bytes_peak; // highest bytes_live so far
+} fredc_mem_stats;
+
+// Strings owned by the calling thread's str8 pool
+typedef struct fredc_pool_stats {
+	size_t strings, bytes;
+} fredc_pool_stats;
+
+// Shape of the hash index of one object
+typedef struct fredc_obj_stats {
+	size_t length, capacity, index_cap;
+	double load;       // length / index_cap
+	size_t max_probe;  // most slots visited to find a present key
+	double mean_probe;
+} fredc_obj_stats;
+
+// Totals over a whole tree, see fredc_val_get_stats
+typedef struct fredc_tree_stats {
+	size_t objects, lists, strings, scalars;
+	size_t members;      // object members and list items
+	size_t string_bytes; // key and string value bytes
+	size_t max_depth;
+	size_t max_probe;    // worst fredc_obj_stats.max_probe in the tree
+	double max_load;     // worst fredc_obj_stats.load in the tree
+} fredc_tree_stats;
+
+bool fredc_set_allocator(const fredc_allocator* allocator);
+void* fredc_mem_alloc(size_t size);
+void* fredc_mem_calloc(size_t count, size_t size);
+void* fredc_mem_realloc(void* ptr, size_t size);
+void fredc_mem_free(void* ptr);
+void fredc_free(void* ptr);
+fredc_mem_stats fredc_mem_get_stats(void);
+fredc_pool_stats fredc_pool_get_stats(void);
+fredc_obj_stats fredc_obj_get_stats(fredc_obj* obj);
+fredc_tree_stats fredc_val_get_stats(fredc_val val);
+
+void* fredc_arena_alloc(fredc_arena* arena, size_t size);
+void* fredc_arena_realloc(fredc_arena* arena, void* ptr, size_t old_size, size_t new_size);
+void fredc_arena_free(fredc_arena* arena);
+
+enum fredc_parse_flags {
+	// Keys and strings of the tree point into the parsed text instead of
+	// being copied, so the text must outlive the document. Such strings are
+	// not null terminated. Only strings with escapes to decode are copied.
+	FREDC_PARSE_INSITU = 1 << 0,
+	// Every distinct key is stored once per document and shared by all the
+	// objects using it, so equal keys also compare equal by pointer.
+	FREDC_PARSE_INTERN = 1 << 1,
+	// Also share string values of up to FREDC_INTERN_MAX_STRING bytes
+	FREDC_PARSE_INTERN_STRINGS = 1 << 2,
+	// Lists of only numbers or only booleans are stored packed, at 8 bytes
+	// (1 for booleans) per element. Integers share a list with doubles when
+	// a double holds them exactly, and are read back as doubles then.
+	// Read their elements with fredc_list_get rather than data. Changes
+	// through the library turn them back into regular lists first.
+	FREDC_PARSE_PACK = 1 << 3,
+};
+
+#define FREDC_INTERN_MAX_STRING 32
+
+fredc_doc* fredc_doc_parse(const char* contents, size_t length);
+fredc_doc* fredc_doc_parse_ex(const char* contents, size_t length, unsigned flags);
+// Splits the largest top-level container across up to threads workers, or one
+// per core when threads is 0. Needs FREDC_THREADS defined (and -pthread)
+// where the implementation is compiled, otherwise parses on the calling thread.
+fredc_doc* fredc_doc_parse_parallel(const char* contents, size_t length, unsigned flags, int threads);
+fredc_doc_stats fredc_doc_get_stats(fredc_doc* doc);
+void fredc_doc_free(fredc_doc* doc);
+
+uint64_t fredc_hash_str8(str8 s);
+
+// A whole file in memory. Regular files are mapped read-only where the
+// platform allows it, anything else (pipes, "-" for stdin) is read into a
+// heap buffer.
+typedef struct fredc_file {
+	str8 contents;
+	bool mapped;
+} fredc_file;
+
+bool fredc_file_open(fredc_file* file, const char* path);
+void fredc_file_close(fredc_file* file);
+
+// Large enough for any number written by fredc_format_double/fredc_format_int
+#define FREDC_NUM_BUF 32
+
+// Positions of every token start in a JSON text, see fredc_index_build
+typedef struct fredc_index {
+	uint32_t* data;
+	size_t length, capacity;
+} fredc_index;
+
+fredc_index fredc_index_build(const char* contents, size_t length);
+void fredc_index_free(fredc_index* idx);
+
+fredc_val fredc_parse_number(const char* s, size_t length, size_t* consumed);
+size_t fredc_unescape(const char* src, size_t length, char* dst);
+size_t fredc_format_double(double value, char* buf);
+size_t fredc_format_int(int64_t value, char* buf);
+
+// Outcome of fredc_validate
+typedef struct fredc_validate_result {
+	bool valid;
+	size_t offset;     // byte offset of the first error
+	const char* error; // what is wrong there, 0 if valid
+} fredc_validate_result;
+
+enum fredc_validate_flags {
+	// Accept a comma before a closing bracket, like the parser does
+	FREDC_VALIDATE_TRAILING_COMMAS = 1 << 0,
 };
 
 fredc_obj new_fredc_obj(size_t length);
+fredc_val fredc_val_obj(fredc_obj obj);
+fredc_val fredc_val_list(fredc_list list);
+fredc_validate_result fredc_validate(const char* contents, size_t length, unsigned flags);
 bool fredc_validate_json(const char* contents, size_t length);
 fredc_obj fredc_parse_obj_str(const char* contents, size_t length);
 fredc_list fredc_parse_list_str(const char* contents, size_t length);
@@ -71,6 +274,213 @@ fredc_list fredc_parse_list_str(const char* contents, size_t length);
 fredc_val fredc_get_prop(fredc_obj* obj, const char* key);
 fredc_val fredc_set_prop(fredc_obj* obj, const char* key, fredc_val val);
 
+fredc_val fredc_list_get(const fredc_list* list, size_t index);
+double fredc_list_sum(const fredc_list* list);
+double fredc_list_min(const fredc_list* list);
+double fredc_list_max(const fredc_list* list);
+size_t fredc_list_count(const fredc_list* list, fredc_val val);
+
+// One step of a compiled path: an object key or a list index
+typedef struct fredc_path_seg {
+	str8 key;
+	uint64_t hash;
+	size_t index;
+	bool is_index;
+} fredc_path_seg;
+
+// A path such as a.b[3].c or ["key.with.dots"][0] parsed once, with the
+// hash of every key precomputed, so it can be evaluated without allocating.
+// Keys are copied and do not refer to the source string.
+typedef struct fredc_path {
+	fredc_path_seg* data;
+	size_t length;
+	bool valid;
+} fredc_path;
+
+fredc_path fredc_path_compile(const char* path);
+void fredc_path_free(fredc_path* path);
+fredc_val fredc_path_get(fredc_val root, const fredc_path* path);
+fredc_val fredc_path_set(fredc_obj* obj, const fredc_path* path, fredc_val val);
+
+fredc_val fredc_get_prop_js(fredc_obj* obj, const char* path);
+fredc_val fredc_set_prop_js(fredc_obj* obj, const char* path, fredc_val val);
+
+// Outcome of fredc_patch_apply
+typedef struct fredc_patch_result {
+	bool ok;
+	size_t op;         // position of the failed operation in the patch
+	const char* error; // what went wrong, 0 if ok
+} fredc_patch_result;
+
+fredc_val fredc_val_clone(fredc_val val);
+fredc_val fredc_val_share(fredc_val val);
+bool fredc_val_equal(fredc_val a, fredc_val b);
+uint64_t fredc_val_hash(fredc_val val);
+fredc_val fredc_diff(fredc_val from, fredc_val to);
+void fredc_val_touch(fredc_val val);
+bool fredc_obj_remove(fredc_obj* obj, const char* key);
+fredc_val fredc_pointer_get(fredc_val root, const char* pointer);
+fredc_patch_result fredc_patch_apply(fredc_val* root, fredc_val patch);
+void fredc_merge_patch(fredc_val* root, fredc_val patch);
+
+// Serializer output options
+typedef struct fredc_write_opts {
+	int indent; // spaces per nesting level, 0 writes compact (minified) JSON
+	// Keep the compact output of nested containers of at least FREDC_CACHE_MIN
+	// bytes so later compact writes copy it instead of walking them again.
+	// Every cached level of nesting holds its own copy of its output.
+	// fredc_path_set and the patch functions drop the caches of every
+	// container on their path, fredc_push_prop only that of its object. Other
+	// changes require fredc_val_touch on the container and each of its parents
+	// beforehand.
+	bool cache;
+} fredc_write_opts;
+
+#define FREDC_CACHE_MIN 4096
+
+// Sink callback: returns the number of bytes consumed, anything short of
+// length is treated as an error.
+typedef size_t (*fredc_write_fn)(void* user, const char* data, size_t length);
+
+// Output target of the serializer. Depending on how it was created it
+// appends to a growable heap buffer (zero initialized writer), fills a
+// caller owned fixed buffer, or buffers and forwards to a callback/FILE*.
+typedef struct fredc_writer {
+	char* data;
+	size_t length, capacity;
+	bool fixed; // data is caller owned and never grown
+
+	fredc_write_fn write;
+	void* user;
+
+	size_t total; // bytes produced, including any that did not fit a fixed buffer
+	bool error;
+} fredc_writer;
+
+fredc_writer fredc_writer_buf(char* buf, size_t capacity);
+fredc_writer fredc_writer_cb(fredc_write_fn write, void* user);
+fredc_writer fredc_writer_file(FILE* file);
+bool fredc_writer_flush(fredc_writer* w);
+void fredc_writer_free(fredc_writer* w);
+
+size_t fredc_val_write(fredc_writer* w, fredc_val val, fredc_write_opts opts);
+size_t fredc_val_measure(fredc_val val, fredc_write_opts opts);
+str8 fredc_val_to_str8(fredc_val val, fredc_write_opts opts);
+
+// Lazily evaluated document: the input plus its structural index and the
+// matching close of every container, see fredc_lazy_parse
+typedef struct fredc_lazy {
+	const char* data;
+	size_t length;
+
+	fredc_index index;
+	uint32_t* close; // per token: token of the matching '}' or ']'
+} fredc_lazy;
+
+// A position in a fredc_lazy document
+typedef struct fredc_lazy_val {
+	fredc_lazy* doc;
+	uint32_t token;
+} fredc_lazy_val;
+
+fredc_lazy* fredc_lazy_parse(const char* contents, size_t length);
+void fredc_lazy_free(fredc_lazy* doc);
+
+fredc_lazy_val fredc_lazy_root(fredc_lazy* doc);
+enum fredc_data_types fredc_lazy_type(fredc_lazy_val v);
+fredc_lazy_val fredc_lazy_get(fredc_lazy_val obj, const char* key);
+fredc_lazy_val fredc_lazy_get_js(fredc_lazy_val v, const char* key);
+fredc_lazy_val fredc_lazy_at(fredc_lazy_val list, size_t i);
+size_t fredc_lazy_length(fredc_lazy_val v);
+str8 fredc_lazy_str8(fredc_lazy_val v);
+fredc_val fredc_lazy_scalar(fredc_lazy_val v);
+fredc_val fredc_lazy_materialize(fredc_lazy_val v);
+
+// Binary encoding of a tree, see fredc_bin_encode. Values are fixed size
+// slots and containers are arrays of slots found by offset, so an encoded
+// buffer (for example a mapped file) is read in place without decoding.
+typedef struct fredc_bin {
+	const char* data;
+	size_t length;
+} fredc_bin;
+
+// A value in a fredc_bin buffer
+typedef struct fredc_bin_val {
+	const fredc_bin* bin;
+	uint32_t slot; // offset of the value's slot, 0 for none
+} fredc_bin_val;
+
+str8 fredc_bin_encode(fredc_val val);
+bool fredc_bin_open(fredc_bin* bin, const char* data, size_t length);
+fredc_doc* fredc_bin_decode(const char* data, size_t length, unsigned flags);
+
+fredc_bin_val fredc_bin_root(const fredc_bin* bin);
+enum fredc_data_types fredc_bin_type(fredc_bin_val v);
+fredc_bin_val fredc_bin_get(fredc_bin_val obj, const char* key);
+fredc_bin_val fredc_bin_at(fredc_bin_val v, size_t i);
+str8 fredc_bin_key(fredc_bin_val obj, size_t i);
+size_t fredc_bin_length(fredc_bin_val v);
+str8 fredc_bin_str8(fredc_bin_val v);
+fredc_val fredc_bin_scalar(fredc_bin_val v);
+
+// Event handler for fredc_sax. Any callback may be 0; returning false stops
+// the parse. str8 arguments are only valid for the duration of the call.
+typedef struct fredc_sax_handler {
+	void* user;
+	bool (*start_object)(void* user);
+	bool (*end_object)(void* user);
+	bool (*start_list)(void* user);
+	bool (*end_list)(void* user);
+	bool (*key)(void* user, str8 key);
+	bool (*string)(void* user, str8 s);
+	bool (*number)(void* user, double n);
+	bool (*integer)(void* user, int64_t n);
+	bool (*boolean)(void* user, bool b);
+	bool (*null)(void* user);
+} fredc_sax_handler;
+
+// Incremental event parser state, see fredc_sax_feed
+typedef struct fredc_sax {
+	fredc_sax_handler handler;
+	int state;
+
+	bool* stack; // true for objects
+	size_t depth, stack_cap;
+
+	char* token; // token split across chunks
+	size_t token_length, token_cap;
+	int token_kind;
+	bool escape; // the previous chunk ended on a backslash inside a string
+	bool escaped; // the current string has escapes to decode
+
+	size_t offset; // bytes fed so far
+	size_t error_offset;
+	bool error;
+} fredc_sax;
+
+void fredc_sax_init(fredc_sax* s, fredc_sax_handler handler);
+bool fredc_sax_feed(fredc_sax* s, const char* chunk, size_t length);
+bool fredc_sax_finish(fredc_sax* s);
+void fredc_sax_free(fredc_sax* s);
+
+typedef struct fredc_builder_frame {
+	size_t base; // first member on the scratch stack
+	bool is_obj;
+} fredc_builder_frame;
+
+// SAX handler state that assembles a heap allocated fredc_val
+typedef struct fredc_tree_builder {
+	fredc_list vals;
+	fredc_node_list nodes;
+	fredc_builder_frame* frames;
+	size_t depth, frames_cap;
+
+	fredc_val root;
+} fredc_tree_builder;
+
+fredc_sax_handler fredc_tree_builder_handler(fredc_tree_builder* b);
+fredc_val fredc_tree_builder_finish(fredc_tree_builder* b);
+
 str8 fredc_val_str8ify(fredc_val val, int indent);
 str8 fredc_node_str8ify(fredc_node prop, int indent);
 str8 fredc_obj_str8ify(fredc_obj o);
@@ -80,6 +490,7 @@ void fredc_val_free(fredc_val *v);
 void fredc_node_free(fredc_node *n);
 void fredc_obj_free(fredc_obj* o);
 
+// Frees every pooled string created by the calling thread
 void str8_free_pool();
 
 #endif
@@ -88,13 +499,179 @@ void str8_free_pool();
 
 #include <assert.h>
 #include <ctype.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#ifdef FREDC_THREADS
+#include <pthread.h>
+#endif
+
+// Allocation
+// Every allocation of the library goes through these macros. Define all four
+// before including the implementation to replace them at compile time.
+// By default they are counted (fredc_mem_get_stats) and served by the
+// allocator set with fredc_set_allocator, or by the C library.
+#ifndef FREDC_MALLOC
+#define FREDC_MALLOC(size) fredc_mem_alloc(size)
+#define FREDC_CALLOC(count, size) fredc_mem_calloc(count, size)
+#define FREDC_REALLOC(ptr, size) fredc_mem_realloc(ptr, size)
+#define FREDC_FREE(ptr) fredc_mem_free(ptr)
+#endif
+
+static fredc_allocator fredc_allocator_current;
+
+static struct {
+	atomic_size_t allocations, reallocations, frees;
+	atomic_size_t bytes_live, bytes_peak;
+} fredc_mem_counters;
+
+// With a custom allocator every block starts with its size, so frees and
+// reallocations can be accounted for and the allocator is told the old size.
+// The header is 16 bytes to keep blocks aligned for any type. C library blocks
+// have none and stay valid to release with free().
+typedef union fredc_mem_header {
+	size_t size;
+	max_align_t align;
+} fredc_mem_header;
+
+static void fredc_mem_track(size_t added, size_t removed) {
+	size_t live = atomic_fetch_add_explicit(&fredc_mem_counters.bytes_live, added - removed, memory_order_relaxed) + added - removed;
+	size_t peak = atomic_load_explicit(&fredc_mem_counters.bytes_peak, memory_order_relaxed);
+	while (live > peak && !atomic_compare_exchange_weak_explicit(&fredc_mem_counters.bytes_peak, &peak, live,
+		memory_order_relaxed, memory_order_relaxed)) {
+	}
+}
+
+// Sets the allocator used for all later allocations, or the C library for 0.
+// Memory must be freed by the allocator that allocated it, so set this before
+// anything is allocated and keep it until everything has been freed.
+// returns: false, leaving the allocator unchanged, if alloc or free is missing
+bool fredc_set_allocator(const fredc_allocator* allocator) {
+	if (allocator && (allocator->alloc == 0 || allocator->free == 0)) {
+		return false;
+	}
+	fredc_allocator_current = allocator ? *allocator : (fredc_allocator){0};
+	return true;
+}
+
+void* fredc_mem_alloc(size_t size) {
+	fredc_allocator* a = &fredc_allocator_current;
+	if (a->alloc == 0) {
+		void* result = malloc(size);
+		if (result) {
+			atomic_fetch_add_explicit(&fredc_mem_counters.allocations, 1, memory_order_relaxed);
+		}
+		return result;
+	}
+
+	fredc_mem_header* block = (fredc_mem_header*)a->alloc(a->user, sizeof(fredc_mem_header) + size);
+	if (block == 0) {
+		return 0;
+	}
+
+	block->size = size;
+	atomic_fetch_add_explicit(&fredc_mem_counters.allocations, 1, memory_order_relaxed);
+	fredc_mem_track(size, 0);
+	return block+1;
+}
+
+void* fredc_mem_calloc(size_t count, size_t size) {
+	if (size && count > SIZE_MAX / size) {
+		return 0;
+	}
+	void* result = fredc_mem_alloc(count * size);
+	if (result) {
+		memset(result, 0, count * size);
+	}
+	return result;
+}
+
+void* fredc_mem_realloc(void* ptr, size_t size) {
+	if (ptr == 0) {
+		return fredc_mem_alloc(size);
+	}
+
+	fredc_allocator* a = &fredc_allocator_current;
+	if (a->alloc == 0) {
+		void* result = realloc(ptr, size);
+		if (result) {
+			atomic_fetch_add_explicit(&fredc_mem_counters.reallocations, 1, memory_order_relaxed);
+		}
+		return result;
+	}
+
+	fredc_mem_header* block = (fredc_mem_header*)ptr - 1;
+	size_t old_size = block->size;
+	fredc_mem_header* grown;
+	if (a->realloc) {
+		grown = (fredc_mem_header*)a->realloc(a->user, block, sizeof(fredc_mem_header) + old_size, sizeof(fredc_mem_header) + size);
+	} else {
+		grown = (fredc_mem_header*)a->alloc(a->user, sizeof(fredc_mem_header) + size);
+		if (grown) {
+			memcpy(grown+1, block+1, old_size < size ? old_size : size);
+			a->free(a->user, block);
+		}
+	}
+	if (grown == 0) {
+		return 0;
+	}
+
+	grown->size = size;
+	atomic_fetch_add_explicit(&fredc_mem_counters.reallocations, 1, memory_order_relaxed);
+	fredc_mem_track(size, old_size);
+	return grown+1;
+}
+
+void fredc_mem_free(void* ptr) {
+	if (ptr == 0) {
+		return;
+	}
+
+	atomic_fetch_add_explicit(&fredc_mem_counters.frees, 1, memory_order_relaxed);
+	fredc_allocator* a = &fredc_allocator_current;
+	if (a->alloc == 0) {
+		free(ptr);
+		return;
+	}
+
+	fredc_mem_header* block = (fredc_mem_header*)ptr - 1;
+	fredc_mem_track(0, block->size);
+	a->free(a->user, block);
+}
+
+// Frees memory returned by the library, such as fredc_bin_encode results.
+// Unless an allocator is set with fredc_set_allocator, free() works as well.
+void fredc_free(void* ptr) {
+	FREDC_FREE(ptr);
+}
+
+fredc_mem_stats fredc_mem_get_stats(void) {
+	fredc_mem_stats result = {
+		.allocations = atomic_load(&fredc_mem_counters.allocations),
+		.reallocations = atomic_load(&fredc_mem_counters.reallocations),
+		.frees = atomic_load(&fredc_mem_counters.frees),
+		.bytes_live = atomic_load(&fredc_mem_counters.bytes_live),
+		.bytes_peak = atomic_load(&fredc_mem_counters.bytes_peak),
+	};
+	result.live = result.allocations - result.frees;
+	return result;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+#define FREDC_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #define FREDC_DARR_MIN_CAP 16
 #define fredc_darr_resize(arr, type, new_cap) {\
-	arr.data = (type*)realloc(arr.data, sizeof(type)*(new_cap > 0 ? new_cap : FREDC_DARR_MIN_CAP));\
+	arr.data = (type*)FREDC_REALLOC(arr.data, sizeof(type)*(new_cap > 0 ? new_cap : FREDC_DARR_MIN_CAP));\
 	assert(arr.data);\
 	arr.capacity = new_cap > 0 ? new_cap : FREDC_DARR_MIN_CAP;\
 	if (arr.length > arr.capacity) { arr.length = arr.capacity; }\
@@ -115,18 +692,274 @@ void str8_free_pool();
 
 #define fredc_darr_push_darr(arr, type, parr) fredc_darr_push_arr(arr, type, parr.data, parr.length)
 
-static str8_list pool = {};
+#define FREDC_ARENA_MIN_CHUNK (64*1024)
+#define FREDC_ARENA_MAX_CHUNK (64*1024*1024)
+#define FREDC_ARENA_ALIGN 16
+
+struct fredc_arena_chunk {
+	fredc_arena_chunk* next;
+	size_t used, capacity;
+	_Alignas(FREDC_ARENA_ALIGN) unsigned char data[];
+};
+
+static fredc_arena_chunk* fredc_arena_new_chunk(fredc_arena* arena, size_t capacity) {
+	fredc_arena_chunk* chunk = (fredc_arena_chunk*)FREDC_MALLOC(sizeof(fredc_arena_chunk) + capacity);
+	assert(chunk);
+	chunk->next = 0;
+	chunk->used = 0;
+	chunk->capacity = capacity;
+
+	arena->bytes_reserved += capacity;
+	arena->chunks++;
+
+	return chunk;
+}
+
+void* fredc_arena_alloc(fredc_arena* arena, size_t size) {
+	size = (size + FREDC_ARENA_ALIGN-1) & ~(size_t)(FREDC_ARENA_ALIGN-1);
+	if (size == 0) {
+		size = FREDC_ARENA_ALIGN;
+	}
+
+	fredc_arena_chunk* chunk = arena->head;
+	if (chunk == 0 || chunk->capacity - chunk->used < size) {
+		if (arena->chunk_size < FREDC_ARENA_MIN_CHUNK) {
+			arena->chunk_size = FREDC_ARENA_MIN_CHUNK;
+		}
+
+		if (size > arena->chunk_size / 4 && chunk) {
+			// Oversized allocation: give it its own chunk behind the current one
+			// so the free space left in the head chunk is not wasted.
+			fredc_arena_chunk* big = fredc_arena_new_chunk(arena, size);
+			big->next = chunk->next;
+			chunk->next = big;
+			chunk = big;
+		} else {
+			size_t capacity = arena->chunk_size;
+			while (capacity < size) {
+				capacity *= 2;
+			}
+			chunk = fredc_arena_new_chunk(arena, capacity);
+			chunk->next = arena->head;
+			arena->head = chunk;
+
+			if (arena->chunk_size < FREDC_ARENA_MAX_CHUNK) {
+				arena->chunk_size *= 2;
+			}
+		}
+	}
+
+	void* result = chunk->data + chunk->used;
+	chunk->used += size;
+	arena->bytes_used += size;
+	arena->allocations++;
+
+	return result;
+}
+
+void* fredc_arena_realloc(fredc_arena* arena, void* ptr, size_t old_size, size_t new_size) {
+	if (ptr == 0) {
+		return fredc_arena_alloc(arena, new_size);
+	}
+
+	old_size = (old_size + FREDC_ARENA_ALIGN-1) & ~(size_t)(FREDC_ARENA_ALIGN-1);
+	size_t grown = (new_size + FREDC_ARENA_ALIGN-1) & ~(size_t)(FREDC_ARENA_ALIGN-1);
+
+	// Extend in place when ptr is the most recent allocation of the head chunk
+	fredc_arena_chunk* chunk = arena->head;
+	if (chunk && (unsigned char*)ptr + old_size == chunk->data + chunk->used) {
+		if (grown <= old_size) {
+			return ptr;
+		}
+		if (chunk->used - old_size + grown <= chunk->capacity) {
+			chunk->used += grown - old_size;
+			arena->bytes_used += grown - old_size;
+			return ptr;
+		}
+	}
+
+	if (new_size <= old_size) {
+		return ptr;
+	}
+
+	void* result = fredc_arena_alloc(arena, new_size);
+	memcpy(result, ptr, old_size);
+	return result;
+}
+
+// Serialization caches
+// A copy of the compact output of one container, kept in a heap block of its
+// own. The caches of arena containers are linked into the arena, which frees
+// whatever is left of them with its chunks.
+struct fredc_cache {
+	fredc_cache *prev, *next;
+	size_t length;
+	char data[];
+};
+
+static void fredc_cache_drop(fredc_arena* arena, fredc_cache** cache) {
+	fredc_cache* c = *cache;
+	if (c == 0) {
+		return;
+	}
+	if (arena) {
+		if (c->prev) {
+			c->prev->next = c->next;
+		} else {
+			arena->caches = c->next;
+		}
+		if (c->next) {
+			c->next->prev = c->prev;
+		}
+	}
+	FREDC_FREE(c);
+	*cache = 0;
+}
+
+static void fredc_cache_set(fredc_arena* arena, fredc_cache** cache, const char* data, size_t length) {
+	fredc_cache_drop(arena, cache);
+	fredc_cache* c = (fredc_cache*)FREDC_MALLOC(sizeof(fredc_cache) + length);
+	if (c == 0) {
+		return;
+	}
+	*c = (fredc_cache){ .length = length };
+	memcpy(c->data, data, length);
+	if (arena) {
+		c->next = arena->caches;
+		if (c->next) {
+			c->next->prev = c;
+		}
+		arena->caches = c;
+	}
+	*cache = c;
+}
+
+static void fredc_obj_unshare(fredc_obj* obj);
+static void fredc_list_unshare(fredc_list* list);
+static void fredc_list_unpack(fredc_list* list);
+
+static bool fredc_val_shares_storage(fredc_val val);
+
+// Drops the cached output and hash of the containers above a changed one,
+// following the links left by fredc_val_link
+static void fredc_parents_dirty(fredc_obj* obj, fredc_list* list) {
+	while (obj || list) {
+		if (obj) {
+			fredc_cache_drop(obj->arena, &obj->cache);
+			obj->hash = 0;
+			list = obj->parent_list;
+			obj = obj->parent_obj;
+		} else {
+			fredc_cache_drop(list->arena, &list->cache);
+			list->hash = 0;
+			obj = list->parent_obj;
+			list = list->parent_list;
+		}
+	}
+}
+
+// Records that child sits in parent_obj or parent_list (or nowhere, when
+// both are 0), for containers that keep a hash or cache of their contents
+static void fredc_val_link(fredc_val child, fredc_obj* parent_obj, fredc_list* parent_list) {
+	if (child.type == JSON_OBJ) {
+		child.object->parent_obj = parent_obj;
+		child.object->parent_list = parent_list;
+	} else if (child.type == JSON_LIST) {
+		child.list->parent_obj = parent_obj;
+		child.list->parent_list = parent_list;
+	}
+}
+
+// Called before every change to a container: it gets storage of its own if
+// it shares any, packed lists are unpacked, and neither its cached output nor
+// its content hash hold afterwards, nor those of the containers above it
+static void fredc_obj_dirty(fredc_obj* obj) {
+	fredc_obj_unshare(obj);
+	fredc_cache_drop(obj->arena, &obj->cache);
+	obj->hash = 0;
+	fredc_parents_dirty(obj->parent_obj, obj->parent_list);
+}
+
+static void fredc_list_dirty(fredc_list* list) {
+	fredc_list_unshare(list);
+	fredc_list_unpack(list);
+	fredc_cache_drop(list->arena, &list->cache);
+	list->hash = 0;
+	fredc_parents_dirty(list->parent_obj, list->parent_list);
+}
+
+void fredc_arena_free(fredc_arena* arena) {
+	fredc_cache* cache = arena->caches;
+	while (cache) {
+		fredc_cache* next = cache->next;
+		FREDC_FREE(cache);
+		cache = next;
+	}
+
+	fredc_arena_chunk* chunk = arena->head;
+	while (chunk) {
+		fredc_arena_chunk* next = chunk->next;
+		FREDC_FREE(chunk);
+		chunk = next;
+	}
+	*arena = (fredc_arena){};
+}
+
+// Allocation helpers for containers that may or may not live in an arena
+static void* fredc_alloc(fredc_arena* arena, size_t size) {
+	void* result = arena ? fredc_arena_alloc(arena, size) : FREDC_MALLOC(size);
+	assert(result);
+	return result;
+}
+
+static void* fredc_realloc(fredc_arena* arena, void* ptr, size_t old_size, size_t new_size) {
+	void* result = arena ? fredc_arena_realloc(arena, ptr, old_size, new_size) : FREDC_REALLOC(ptr, new_size);
+	assert(result);
+	return result;
+}
+
+static void fredc_release(fredc_arena* arena, void* ptr) {
+	if (arena == 0) {
+		FREDC_FREE(ptr);
+	}
+}
+
+static unsigned long long fredc_now_ns() {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (unsigned long long)ts.tv_sec * 1000000000ull + (unsigned long long)ts.tv_nsec;
+}
+
+#if defined(_MSC_VER)
+	#define FREDC_THREAD_LOCAL __declspec(thread)
+#else
+	#define FREDC_THREAD_LOCAL _Thread_local
+#endif
+
+// Strings allocated with new_str8(..., false) are owned by the pool of the
+// thread that created them. Nothing else in fredc is shared between threads,
+// so independent documents can be parsed and stringified concurrently.
+// Each thread releases its own strings with str8_free_pool.
+static FREDC_THREAD_LOCAL str8_list pool = {};
 
 void str8_free_pool() {
 	if (pool.data && pool.capacity) {
 		for (int i = 0; i < pool.length; i++) {
-			free(pool.data[i].data);
+			FREDC_FREE(pool.data[i].data);
 		}
 	}
-	free(pool.data);
+	FREDC_FREE(pool.data);
 	pool = (str8_list){};
 }
 
+fredc_pool_stats fredc_pool_get_stats(void) {
+	fredc_pool_stats result = { .strings = pool.length };
+	for (size_t i = 0; i < pool.length; i++) {
+		result.bytes += pool.data[i].length+1;
+	}
+	return result;
+}
+
 str8 new_str8(const char* data, size_t length, bool inplace) {
 	if (length == 0) {
 		return (str8){};
@@ -139,7 +972,7 @@ str8 new_str8(const char* data, size_t length, bool inplace) {
 	}
 
 	str8 result = {
-		.data = (char*)malloc(length+1),
+		.data = (char*)FREDC_MALLOC(length+1),
 		.length = length
 	};
 	if (data != 0 && data[0] != '\0') {
@@ -157,35 +990,23 @@ bool str8_cmp(str8 left, str8 right) {
 		return false;
 	}
 
-	for (int i = 0; i < left.length; i++) {
-		if (left.data[i] != right.data[i]) {
-			return false;
-		}
-	}
-
-	return true;
+	return left.length == 0 || memcmp(left.data, right.data, left.length) == 0;
 }
 
+// The byte searches below use memchr, which libc vectorizes
 bool str8_contains(str8 s, int c) {
-	for (int i = 0; i < s.length; i++) {
-		if (s.data[i] == c) {
-			return true;
-		}
-	}
-
-	return false;
+	return s.length && memchr(s.data, c, s.length) != 0;
 }
 
 str8* str8_cut(str8 s, int sep, bool inplace) {
 	str8* result = 0;
 
-	for (int i = 0; i < s.length; i++) {
-		if (s.data[i] == sep) {
-			result = (str8*)calloc(sizeof(str8), 2);
-			result[0] = new_str8(s.data, i, inplace);
-			result[1] = new_str8(s.data+i+1, s.length-i-1, inplace);
-			break;
-		};
+	const char* found = s.length ? (const char*)memchr(s.data, sep, s.length) : 0;
+	if (found) {
+		size_t i = (size_t)(found - s.data);
+		result = (str8*)FREDC_CALLOC(sizeof(str8), 2);
+		result[0] = new_str8(s.data, i, inplace);
+		result[1] = new_str8(s.data+i+1, s.length-i-1, inplace);
 	}
 
 	return result;
@@ -214,13 +1035,12 @@ str8 str8_list_concat(str8_list list) {
 str8_list str8_split(str8 s, int delim, bool inplace) {
 	str8_list result = {};
 
-	int start = 0, c = 0;
-	for (; c < s.length; c++) {
-		if (s.data[c] == delim) {
-			str8 substr = {.data=s.data+start, .length=c-start};
-			fredc_darr_push(result, str8, new_str8(substr.data, substr.length, inplace));
-			start = c+1;
-		}
+	size_t start = 0, c = s.length;
+	const char* found;
+	while (start < s.length && (found = (const char*)memchr(s.data+start, delim, s.length-start))) {
+		size_t end = (size_t)(found - s.data);
+		fredc_darr_push(result, str8, new_str8(s.data+start, end-start, inplace));
+		start = end+1;
 	}
 
 	if (result.length == 0) {
@@ -273,495 +1093,5562 @@ str8 str8_trim(str8 s, str8 cutset, bool inplace) {
 	return result;
 }
 
-#define FREDC_OBJ_MIN 16
-
-static size_t fredc_hash(fredc_obj* obj, str8 key) {
-	size_t result = 0;
+// wyhash style multiply-mix: the 128 bit product folded back to 64 bits
+static inline uint64_t fredc_mix(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+	__uint128_t r = (__uint128_t)a * b;
+	return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+	uint64_t ha = a >> 32, la = (uint32_t)a, hb = b >> 32, lb = (uint32_t)b;
+	uint64_t rh = ha*hb, rm0 = ha*lb, rm1 = hb*la, rl = la*lb;
+	uint64_t t = rl + (rm0 << 32), c = t < rl;
+	uint64_t lo = t + (rm1 << 32);
+	c += lo < t;
+	uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+	return lo ^ hi;
+#endif
+}
 
-	for (int i = 0; i < key.length; i++) {
-		result += key.data[i] << 1;
-	}
+#define FREDC_HASH_P0 0xa0761d6478bd642full
+#define FREDC_HASH_P1 0xe7037ed1a0b428dbull
+#define FREDC_HASH_P2 0x8ebc6af09c88c6e3ull
 
-	return result % obj->length;
+static inline uint64_t fredc_read_u64(const char* p) {
+	uint64_t result;
+	memcpy(&result, p, 8);
+	return result;
 }
 
-fredc_obj new_fredc_obj(size_t length) {
-	if (length < FREDC_OBJ_MIN) {
-		length = FREDC_OBJ_MIN;
+static uint64_t fredc_hash_bytes(const char* data, size_t length, uint64_t seed) {
+	uint64_t h = seed ^ FREDC_HASH_P0;
+	size_t i = length;
+
+	for (; i >= 16; i -= 16, data += 16) {
+		h = fredc_mix(fredc_read_u64(data) ^ FREDC_HASH_P1, fredc_read_u64(data+8) ^ h);
+	}
+	if (i >= 8) {
+		h = fredc_mix(fredc_read_u64(data) ^ FREDC_HASH_P1, h ^ FREDC_HASH_P2);
+		i -= 8;
+		data += 8;
 	}
 
-	fredc_obj result = (fredc_obj) {
-		.props = (fredc_node*)calloc(length, sizeof(fredc_node)),
-		.length = length,
-	};
+	uint64_t tail = 0;
+	for (size_t b = 0; b < i; b++) {
+		tail |= (uint64_t)(unsigned char)data[b] << (b*8);
+	}
 
-	return result;
+	return fredc_mix(fredc_mix(tail ^ FREDC_HASH_P1, h ^ length), FREDC_HASH_P2);
 }
 
-void fredc_push_prop(fredc_obj* obj, str8 key, fredc_val prop) {
-	size_t index = fredc_hash(obj, key);
-	assert(index < obj->length);
+uint64_t fredc_hash_str8(str8 s) {
+	return fredc_hash_bytes(s.data, s.length, 0);
+}
 
-	str8 key2;
-	key2.length = key.length;
-	key2.data = (char*)malloc(key2.length+1);
-	memcpy(key2.data, key.data, key2.length);
+// Objects of up to FREDC_OBJ_FLAT props have no index and are searched
+// linearly, comparing hashes first. The index is built when one grows past
+// that, starting at FREDC_OBJ_MIN slots.
+#define FREDC_OBJ_FLAT 8
+#define FREDC_OBJ_MIN 16
 
-	fredc_node* dest = obj->props + index;
-	if (dest->key.length == 0) {
-		dest->key = key2;
-		dest->val = prop;
-	} else if (str8_cmp(dest->key, key2) ) {
-		free(key2.data);
-		fredc_val_free(&dest->val);
-		dest->val = prop;
-	} else {
-		while (dest->next) {
-			dest = dest->next;
+static void fredc_obj_reindex(fredc_obj* obj, size_t index_cap) {
+	fredc_release(obj->arena, obj->index);
+	obj->index = (uint32_t*)fredc_alloc(obj->arena, index_cap * sizeof(uint32_t));
+	memset(obj->index, 0, index_cap * sizeof(uint32_t));
+	obj->index_cap = index_cap;
+
+	size_t mask = index_cap-1;
+	for (size_t e = 0; e < obj->length; e++) {
+		size_t slot = obj->props[e].hash & mask;
+		while (obj->index[slot]) {
+			slot = (slot+1) & mask;
 		}
-
-		fredc_node node = {.key = key2, .val = prop};
-		fredc_darr_push(obj->pool, fredc_node, node);
-		dest->next = obj->pool.data + (obj->pool.length-1);
+		obj->index[slot] = (uint32_t)(e+1);
 	}
 }
 
-fredc_node* fredc_get_node(fredc_obj* obj, str8 key) {
-	if (key.data == 0 || key.length == 0) { return 0; }
-	size_t index = fredc_hash(obj, key);
-
-	fredc_node* node = obj->props+index;
-	while (node && !str8_cmp(node->key, key)) { 
-		node = node->next;
+// Grows the entries array and, past FREDC_OBJ_FLAT props, the index so that
+// length props fit without exceeding a 3/4 load factor.
+// exact: allocate room for exactly length props, when no more will follow
+static void fredc_obj_reserve(fredc_obj* obj, size_t length, bool exact) {
+	if (length > obj->capacity) {
+		size_t cap = length;
+		if (!exact) {
+			cap = obj->capacity ? obj->capacity : 4;
+			while (cap < length) {
+				cap *= 2;
+			}
+		}
+		obj->props = (fredc_node*)fredc_realloc(obj->arena, obj->props,
+			obj->capacity * sizeof(fredc_node), cap * sizeof(fredc_node));
+		obj->capacity = cap;
 	}
 
-	if (node && (node->key.length == 0 || node->key.data == 0)) {
-		node = 0;
+	if (length > FREDC_OBJ_FLAT && (length*4 > obj->index_cap*3 || obj->index == 0)) {
+		size_t index_cap = obj->index_cap ? obj->index_cap : FREDC_OBJ_MIN;
+		while (length*4 > index_cap*3) {
+			index_cap *= 2;
+		}
+		fredc_obj_reindex(obj, index_cap);
 	}
-
-	return node;
 }
 
-fredc_val fredc_get_prop(fredc_obj* obj, const char* key) {
-	fredc_val result = {};
-
-	fredc_node* node = fredc_get_node(obj, new_str8(key, strlen(key), true));
-	if (node) {
-		result = node->val;
-	}
+// length: number of props to reserve space for
+// arena: allocate the object and its keys from arena, or from the heap if 0
+static fredc_obj new_fredc_obj_in(fredc_arena* arena, size_t length) {
+	fredc_obj result = { .arena = arena };
+	fredc_obj_reserve(&result, length, true);
 
 	return result;
 }
 
-fredc_val fredc_set_prop(fredc_obj* obj, const char* key, fredc_val val) {
-	fredc_val result = {};
-	str8 key8 = new_str8(key, strlen(key), true);
+fredc_obj new_fredc_obj(size_t length) {
+	return new_fredc_obj_in(0, length);
+}
 
-	fredc_push_prop(obj, key8, val);
-	fredc_node* node = fredc_get_node(obj, key8);
-	if (node) {
-		result = node->val;
-	}
+// Moves obj into a value. Its header is allocated next to its entries, from
+// the same arena or the heap, and is released along with them.
+fredc_val fredc_val_obj(fredc_obj obj) {
+	fredc_val result = { .type = JSON_OBJ, .object = (fredc_obj*)fredc_alloc(obj.arena, sizeof(fredc_obj)) };
+	assert(result.object);
+	*result.object = obj;
+	return result;
+}
 
+// Moves list into a value, like fredc_val_obj
+fredc_val fredc_val_list(fredc_list list) {
+	fredc_val result = { .type = JSON_LIST, .list = (fredc_list*)fredc_alloc(list.arena, sizeof(fredc_list)) };
+	assert(result.list);
+	*result.list = list;
 	return result;
 }
 
-// Recursive get_prop using key interpreted as JavaScript notation.
-// Currently only supports dot notation (e.g. obj.foo.bar)
-// obj: target object
-// key: string describing the location of the property relative to obj
-// returns: val on success or undefined fredc_val on failure
-fredc_val fredc_get_prop_js(fredc_obj* obj, const char* key) {
-	fredc_val result = {};
+// Packed lists
+// FREDC_PARSE_PACK stores lists of only numbers or only booleans as plain
+// arrays. Reads go through fredc_list_get, which builds each value on the
+// fly, and every change made through the library unpacks the list first.
 
-	str8_list keys = str8_split(new_str8(key, strlen(key), true), '.', true);
-	fredc_node* node = fredc_get_node(obj, keys.data[0]);
-	if (node == 0) { goto cleanup; }
+static size_t fredc_packed_size(unsigned char type) {
+	return type == JSON_BOOL ? sizeof(bool) : 8;
+}
 
-	if (keys.length > 1) {
-		if (node->val.type == JSON_OBJ) {
-			result = fredc_get_prop_js(&node->val.object, keys.data[1].data);
-		} else {
-			result = (fredc_val){};
-		}
-	} else {
-		result = node->val;
+// returns: element index of list, or undefined past its end
+fredc_val fredc_list_get(const fredc_list* list, size_t index) {
+	if (index >= list->length) {
+		return (fredc_val){};
+	}
+	switch (list->packed) {
+		case JSON_INT: return (fredc_val){ .type = JSON_INT, .integer = list->ints[index] };
+		case JSON_NUM: return (fredc_val){ .type = JSON_NUM, .number = list->nums[index] };
+		case JSON_BOOL: return (fredc_val){ .type = JSON_BOOL, .boolean = list->bools[index] };
+		default: return list->data[index];
 	}
-
-	cleanup:
-		free(keys.data);
-		return result;
 }
 
-// Recursive set_prop using key interpreted as JavaScript notation.
-// Currently only supports dot notation (e.g. obj.foo.bar)
-// obj: target object
-// key: string describing the location of the property relative to obj
-// returns: val on success or undefined fredc_val on failure
-// Will replace only the last key and fail on any preceding key that is not an object.
-fredc_val fredc_set_prop_js(fredc_obj* obj, const char* key, fredc_val val) {
-	fredc_val result = {};
-
-	str8_list keys = str8_split(new_str8(key, strlen(key), true), '.', true);
-	fredc_node* node = fredc_get_node(obj, keys.data[0]);
+// Element types seen in a list being built, which may come in several runs
+typedef struct fredc_pack_scan {
+	size_t ints, nums, bools, others;
+	bool inexact; // an integer that a double cannot hold exactly
+} fredc_pack_scan;
+
+static void fredc_pack_scan_vals(fredc_pack_scan* s, const fredc_val* vals, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		switch (vals[i].type) {
+			case JSON_INT: {
+				s->ints++;
+				int64_t n = vals[i].integer;
+				if (n > (1ll << 53) || n < -(1ll << 53)) {
+					s->inexact = true;
+				}
+			} break;
+			case JSON_NUM: s->nums++; break;
+			case JSON_BOOL: s->bools++; break;
+			default: s->others++; break;
+		}
+	}
+}
 
-	if (keys.length > 1) {
-		if (node == 0) {
-			fredc_obj new_obj = new_fredc_obj(0);
-			result = fredc_set_prop(&new_obj, keys.data[1].data, val);
-			
-			if (result.type == val.type) {
-				fredc_val obj_val = {
-					.type = JSON_OBJ,
-					.object = new_obj
-				};
-				fredc_push_prop(obj, keys.data[0], obj_val);
+// returns: the packed type of a list with the scanned elements, or 0 if it
+// has to stay a regular list
+static unsigned char fredc_pack_type(const fredc_pack_scan* s) {
+	if (s->others || (s->bools && (s->ints || s->nums))) {
+		return 0;
+	}
+	if (s->bools) {
+		return JSON_BOOL;
+	}
+	if (s->nums) {
+		return s->ints && s->inexact ? 0 : JSON_NUM;
+	}
+	return s->ints ? JSON_INT : 0;
+}
 
-			} else {
-				fredc_obj_free(&new_obj);
-			}
-		} else if (node->val.type == JSON_OBJ){ 
-			result = fredc_set_prop(&node->val.object, keys.data[1].data, val);
-		} else {
-			printf("can't set properties of non-object %s\n", node->key.data);
-			result = (fredc_val){};
+// Stores count vals from position at of a packed list that has room for them
+static void fredc_pack_store(fredc_list* list, size_t at, const fredc_val* vals, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		fredc_val v = vals[i];
+		switch (list->packed) {
+			case JSON_INT: list->ints[at+i] = v.integer; break;
+			case JSON_NUM: list->nums[at+i] = v.type == JSON_INT ? (double)v.integer : v.number; break;
+			case JSON_BOOL: list->bools[at+i] = v.boolean; break;
 		}
-	} else {
-		fredc_push_prop(obj, keys.data[0], val);
-		result = val;
 	}
+}
 
-	free(keys.data);
+// Allocates the elements of list, packed as type when that is not 0
+static void fredc_list_alloc(fredc_list* list, fredc_arena* arena, unsigned char type, size_t count) {
+	list->packed = type;
+	list->data = (fredc_val*)fredc_alloc(arena, count * (type ? fredc_packed_size(type) : sizeof(fredc_val)));
+	list->length = list->capacity = count;
+}
 
+static void fredc_list_unpack(fredc_list* list) {
+	if (list->packed == 0) {
+		return;
+	}
+
+	fredc_val* data = (fredc_val*)fredc_alloc(list->arena, list->length * sizeof(fredc_val));
+	for (size_t i = 0; i < list->length; i++) {
+		data[i] = fredc_list_get(list, i);
+	}
+	fredc_release(list->arena, list->data);
+	list->data = data;
+	list->capacity = list->length;
+	list->packed = 0;
+}
+
+static void fredc_val_release(fredc_arena* arena, fredc_val* v) {
+	if (arena == 0) {
+		fredc_val_free(v);
+	}
+	v->type = JSON_UNDEFINED;
+}
+
+// returns: the index slot holding key, or the empty slot where it belongs
+static size_t fredc_obj_find_slot(fredc_obj* obj, str8 key, uint64_t hash) {
+	size_t mask = obj->index_cap-1;
+	size_t slot = hash & mask;
+
+	while (obj->index[slot]) {
+		fredc_node* node = obj->props + (obj->index[slot]-1);
+		if (node->hash == hash && (node->key.data == key.data || str8_cmp(node->key, key))) {
+			break;
+		}
+		slot = (slot+1) & mask;
+	}
+
+	return slot;
+}
+
+// returns: the prop with key in an object without an index, or 0
+static fredc_node* fredc_obj_find_flat(fredc_obj* obj, str8 key, uint64_t hash) {
+	for (size_t i = 0; i < obj->length; i++) {
+		fredc_node* node = obj->props + i;
+		if (node->hash == hash && (node->key.data == key.data || str8_cmp(node->key, key))) {
+			return node;
+		}
+	}
+	return 0;
+}
+
+static fredc_node* fredc_get_node_hashed(fredc_obj* obj, str8 key, uint64_t hash) {
+	if (obj->index == 0) {
+		return fredc_obj_find_flat(obj, key, hash);
+	}
+
+	size_t slot = fredc_obj_find_slot(obj, key, hash);
+	return obj->index[slot] ? obj->props + (obj->index[slot]-1) : 0;
+}
+
+// borrow_key stores key itself rather than a copy of it, handing it to obj:
+// a key that replaces an existing member is released right away
+static void fredc_push_prop_hashed(fredc_obj* obj, str8 key, uint64_t hash, fredc_val prop, bool borrow_key) {
+	fredc_obj_dirty(obj);
+
+	fredc_node* dest;
+	size_t slot = 0;
+	if (obj->index) {
+		fredc_obj_reserve(obj, obj->length+1, false);
+		slot = fredc_obj_find_slot(obj, key, hash);
+		dest = obj->index[slot] ? obj->props + (obj->index[slot]-1) : 0;
+	} else {
+		dest = fredc_obj_find_flat(obj, key, hash);
+	}
+	if (dest) {
+		fredc_val_release(obj->arena, &dest->val);
+		dest->val = prop;
+		if (borrow_key) {
+			fredc_release(obj->arena, key.data);
+		}
+		return;
+	}
+
+	if (obj->index == 0) {
+		// May outgrow the flat layout, in which case the index is built here
+		fredc_obj_reserve(obj, obj->length+1, false);
+		if (obj->index) {
+			slot = fredc_obj_find_slot(obj, key, hash);
+		}
+	}
+
+	str8 key2 = key;
+	if (!borrow_key) {
+		key2.data = (char*)fredc_alloc(obj->arena, key2.length+1);
+		memcpy(key2.data, key.data, key2.length);
+		key2.data[key2.length] = '\0';
+	}
+
+	obj->props[obj->length] = (fredc_node){ .key = key2, .val = prop, .hash = hash };
+	obj->length++;
+	if (obj->index) {
+		obj->index[slot] = (uint32_t)obj->length;
+	}
+}
+
+void fredc_push_prop(fredc_obj* obj, str8 key, fredc_val prop) {
+	fredc_push_prop_hashed(obj, key, fredc_hash_str8(key), prop, false);
+}
+
+fredc_node* fredc_get_node(fredc_obj* obj, str8 key) {
+	if (key.data == 0) { return 0; }
+	return fredc_get_node_hashed(obj, key, fredc_hash_str8(key));
+}
+
+// Intern table used while parsing with FREDC_PARSE_INTERN. The slots are
+// scratch memory, the strings themselves live in the document arena (or in
+// the input, when parsing in place) and outlive the table.
+
+#define FREDC_INTERN_MIN 64
+
+typedef struct fredc_intern_slot {
+	str8 s;
+	uint64_t hash;
+} fredc_intern_slot;
+
+typedef struct fredc_intern {
+	fredc_intern_slot* slots;
+	size_t capacity, length;
+} fredc_intern;
+
+static void fredc_intern_grow(fredc_intern* t) {
+	size_t capacity = t->capacity ? t->capacity*2 : FREDC_INTERN_MIN;
+	fredc_intern_slot* slots = (fredc_intern_slot*)FREDC_CALLOC(capacity, sizeof(fredc_intern_slot));
+	assert(slots);
+
+	for (size_t i = 0; i < t->capacity; i++) {
+		if (t->slots[i].s.data) {
+			size_t slot = t->slots[i].hash & (capacity-1);
+			while (slots[slot].s.data) {
+				slot = (slot+1) & (capacity-1);
+			}
+			slots[slot] = t->slots[i];
+		}
+	}
+
+	FREDC_FREE(t->slots);
+	t->slots = slots;
+	t->capacity = capacity;
+}
+
+// returns: the shared copy of s, adding it (copied to arena, or as is when
+// borrow is set) if it is not in the table yet
+static str8 fredc_intern_str8(fredc_intern* t, fredc_arena* arena, str8 s, uint64_t hash, bool borrow) {
+	if ((t->length+1)*2 > t->capacity) {
+		fredc_intern_grow(t);
+	}
+
+	size_t slot = hash & (t->capacity-1);
+	while (t->slots[slot].s.data) {
+		fredc_intern_slot* entry = t->slots + slot;
+		if (entry->hash == hash && str8_cmp(entry->s, s)) {
+			return entry->s;
+		}
+		slot = (slot+1) & (t->capacity-1);
+	}
+
+	str8 stored = s;
+	if (!borrow || s.data == 0) {
+		stored.data = (char*)fredc_alloc(arena, s.length+1);
+		if (s.length) {
+			memcpy(stored.data, s.data, s.length);
+		}
+		stored.data[s.length] = '\0';
+	}
+	t->slots[slot] = (fredc_intern_slot){ .s = stored, .hash = hash };
+	t->length++;
+
+	return stored;
+}
+
+static void fredc_intern_free(fredc_intern* t) {
+	FREDC_FREE(t->slots);
+	*t = (fredc_intern){};
+}
+
+// returns: the prop with key, which aliases the storage of obj. Take a
+// fredc_val_share of it to keep it beyond changes to obj or its release.
+fredc_val fredc_get_prop(fredc_obj* obj, const char* key) {
+	fredc_val result = {};
+
+	fredc_node* node = fredc_get_node(obj, (str8){ (char*)key, strlen(key) });
+	if (node) {
+		result = node->val;
+	}
+
+	return result;
+}
+
+fredc_val fredc_set_prop(fredc_obj* obj, const char* key, fredc_val val) {
+	fredc_val result = {};
+	str8 key8 = { (char*)key, strlen(key) };
+
+	fredc_push_prop(obj, key8, val);
+	fredc_node* node = fredc_get_node(obj, key8);
+	if (node) {
+		result = node->val;
+	}
+
+	return result;
+}
+
+// Paths
+// Segments and the bytes of their keys share a single allocation.
+
+fredc_path fredc_path_compile(const char* path) {
+	fredc_path result = {};
+	size_t length = strlen(path);
+
+	size_t max_segs = 1;
+	for (size_t i = 0; i < length; i++) {
+		max_segs += path[i] == '.' || path[i] == '[';
+	}
+	char* block = (char*)FREDC_MALLOC(max_segs * sizeof(fredc_path_seg) + length + 1);
+	assert(block);
+	result.data = (fredc_path_seg*)block;
+	char* keys = block + max_segs * sizeof(fredc_path_seg);
+
+	size_t pos = 0;
+	bool first = true;
+	while (pos < length) {
+		fredc_path_seg seg = {};
+		const char* key = 0;
+		size_t key_length = 0;
+
+		if (path[pos] == '[') {
+			pos++;
+			if (pos < length && path[pos] == '\"') {
+				const char* close = (const char*)memchr(path+pos+1, '\"', length-pos-1);
+				if (!close || close+1 >= path+length || close[1] != ']') {
+					goto invalid;
+				}
+				key = path+pos+1;
+				key_length = (size_t)(close - key);
+				pos = (size_t)(close - path) + 2;
+			} else {
+				size_t digits = 0;
+				while (pos < length && path[pos] >= '0' && path[pos] <= '9') {
+					size_t digit = (size_t)(path[pos] - '0');
+					if (seg.index > (SIZE_MAX - digit) / 10) {
+						goto invalid;
+					}
+					seg.index = seg.index*10 + digit;
+					pos++;
+					digits++;
+				}
+				if (digits == 0 || pos >= length || path[pos] != ']') {
+					goto invalid;
+				}
+				pos++;
+				seg.is_index = true;
+			}
+		} else {
+			if (!first) {
+				if (path[pos] != '.') {
+					goto invalid;
+				}
+				pos++;
+			}
+			key = path+pos;
+			while (pos < length && path[pos] != '.' && path[pos] != '[' && path[pos] != ']') {
+				pos++;
+			}
+			key_length = (size_t)(path+pos - key);
+			// The empty key is only reachable quoted, as [""]
+			if (key_length == 0) {
+				goto invalid;
+			}
+		}
+
+		if (!seg.is_index) {
+			memcpy(keys, key, key_length);
+			keys[key_length] = '\0';
+			seg.key = (str8){ .data = keys, .length = key_length };
+			seg.hash = fredc_hash_str8(seg.key);
+			keys += key_length+1;
+		}
+		result.data[result.length++] = seg;
+		first = false;
+	}
+
+	result.valid = result.length > 0;
+	return result;
+
+	invalid:
+		result.length = 0;
+		return result;
+}
+
+void fredc_path_free(fredc_path* path) {
+	FREDC_FREE(path->data);
+	*path = (fredc_path){};
+}
+
+// returns: the member of val that seg names, or undefined
+static fredc_val fredc_path_step(fredc_val val, const fredc_path_seg* seg) {
+	if (seg->is_index) {
+		return val.type == JSON_LIST ? fredc_list_get(val.list, seg->index) : (fredc_val){};
+	}
+	if (val.type == JSON_OBJ) {
+		fredc_node* node = fredc_get_node_hashed(val.object, seg->key, seg->hash);
+		return node ? node->val : (fredc_val){};
+	}
+	return (fredc_val){};
+}
+
+fredc_val fredc_path_get(fredc_val root, const fredc_path* path) {
+	if (!path->valid) {
+		return (fredc_val){};
+	}
+
+	fredc_val val = root;
+	for (size_t i = 0; i < path->length && val.type != JSON_UNDEFINED; i++) {
+		val = fredc_path_step(val, path->data + i);
+	}
+	return val;
+}
+
+// Inserts val before position at, which may be the length of list
+static void fredc_list_insert(fredc_list* list, size_t at, fredc_val val) {
+	fredc_list_dirty(list);
+	if (list->length == list->capacity) {
+		size_t cap = list->capacity ? list->capacity*2 : FREDC_DARR_MIN_CAP;
+		list->data = (fredc_val*)fredc_realloc(list->arena, list->data,
+			list->capacity * sizeof(fredc_val), cap * sizeof(fredc_val));
+		list->capacity = cap;
+	}
+	memmove(list->data + at+1, list->data + at, (list->length - at) * sizeof(fredc_val));
+	list->data[at] = val;
+	list->length++;
+}
+
+// Prepares a container for changes made other than through the functions of
+// this library: gives it storage of its own if it shares any, unpacks it if
+// it is a packed list and drops its serialization cache and content hash
+void fredc_val_touch(fredc_val val) {
+	if (val.type == JSON_OBJ) {
+		fredc_obj_dirty(val.object);
+	} else if (val.type == JSON_LIST) {
+		fredc_list_dirty(val.list);
+	}
+}
+
+// Sets the value at path, creating objects for missing keys along the way.
+// returns: the stored value, or undefined if the path runs through a value
+// of the wrong type or past the end of a list
+fredc_val fredc_path_set(fredc_obj* obj, const fredc_path* path, fredc_val val) {
+	if (!path->valid || path->data[0].is_index) {
+		return (fredc_val){};
+	}
+
+	fredc_val* parent = 0;
+	fredc_obj_dirty(obj);
+	for (size_t i = 0; i+1 < path->length; i++) {
+		const fredc_path_seg* seg = path->data + i;
+		const fredc_path_seg* next = seg+1;
+
+		fredc_val* child;
+		if (parent) {
+			fredc_val_touch(*parent);
+		}
+		if (seg->is_index) {
+			child = parent->type == JSON_LIST && seg->index < parent->list->length ? parent->list->data + seg->index : 0;
+		} else {
+			fredc_obj* o = parent ? parent->object : obj;
+			fredc_node* node = fredc_get_node_hashed(o, seg->key, seg->hash);
+			if (node == 0) {
+				// Only objects are created, so the rest of the path must be keys
+				for (size_t j = i+1; j < path->length; j++) {
+					if (path->data[j].is_index) {
+						return (fredc_val){};
+					}
+				}
+
+				fredc_val created = fredc_val_obj(new_fredc_obj_in(o->arena, 0));
+				fredc_push_prop_hashed(o, seg->key, seg->hash, created, false);
+				node = fredc_get_node_hashed(o, seg->key, seg->hash);
+			}
+			child = node ? &node->val : 0;
+		}
+
+		if (child == 0 || child->type != (next->is_index ? JSON_LIST : JSON_OBJ)) {
+			printf("can't set %s of non-%s at segment %zu\n",
+				next->is_index ? "elements" : "properties", next->is_index ? "list" : "object", i);
+			return (fredc_val){};
+		}
+		parent = child;
+	}
+	if (parent) {
+		fredc_val_touch(*parent);
+	}
+
+	const fredc_path_seg* last = path->data + path->length-1;
+	if (last->is_index) {
+		fredc_list* list = parent->list;
+		if (last->index > list->length) {
+			return (fredc_val){};
+		}
+		if (last->index == list->length) {
+			fredc_list_insert(list, last->index, val);
+		} else {
+			fredc_val_release(list->arena, list->data + last->index);
+			list->data[last->index] = val;
+		}
+		return val;
+	}
+
+	fredc_obj* o = parent ? parent->object : obj;
+	fredc_push_prop_hashed(o, last->key, last->hash, val, false);
+	return val;
+}
+
+// Convenience forms that compile path on every call. Hot paths should
+// compile once with fredc_path_compile and reuse it.
+
+// Looks up path in JavaScript notation (e.g. a.b[3]["c.d"]) relative to obj
+// returns: the value, or an undefined fredc_val if it is missing or path is invalid
+fredc_val fredc_get_prop_js(fredc_obj* obj, const char* path) {
+	fredc_path compiled = fredc_path_compile(path);
+	fredc_val result = fredc_path_get((fredc_val){ .type = JSON_OBJ, .object = obj }, &compiled);
+	fredc_path_free(&compiled);
+
+	return result;
+}
+
+fredc_val fredc_set_prop_js(fredc_obj* obj, const char* path, fredc_val val) {
+	fredc_path compiled = fredc_path_compile(path);
+	fredc_val result = fredc_path_set(obj, &compiled, val);
+	fredc_path_free(&compiled);
+
+	return result;
+}
+
+// Patching
+// JSON Patch (RFC 6902) and JSON Merge Patch (RFC 7386) change a tree in
+// place. Values taken from the patch are copied into the arena of the
+// container receiving them, values replaced or removed are released, and
+// every container on the way to a change loses its serialization cache.
+
+static fredc_arena* fredc_val_arena(fredc_val val) {
+	if (val.type == JSON_OBJ) {
+		return val.object->arena;
+	}
+	if (val.type == JSON_LIST) {
+		return val.list->arena;
+	}
+	return 0;
+}
+
+// Deep copy of val allocated from arena, or from the heap if 0
+static fredc_val fredc_val_clone_in(fredc_arena* arena, fredc_val val) {
+	switch (val.type) {
+		case JSON_STRING: {
+			str8 copy = { (char*)fredc_alloc(arena, val.string.length+1), val.string.length };
+			memcpy(copy.data, val.string.data, copy.length);
+			copy.data[copy.length] = '\0';
+			val.string = copy;
+		} break;
+
+		case JSON_OBJ: {
+			fredc_obj* src = val.object;
+			val = fredc_val_obj(new_fredc_obj_in(arena, src->length));
+			for (size_t i = 0; i < src->length; i++) {
+				fredc_node* node = src->props+i;
+				fredc_push_prop_hashed(val.object, node->key, node->hash, fredc_val_clone_in(arena, node->val), false);
+			}
+		} break;
+
+		case JSON_LIST: {
+			fredc_list* src = val.list;
+			fredc_list copy = { .arena = arena };
+			if (src->length && src->packed) {
+				fredc_list_alloc(&copy, arena, src->packed, src->length);
+				memcpy(copy.data, src->data, src->length * fredc_packed_size(src->packed));
+			} else if (src->length) {
+				copy.data = (fredc_val*)fredc_alloc(arena, src->length * sizeof(fredc_val));
+				copy.length = copy.capacity = src->length;
+				for (size_t i = 0; i < src->length; i++) {
+					copy.data[i] = fredc_val_clone_in(arena, src->data[i]);
+				}
+			}
+			val = fredc_val_list(copy);
+		} break;
+
+		default: break;
+	}
+
+	return val;
+}
+
+// returns: a heap allocated deep copy of val, to be freed with fredc_val_free
+fredc_val fredc_val_clone(fredc_val val) {
+	return fredc_val_clone_in(0, val);
+}
+
+// Content hashes
+// Containers carry a hash of their contents, computed on first use and
+// dropped, like their serialization cache, whenever they change. Objects add
+// up one hash per member so the same members in any order hash alike, and
+// numbers that compare equal hash alike whether stored as integers or not.
+#define FREDC_HASH_OBJ 0x2d358dccaa6c78a5ull
+#define FREDC_HASH_LIST 0x8bb84b93962eacc9ull
+
+// returns: whether d is a whole number that fits an int64_t, stored in *result
+static bool fredc_num_to_int(double d, int64_t* result) {
+	if (!(d >= -9223372036854775808.0 && d < 9223372036854775808.0) || (double)(int64_t)d != d) {
+		return false;
+	}
+	*result = (int64_t)d;
+	return true;
+}
+
+// Hashes are stored in the tree as they are computed, together with a link
+// from every container to its parent so that a change anywhere below drops
+// them. Headers in storage other holders see (see fredc_val_share) are left
+// as they are, so holders hash on their own threads without writing to them.
+// store: val's header is the caller's to write
+static uint64_t fredc_hash_val(fredc_val val, bool store) {
+	switch (val.type) {
+		case JSON_NULL: return FREDC_HASH_P0;
+		case JSON_BOOL: return fredc_mix(FREDC_HASH_P1, (uint64_t)val.boolean + 1);
+		case JSON_STRING: return fredc_hash_bytes(val.string.data, val.string.length, FREDC_HASH_P2);
+
+		case JSON_INT: return fredc_mix((uint64_t)val.integer ^ FREDC_HASH_P1, FREDC_HASH_P2);
+
+		case JSON_NUM: {
+			int64_t integer;
+			if (fredc_num_to_int(val.number, &integer)) {
+				return fredc_hash_val((fredc_val){ .type = JSON_INT, .integer = integer }, false);
+			}
+			uint64_t bits;
+			memcpy(&bits, &val.number, sizeof(bits));
+			return fredc_mix(bits ^ FREDC_HASH_P1, FREDC_HASH_P0);
+		}
+
+		case JSON_OBJ: {
+			fredc_obj* obj = val.object;
+			if (obj->hash) {
+				return obj->hash;
+			}
+			bool own = store && !fredc_val_shares_storage(val);
+			uint64_t sum = obj->length;
+			for (size_t i = 0; i < obj->length; i++) {
+				fredc_node* node = obj->props+i;
+				sum += fredc_mix(node->hash ^ FREDC_HASH_P0, fredc_hash_val(node->val, own) ^ FREDC_HASH_P1);
+				if (own) {
+					fredc_val_link(node->val, obj, 0);
+				}
+			}
+			uint64_t h = fredc_mix(sum ^ FREDC_HASH_OBJ, FREDC_HASH_P2);
+			h = h ? h : 1;
+			if (store) {
+				obj->hash = h;
+			}
+			return h;
+		}
+
+		case JSON_LIST: {
+			fredc_list* list = val.list;
+			if (list->hash) {
+				return list->hash;
+			}
+			bool own = store && !fredc_val_shares_storage(val);
+			uint64_t h = FREDC_HASH_LIST ^ list->length;
+			for (size_t i = 0; i < list->length; i++) {
+				fredc_val item = fredc_list_get(list, i);
+				h = fredc_mix(h ^ FREDC_HASH_P0, fredc_hash_val(item, own) ^ FREDC_HASH_P1);
+				if (own) {
+					fredc_val_link(item, 0, list);
+				}
+			}
+			h = h ? h : 1;
+			if (store) {
+				list->hash = h;
+			}
+			return h;
+		}
+
+		default: return 0;
+	}
+}
+
+uint64_t fredc_val_hash(fredc_val val) {
+	return fredc_hash_val(val, true);
+}
+
+// returns: a heap allocated string value holding a copy of data
+static fredc_val fredc_heap_string(const char* data, size_t length) {
+	fredc_val result = { .type = JSON_STRING, .string = { (char*)FREDC_MALLOC(length+1), length } };
+	assert(result.string.data);
+	if (length) {
+		memcpy(result.string.data, data, length);
+	}
+	result.string.data[length] = '\0';
+	return result;
+}
+
+// Sharing
+// fredc_val_share hands out another container header over the same storage,
+// whose references are counted in a fredc_share block. Shared storage is
+// never changed: a container about to change first copies its entries and
+// shares each child container in turn, so a change copies the containers on
+// its path and leaves the rest of the tree shared.
+// Lookups never copy anything, so a container they return from shared
+// storage is a view that the other holders see as well: read it, but change
+// it only through its root, with fredc_path_set, fredc_set_prop_js or the
+// patch functions, which unshare every container on their path first. To
+// change it directly, fredc_val_touch its parent (which must be one's own)
+// and look it up again, or take a fredc_val_share of it.
+// Shares are taken from the thread that owns the tree. The holders may read,
+// hash, diff and write (with opts.cache too) their values on any thread and
+// free them whenever they are done: none of that stores into headers that
+// sit in shared storage.
+struct fredc_share {
+	atomic_size_t refs; // containers using the storage
+};
+
+// A container in shared storage can be shared by all of its holders at once,
+// each unsharing on its own thread, so its share field is accessed
+// atomically until the storage has a single holder again.
+static fredc_share* fredc_share_load(fredc_share** share) {
+	return atomic_load_explicit((_Atomic(fredc_share*)*)share, memory_order_acquire);
+}
+
+// returns: whether val is a container whose storage, and with it the headers
+// of its children, other holders use as well
+static bool fredc_val_shares_storage(fredc_val val) {
+	fredc_share* s = 0;
+	if (val.type == JSON_OBJ) {
+		s = fredc_share_load(&val.object->share);
+	} else if (val.type == JSON_LIST) {
+		s = fredc_share_load(&val.list->share);
+	}
+	return s && atomic_load_explicit(&s->refs, memory_order_acquire) > 1;
+}
+
+static fredc_share* fredc_share_acquire(fredc_share** share) {
+	fredc_share* s = fredc_share_load(share);
+	if (s == 0) {
+		fredc_share* created = (fredc_share*)FREDC_MALLOC(sizeof(fredc_share));
+		assert(created);
+		atomic_init(&created->refs, 1);
+		if (atomic_compare_exchange_strong_explicit((_Atomic(fredc_share*)*)share, &s, created,
+			memory_order_acq_rel, memory_order_acquire)) {
+			s = created;
+		} else {
+			FREDC_FREE(created);
+		}
+	}
+	atomic_fetch_add_explicit(&s->refs, 1, memory_order_relaxed);
+	return s;
+}
+
+// Drops one reference to shared storage.
+// returns: whether other containers still use the storage
+static bool fredc_share_release(fredc_share** share) {
+	fredc_share* s = *share;
+	*share = 0;
+	if (s == 0) {
+		return false;
+	}
+	if (atomic_fetch_sub_explicit(&s->refs, 1, memory_order_acq_rel) > 1) {
+		return true;
+	}
+	FREDC_FREE(s);
+	return false;
+}
+
+// Snapshots val in constant time: the result has the same contents and
+// stays unchanged when val changes, and the other way around. Containers of
+// a document cannot be shared and are deep copied to the heap once; share
+// that copy from then on.
+// returns: a value to be freed with fredc_val_free
+fredc_val fredc_val_share(fredc_val val) {
+	switch (val.type) {
+		case JSON_STRING: {
+			return fredc_heap_string(val.string.data, val.string.length);
+		}
+
+		case JSON_OBJ: {
+			if (val.object->arena) {
+				return fredc_val_clone(val);
+			}
+			fredc_share* share = fredc_share_acquire(&val.object->share);
+			fredc_obj copy = *val.object;
+			copy.share = share;
+			copy.cache = 0;
+			copy.parent_obj = 0;
+			copy.parent_list = 0;
+			return fredc_val_obj(copy);
+		}
+
+		case JSON_LIST: {
+			if (val.list->arena) {
+				return fredc_val_clone(val);
+			}
+			fredc_share* share = fredc_share_acquire(&val.list->share);
+			fredc_list copy = *val.list;
+			copy.share = share;
+			copy.cache = 0;
+			copy.parent_obj = 0;
+			copy.parent_list = 0;
+			return fredc_val_list(copy);
+		}
+
+		default: return val;
+	}
+}
+
+static void fredc_obj_unshare(fredc_obj* obj) {
+	if (obj->share == 0) {
+		return;
+	}
+	if (atomic_load_explicit(&obj->share->refs, memory_order_acquire) == 1) {
+		// The children may still be linked to a former holder
+		fredc_share_release(&obj->share);
+		for (size_t i = 0; i < obj->length; i++) {
+			fredc_val_link(obj->props[i].val, obj, 0);
+		}
+		return;
+	}
+
+	fredc_obj copy = new_fredc_obj_in(0, obj->length);
+	for (size_t i = 0; i < obj->length; i++) {
+		fredc_node* node = obj->props+i;
+		fredc_val key = fredc_heap_string(node->key.data, node->key.length);
+		copy.props[i] = (fredc_node){ .key = key.string, .val = fredc_val_share(node->val), .hash = node->hash };
+		fredc_val_link(copy.props[i].val, obj, 0);
+	}
+	copy.length = obj->length;
+	if (copy.index) {
+		fredc_obj_reindex(&copy, copy.index_cap);
+	}
+	copy.cache = obj->cache;
+	copy.parent_obj = obj->parent_obj;
+	copy.parent_list = obj->parent_list;
+
+	// Whoever lets go of the storage last frees it
+	fredc_obj old = *obj;
+	*obj = copy;
+	if (!fredc_share_release(&old.share)) {
+		old.cache = 0;
+		fredc_obj_free(&old);
+	}
+}
+
+static void fredc_list_unshare(fredc_list* list) {
+	if (list->share == 0) {
+		return;
+	}
+	if (atomic_load_explicit(&list->share->refs, memory_order_acquire) == 1) {
+		// The children may still be linked to a former holder
+		fredc_share_release(&list->share);
+		for (size_t i = 0; !list->packed && i < list->length; i++) {
+			fredc_val_link(list->data[i], 0, list);
+		}
+		return;
+	}
+
+	fredc_list copy = { .cache = list->cache, .parent_obj = list->parent_obj, .parent_list = list->parent_list };
+	if (list->length && list->packed) {
+		fredc_list_alloc(&copy, 0, list->packed, list->length);
+		memcpy(copy.data, list->data, list->length * fredc_packed_size(list->packed));
+	} else if (list->length) {
+		copy.data = (fredc_val*)FREDC_MALLOC(list->length * sizeof(fredc_val));
+		assert(copy.data);
+		copy.length = copy.capacity = list->length;
+		for (size_t i = 0; i < list->length; i++) {
+			copy.data[i] = fredc_val_share(list->data[i]);
+			fredc_val_link(copy.data[i], 0, list);
+		}
+	}
+
+	fredc_list old = *list;
+	*list = copy;
+	if (!fredc_share_release(&old.share)) {
+		for (size_t i = 0; !old.packed && i < old.length; i++) {
+			fredc_val_free(old.data + i);
+		}
+		FREDC_FREE(old.data);
+	}
+}
+
+// returns: whether a and b are containers over the same storage, which
+// makes them equal
+static bool fredc_val_same(fredc_val a, fredc_val b) {
+	if (a.type == JSON_OBJ && b.type == JSON_OBJ) {
+		fredc_share* share = fredc_share_load(&a.object->share);
+		return a.object == b.object || (share && share == fredc_share_load(&b.object->share));
+	}
+	if (a.type == JSON_LIST && b.type == JSON_LIST) {
+		fredc_share* share = fredc_share_load(&a.list->share);
+		return a.list == b.list || (share && share == fredc_share_load(&b.list->share));
+	}
+	return false;
+}
+
+// Structural equality: numbers compare by value whether stored as integers
+// or not, object props in any order. Containers over the same storage are
+// equal at once, and ones whose hashes are known and differ unequal.
+bool fredc_val_equal(fredc_val a, fredc_val b) {
+	bool a_num = a.type == JSON_INT || a.type == JSON_NUM;
+	bool b_num = b.type == JSON_INT || b.type == JSON_NUM;
+	if (a_num && b_num) {
+		if (a.type == b.type) {
+			return a.type == JSON_INT ? a.integer == b.integer : a.number == b.number;
+		}
+		int64_t integer;
+		double number = a.type == JSON_NUM ? a.number : b.number;
+		return fredc_num_to_int(number, &integer) && integer == (a.type == JSON_INT ? a.integer : b.integer);
+	}
+	if (a.type != b.type) {
+		return false;
+	}
+	if (fredc_val_same(a, b)) {
+		return true;
+	}
+
+	switch (a.type) {
+		case JSON_BOOL: return a.boolean == b.boolean;
+		case JSON_STRING: return str8_cmp(a.string, b.string);
+
+		case JSON_LIST: {
+			if (a.list->length != b.list->length || (a.list->hash && b.list->hash && a.list->hash != b.list->hash)) {
+				return false;
+			}
+			for (size_t i = 0; i < a.list->length; i++) {
+				if (!fredc_val_equal(fredc_list_get(a.list, i), fredc_list_get(b.list, i))) {
+					return false;
+				}
+			}
+		} break;
+
+		case JSON_OBJ: {
+			if (a.object->length != b.object->length || (a.object->hash && b.object->hash && a.object->hash != b.object->hash)) {
+				return false;
+			}
+			for (size_t i = 0; i < a.object->length; i++) {
+				fredc_node* node = a.object->props+i;
+				fredc_node* other = fredc_get_node_hashed(b.object, node->key, node->hash);
+				if (other == 0 || !fredc_val_equal(node->val, other->val)) {
+					return false;
+				}
+			}
+		} break;
+
+		default: break;
+	}
+
+	return true;
+}
+
+// Removes the prop with key from obj, keeping the order of the others.
+// returns: its value, which the caller now owns, or undefined if not found
+static fredc_val fredc_obj_take(fredc_obj* obj, str8 key, uint64_t hash) {
+	if (fredc_get_node_hashed(obj, key, hash) == 0) {
+		return (fredc_val){};
+	}
+
+	fredc_obj_dirty(obj);
+	fredc_node* node = fredc_get_node_hashed(obj, key, hash);
+	fredc_val result = node->val;
+	fredc_val_link(result, 0, 0);
+	fredc_release(obj->arena, node->key.data);
+
+	size_t at = (size_t)(node - obj->props);
+	memmove(node, node+1, (obj->length - at-1) * sizeof(fredc_node));
+	obj->length--;
+	if (obj->index) {
+		fredc_obj_reindex(obj, obj->index_cap);
+	}
+
+	return result;
+}
+
+// returns: whether obj had a prop with key
+bool fredc_obj_remove(fredc_obj* obj, const char* key) {
+	str8 k = { (char*)key, strlen(key) };
+	fredc_val val = fredc_obj_take(obj, k, fredc_hash_str8(k));
+	if (val.type == JSON_UNDEFINED) {
+		return false;
+	}
+
+	fredc_val_release(obj->arena, &val);
+	return true;
+}
+
+// Removes the value at position at from list
+static fredc_val fredc_list_take(fredc_list* list, size_t at) {
+	fredc_list_dirty(list);
+	fredc_val result = list->data[at];
+	fredc_val_link(result, 0, 0);
+	memmove(list->data + at, list->data + at+1, (list->length - at-1) * sizeof(fredc_val));
+	list->length--;
+	return result;
+}
+
+// JSON Pointer (RFC 6901): "" is the whole document, every "/" starts a
+// reference token in which ~1 stands for "/" and ~0 for "~".
+
+// Splits the next token off pointer, which starts at its "/", and decodes it
+// into buf. buf needs room for the whole pointer.
+static str8 fredc_pointer_next(str8* pointer, char* buf) {
+	size_t end = 1;
+	while (end < pointer->length && pointer->data[end] != '/') {
+		end++;
+	}
+
+	size_t length = 0;
+	for (size_t i = 1; i < end; i++) {
+		char c = pointer->data[i];
+		if (c == '~' && i+1 < end && (pointer->data[i+1] == '0' || pointer->data[i+1] == '1')) {
+			c = pointer->data[++i] == '0' ? '~' : '/';
+		}
+		buf[length++] = c;
+	}
+
+	pointer->data += end;
+	pointer->length -= end;
+	return (str8){ buf, length };
+}
+
+// returns: the list position token stands for, length for "-", or SIZE_MAX
+// if it is not a position
+static size_t fredc_pointer_index(str8 token, size_t length) {
+	if (token.length == 1 && token.data[0] == '-') {
+		return length;
+	}
+	if (token.length == 0 || (token.length > 1 && token.data[0] == '0')) {
+		return SIZE_MAX;
+	}
+
+	size_t result = 0;
+	for (size_t i = 0; i < token.length; i++) {
+		if (token.data[i] < '0' || token.data[i] > '9' || result > (SIZE_MAX-9) / 10) {
+			return SIZE_MAX;
+		}
+		result = result*10 + (size_t)(token.data[i] - '0');
+	}
+	return result;
+}
+
+// The elements of packed lists are built into *scratch, which they cannot be
+// changed through.
+// returns: the member of container val that token names, or 0
+static fredc_val* fredc_pointer_child(fredc_val* val, str8 token, fredc_val* scratch) {
+	if (val->type == JSON_OBJ) {
+		fredc_node* node = fredc_get_node_hashed(val->object, token, fredc_hash_str8(token));
+		return node ? &node->val : 0;
+	}
+	if (val->type == JSON_LIST) {
+		size_t i = fredc_pointer_index(token, val->list->length);
+		if (i < val->list->length && val->list->packed) {
+			*scratch = fredc_list_get(val->list, i);
+			return scratch;
+		}
+		return i < val->list->length ? val->list->data + i : 0;
+	}
+	return 0;
+}
+
+// Follows pointer from root. When last is given the walk stops at the
+// parent of the final token, which is decoded into *last (data 0 for the
+// root itself).
+// touch: drop the caches of the containers the walk ends in or passes through,
+// which also unpacks them
+// returns: the value reached, or 0 if the pointer is malformed or a token
+// along the way does not exist. Without touch it may be scratch, see
+// fredc_pointer_child.
+static fredc_val* fredc_pointer_walk(fredc_val* root, str8 pointer, char* buf, str8* last, bool touch, fredc_val* scratch) {
+	if (pointer.length && pointer.data[0] != '/') {
+		return 0;
+	}
+	if (last) {
+		*last = (str8){};
+	}
+
+	fredc_val* val = root;
+	while (pointer.length) {
+		str8 token = fredc_pointer_next(&pointer, buf);
+		if (last && pointer.length == 0) {
+			*last = token;
+			break;
+		}
+		if (touch) {
+			fredc_val_touch(*val);
+		}
+		val = fredc_pointer_child(val, token, scratch);
+		if (val == 0) {
+			return 0;
+		}
+	}
+
+	if (touch) {
+		fredc_val_touch(*val);
+	}
+	return val;
+}
+
+// returns: the value at pointer, or undefined if there is none
+fredc_val fredc_pointer_get(fredc_val root, const char* pointer) {
+	str8 p = { (char*)pointer, strlen(pointer) };
+	char* buf = (char*)FREDC_MALLOC(p.length+1);
+	assert(buf);
+	fredc_val scratch;
+	fredc_val* result = fredc_pointer_walk(&root, p, buf, 0, false, &scratch);
+	FREDC_FREE(buf);
+
+	return result ? *result : (fredc_val){};
+}
+
+// Adds val as member token of parent, or inserts it into a list.
+// replace: the member must exist already and is overwritten instead
+// returns: an error, or 0 once val is owned by parent
+static const char* fredc_patch_put(fredc_val* parent, str8 token, fredc_val val, bool replace) {
+	if (parent->type == JSON_OBJ) {
+		uint64_t hash = fredc_hash_str8(token);
+		if (replace && fredc_get_node_hashed(parent->object, token, hash) == 0) {
+			return "path not found";
+		}
+		fredc_push_prop_hashed(parent->object, token, hash, val, false);
+		return 0;
+	}
+
+	if (parent->type == JSON_LIST) {
+		fredc_list* list = parent->list;
+		size_t i = fredc_pointer_index(token, list->length);
+		if (replace ? i >= list->length : i > list->length) {
+			return "list index out of range";
+		}
+		if (replace) {
+			fredc_list_dirty(list);
+			fredc_val_release(list->arena, list->data + i);
+			list->data[i] = val;
+		} else {
+			fredc_list_insert(list, i, val);
+		}
+		return 0;
+	}
+
+	return "parent is not a container";
+}
+
+// Detaches member token from parent into *result. *at is set to the
+// position it had, for fredc_patch_untake.
+static const char* fredc_patch_take(fredc_val* parent, str8 token, fredc_val* result, size_t* at) {
+	if (parent->type == JSON_OBJ) {
+		uint64_t hash = fredc_hash_str8(token);
+		fredc_node* node = fredc_get_node_hashed(parent->object, token, hash);
+		if (node == 0) {
+			return "path not found";
+		}
+		*at = (size_t)(node - parent->object->props);
+		*result = fredc_obj_take(parent->object, token, hash);
+		return 0;
+	}
+	if (parent->type == JSON_LIST) {
+		size_t i = fredc_pointer_index(token, parent->list->length);
+		if (i >= parent->list->length) {
+			return "list index out of range";
+		}
+		*at = i;
+		*result = fredc_list_take(parent->list, i);
+		return 0;
+	}
+	return "parent is not a container";
+}
+
+// Puts back a value detached by fredc_patch_take at its old position
+static void fredc_patch_untake(fredc_val* parent, str8 token, fredc_val val, size_t at) {
+	if (parent->type == JSON_LIST) {
+		fredc_list_insert(parent->list, at, val);
+		return;
+	}
+
+	fredc_obj* obj = parent->object;
+	fredc_push_prop_hashed(obj, token, fredc_hash_str8(token), val, false);
+	fredc_node node = obj->props[obj->length-1];
+	memmove(obj->props + at+1, obj->props + at, (obj->length-1 - at) * sizeof(fredc_node));
+	obj->props[at] = node;
+	if (obj->index) {
+		fredc_obj_reindex(obj, obj->index_cap);
+	}
+}
+
+// Stores a copy of val at pointer, which must exist already when replace is
+// set. val may live in the tree itself.
+static const char* fredc_patch_store(fredc_val* root, str8 pointer, fredc_val val, bool replace, char* buf) {
+	str8 token;
+	fredc_val scratch;
+	fredc_val* parent = fredc_pointer_walk(root, pointer, buf, &token, true, &scratch);
+	if (parent == 0) {
+		return "path not found";
+	}
+
+	if (token.data == 0) {
+		// A root that is not a container has no known owner and is not released
+		fredc_arena* arena = fredc_val_arena(*root);
+		fredc_val copy = fredc_val_clone_in(arena, val);
+		if (root->type == JSON_OBJ || root->type == JSON_LIST) {
+			fredc_val_release(arena, root);
+		}
+		*root = copy;
+		return 0;
+	}
+
+	fredc_arena* arena = fredc_val_arena(*parent);
+	fredc_val copy = fredc_val_clone_in(arena, val);
+	const char* error = fredc_patch_put(parent, token, copy, replace);
+	if (error) {
+		fredc_val_release(arena, &copy);
+	}
+	return error;
+}
+
+static bool fredc_str8_is(str8 s, const char* literal) {
+	size_t length = strlen(literal);
+	return s.length == length && memcmp(s.data, literal, length) == 0;
+}
+
+static const char* fredc_patch_op(fredc_val* root, fredc_val op, char* buf) {
+	if (op.type != JSON_OBJ) {
+		return "operation is not an object";
+	}
+	fredc_val name = fredc_get_prop(op.object, "op");
+	fredc_val path = fredc_get_prop(op.object, "path");
+	fredc_val from = fredc_get_prop(op.object, "from");
+	fredc_val value = fredc_get_prop(op.object, "value");
+	fredc_val scratch;
+	if (name.type != JSON_STRING || path.type != JSON_STRING) {
+		return "missing op or path";
+	}
+
+	str8 kind = name.string;
+	bool needs_value = fredc_str8_is(kind, "add") || fredc_str8_is(kind, "replace") || fredc_str8_is(kind, "test");
+	bool needs_from = fredc_str8_is(kind, "move") || fredc_str8_is(kind, "copy");
+	if (needs_value && value.type == JSON_UNDEFINED) {
+		return "missing value";
+	}
+	if (needs_from && from.type != JSON_STRING) {
+		return "missing from";
+	}
+
+	if (fredc_str8_is(kind, "add") || fredc_str8_is(kind, "replace")) {
+		return fredc_patch_store(root, path.string, value, kind.data[0] == 'r', buf);
+	}
+
+	if (fredc_str8_is(kind, "test")) {
+		fredc_val* found = fredc_pointer_walk(root, path.string, buf, 0, false, &scratch);
+		if (found == 0) {
+			return "path not found";
+		}
+		return fredc_val_equal(*found, value) ? 0 : "test failed";
+	}
+
+	if (fredc_str8_is(kind, "copy")) {
+		fredc_val* found = fredc_pointer_walk(root, from.string, buf, 0, false, &scratch);
+		if (found == 0) {
+			return "from not found";
+		}
+		return fredc_patch_store(root, path.string, *found, false, buf);
+	}
+
+	bool move = fredc_str8_is(kind, "move");
+	if (!move && !fredc_str8_is(kind, "remove")) {
+		return "unknown op";
+	}
+
+	str8 source = move ? from.string : path.string;
+	if (move) {
+		// Moving a value onto itself changes nothing, but it must still exist
+		if (str8_cmp(source, path.string)) {
+			return fredc_pointer_walk(root, source, buf, 0, false, &scratch) ? 0 : "from not found";
+		}
+		// A value cannot be moved into one of its own children
+		if (path.string.length > source.length && path.string.data[source.length] == '/' &&
+			memcmp(path.string.data, source.data, source.length) == 0) {
+			return "cannot move a value into itself";
+		}
+	}
+
+	str8 token;
+	fredc_val* parent = fredc_pointer_walk(root, source, buf, &token, true, &scratch);
+	if (parent == 0) {
+		return "path not found";
+	}
+	if (token.data == 0) {
+		return "cannot remove the root";
+	}
+
+	fredc_val taken;
+	size_t at;
+	const char* error = fredc_patch_take(parent, token, &taken, &at);
+	if (error) {
+		return error;
+	}
+	fredc_arena* arena = fredc_val_arena(*parent);
+	if (!move) {
+		fredc_val_release(arena, &taken);
+		return 0;
+	}
+
+	// The moved value keeps its memory when both ends share an owner
+	str8 dest_token;
+	fredc_val* dest = fredc_pointer_walk(root, path.string, buf, &dest_token, true, &scratch);
+	bool same = dest && dest_token.data && fredc_val_arena(*dest) == arena;
+	if (same) {
+		error = fredc_patch_put(dest, dest_token, taken, false);
+	} else {
+		error = fredc_patch_store(root, path.string, taken, false, buf);
+	}
+	if (error) {
+		// Nothing was stored, so the source path leads where it did
+		parent = fredc_pointer_walk(root, source, buf, &token, true, &scratch);
+		fredc_patch_untake(parent, token, taken, at);
+	} else if (!same) {
+		fredc_val_release(arena, &taken);
+	}
+	return error;
+}
+
+// Applies the operations of patch, a list, to *root in order.
+// Application stops at the first operation that fails, which changes
+// nothing, leaving the ones before it applied: patch a copy
+// (fredc_val_clone) to get all or nothing.
+fredc_patch_result fredc_patch_apply(fredc_val* root, fredc_val patch) {
+	if (patch.type != JSON_LIST) {
+		return (fredc_patch_result){ .error = "patch is not a list" };
+	}
+
+	// Scratch space for decoding pointer tokens, sized for the longest path
+	size_t longest = 0;
+	for (size_t i = 0; i < patch.list->length; i++) {
+		fredc_val op = fredc_list_get(patch.list, i);
+		if (op.type == JSON_OBJ) {
+			fredc_val path = fredc_get_prop(op.object, "path");
+			fredc_val from = fredc_get_prop(op.object, "from");
+			if (path.type == JSON_STRING && path.string.length > longest) {
+				longest = path.string.length;
+			}
+			if (from.type == JSON_STRING && from.string.length > longest) {
+				longest = from.string.length;
+			}
+		}
+	}
+	char* buf = (char*)FREDC_MALLOC(longest+1);
+	assert(buf);
+
+	fredc_patch_result result = { .ok = true };
+	for (size_t i = 0; i < patch.list->length; i++) {
+		const char* error = fredc_patch_op(root, fredc_list_get(patch.list, i), buf);
+		if (error) {
+			result = (fredc_patch_result){ .op = i, .error = error };
+			break;
+		}
+	}
+	FREDC_FREE(buf);
+
+	return result;
+}
+
+// target lives in, and takes new values from, arena
+static void fredc_merge_into(fredc_arena* arena, fredc_val* target, fredc_val patch) {
+	if (patch.type != JSON_OBJ) {
+		fredc_val copy = fredc_val_clone_in(arena, patch);
+		fredc_val_release(arena, target);
+		*target = copy;
+		return;
+	}
+
+	if (target->type != JSON_OBJ) {
+		fredc_val_release(arena, target);
+		*target = fredc_val_obj(new_fredc_obj_in(arena, 0));
+	}
+	fredc_obj* obj = target->object;
+	fredc_obj_dirty(obj);
+
+	for (size_t i = 0; i < patch.object->length; i++) {
+		fredc_node* node = patch.object->props+i;
+		if (node->val.type == JSON_NULL) {
+			fredc_val removed = fredc_obj_take(obj, node->key, node->hash);
+			fredc_val_release(obj->arena, &removed);
+			continue;
+		}
+
+		fredc_node* existing = fredc_get_node_hashed(obj, node->key, node->hash);
+		if (existing) {
+			fredc_merge_into(obj->arena, &existing->val, node->val);
+		} else {
+			// Merging into nothing still strips the nulls of nested objects
+			fredc_val created = {};
+			fredc_merge_into(obj->arena, &created, node->val);
+			fredc_push_prop_hashed(obj, node->key, node->hash, created, false);
+		}
+	}
+}
+
+// Applies a merge patch: the members of an object patch are merged into
+// *root recursively, null members delete, anything else replaces *root.
+// A root that is not a container is overwritten without being freed.
+void fredc_merge_patch(fredc_val* root, fredc_val patch) {
+	if (root->type != JSON_OBJ && root->type != JSON_LIST) {
+		*root = (fredc_val){};
+	}
+	fredc_merge_into(fredc_val_arena(*root), root, patch);
+}
+
+// Numbers
+// Parsing reads the digits once into a 64 bit mantissa. Integers that fit an
+// int64_t become JSON_INT; other values are converted exactly with a single
+// multiplication or division when mantissa and exponent are small enough
+// (Clinger's fast path) and fall back to strtod otherwise.
+// Formatting uses Grisu2, which yields the shortest digit string that reads
+// back to the same double in nearly every case and always round trips.
+
+static const double fredc_exact_pow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static bool fredc_is_digit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+// Parses the number at the start of s.
+// consumed: receives the number of bytes read, 0 if s does not start with a number
+fredc_val fredc_parse_number(const char* s, size_t length, size_t* consumed) {
+	fredc_val result = {};
+	size_t i = 0;
+	bool negative = false;
+	*consumed = 0;
+
+	if (i < length && (s[i] == '-' || s[i] == '+')) {
+		negative = s[i] == '-';
+		i++;
+	}
+
+	uint64_t mantissa = 0;
+	int digits = 0, dropped = 0, exp10 = 0;
+	bool is_int = true, truncated = false;
+	size_t digits_start = i;
+
+	for (; i < length && fredc_is_digit(s[i]); i++) {
+		if (digits < 19) {
+			mantissa = mantissa*10 + (uint64_t)(s[i]-'0');
+			digits += mantissa != 0;
+		} else {
+			dropped++;
+			truncated = true;
+		}
+	}
+	size_t int_digits = i - digits_start;
+
+	if (i < length && s[i] == '.') {
+		is_int = false;
+		for (i++; i < length && fredc_is_digit(s[i]); i++) {
+			if (digits < 19) {
+				mantissa = mantissa*10 + (uint64_t)(s[i]-'0');
+				digits += mantissa != 0;
+				exp10--;
+			} else {
+				truncated = true;
+			}
+		}
+	}
+	if (int_digits == 0 && i == digits_start + (is_int ? 0 : 1)) {
+		return result;
+	}
+
+	if (i < length && (s[i] == 'e' || s[i] == 'E')) {
+		size_t e = i+1;
+		bool exp_negative = false;
+		if (e < length && (s[e] == '-' || s[e] == '+')) {
+			exp_negative = s[e] == '-';
+			e++;
+		}
+		if (e < length && fredc_is_digit(s[e])) {
+			int exp_val = 0;
+			for (; e < length && fredc_is_digit(s[e]); e++) {
+				if (exp_val < 100000) {
+					exp_val = exp_val*10 + (s[e]-'0');
+				}
+			}
+			exp10 += exp_negative ? -exp_val : exp_val;
+			is_int = false;
+			i = e;
+		}
+	}
+	*consumed = i;
+	exp10 += dropped;
+
+	if (is_int && dropped == 0) {
+		if (!negative && mantissa <= (uint64_t)INT64_MAX) {
+			result.type = JSON_INT;
+			result.integer = (int64_t)mantissa;
+			return result;
+		} else if (negative && mantissa <= (uint64_t)INT64_MAX + 1) {
+			result.type = JSON_INT;
+			result.integer = (int64_t)(0 - mantissa);
+			return result;
+		}
+	}
+
+	result.type = JSON_NUM;
+	if (!truncated && mantissa <= (1ull << 53)) {
+		if (exp10 >= 0 && exp10 <= 22) {
+			double d = (double)mantissa * fredc_exact_pow10[exp10];
+			result.number = negative ? -d : d;
+			return result;
+		} else if (exp10 < 0 && exp10 >= -22) {
+			double d = (double)mantissa / fredc_exact_pow10[-exp10];
+			result.number = negative ? -d : d;
+			return result;
+		}
+	}
+	if (mantissa == 0) {
+		result.number = negative ? -0.0 : 0.0;
+		return result;
+	}
+
+	// Slow path: correctly rounded conversion of a bounded copy
+	char buf[128];
+	char* copy = i < sizeof(buf) ? buf : (char*)FREDC_MALLOC(i+1);
+	assert(copy);
+	memcpy(copy, s, i);
+	copy[i] = '\0';
+	result.number = strtod(copy, 0);
+	if (copy != buf) {
+		FREDC_FREE(copy);
+	}
+
+	return result;
+}
+
+static const char fredc_digit_pairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+// buf: at least FREDC_NUM_BUF bytes
+// returns: number of characters written, buf is not null terminated
+size_t fredc_format_int(int64_t value, char* buf) {
+	char tmp[24];
+	char* end = tmp + sizeof(tmp);
+	char* p = end;
+	uint64_t u = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+
+	while (u >= 100) {
+		unsigned pair = (unsigned)(u % 100) * 2;
+		u /= 100;
+		*--p = fredc_digit_pairs[pair+1];
+		*--p = fredc_digit_pairs[pair];
+	}
+	if (u >= 10) {
+		*--p = fredc_digit_pairs[u*2+1];
+		*--p = fredc_digit_pairs[u*2];
+	} else {
+		*--p = (char)('0' + u);
+	}
+	if (value < 0) {
+		*--p = '-';
+	}
+
+	size_t length = (size_t)(end - p);
+	memcpy(buf, p, length);
+	return length;
+}
+
+typedef struct fredc_diyfp {
+	uint64_t f;
+	int e;
+} fredc_diyfp;
+
+#define FREDC_DP_SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFull
+#define FREDC_DP_HIDDEN_BIT 0x0010000000000000ull
+
+static fredc_diyfp fredc_diyfp_from_double(double d) {
+	uint64_t u;
+	memcpy(&u, &d, sizeof(u));
+	int biased_e = (int)((u >> 52) & 0x7FF);
+	uint64_t significand = u & FREDC_DP_SIGNIFICAND_MASK;
+
+	if (biased_e) {
+		return (fredc_diyfp){ significand + FREDC_DP_HIDDEN_BIT, biased_e - 1075 };
+	}
+	return (fredc_diyfp){ significand, 1 - 1075 };
+}
+
+static fredc_diyfp fredc_diyfp_mul(fredc_diyfp a, fredc_diyfp b) {
+#if defined(__SIZEOF_INT128__)
+	__uint128_t p = (__uint128_t)a.f * b.f;
+	uint64_t h = (uint64_t)(p >> 64);
+	uint64_t l = (uint64_t)p;
+	h += (l >> 63) & 1; // rounding
+#else
+	uint64_t a_hi = a.f >> 32, a_lo = a.f & 0xFFFFFFFF, b_hi = b.f >> 32, b_lo = b.f & 0xFFFFFFFF;
+	uint64_t ac = a_hi*b_hi, bc = a_lo*b_hi, ad = a_hi*b_lo, bd = a_lo*b_lo;
+	uint64_t tmp = (bd >> 32) + (ad & 0xFFFFFFFF) + (bc & 0xFFFFFFFF);
+	tmp += 1u << 31; // rounding
+	uint64_t h = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+#endif
+	return (fredc_diyfp){ h, a.e + b.e + 64 };
+}
+
+static fredc_diyfp fredc_diyfp_normalize(fredc_diyfp v) {
+	while (!(v.f & (1ull << 63))) {
+		v.f <<= 1;
+		v.e--;
+	}
+	return v;
+}
+
+static void fredc_diyfp_boundaries(fredc_diyfp v, fredc_diyfp* minus, fredc_diyfp* plus) {
+	fredc_diyfp pl = { (v.f << 1) + 1, v.e - 1 };
+	while (!(pl.f & (FREDC_DP_HIDDEN_BIT << 1))) {
+		pl.f <<= 1;
+		pl.e--;
+	}
+	pl.f <<= 10; // 64 bit diyfp - 52 bit significand - 2
+	pl.e -= 10;
+
+	fredc_diyfp mi = (v.f == FREDC_DP_HIDDEN_BIT) ?
+		(fredc_diyfp){ (v.f << 2) - 1, v.e - 2 } :
+		(fredc_diyfp){ (v.f << 1) - 1, v.e - 1 };
+	mi.f <<= mi.e - pl.e;
+	mi.e = pl.e;
+
+	*plus = pl;
+	*minus = mi;
+}
+
+// Normalized 10^k for k = -348, -340, ..., 340
+static const uint64_t fredc_cached_pow_f[] = {
+	0xfa8fd5a0081c0288ull, 0xbaaee17fa23ebf76ull, 0x8b16fb203055ac76ull, 0xcf42894a5dce35eaull,
+	0x9a6bb0aa55653b2dull, 0xe61acf033d1a45dfull, 0xab70fe17c79ac6caull, 0xff77b1fcbebcdc4full,
+	0xbe5691ef416bd60cull, 0x8dd01fad907ffc3cull, 0xd3515c2831559a83ull, 0x9d71ac8fada6c9b5ull,
+	0xea9c227723ee8bcbull, 0xaecc49914078536dull, 0x823c12795db6ce57ull, 0xc21094364dfb5637ull,
+	0x9096ea6f3848984full, 0xd77485cb25823ac7ull, 0xa086cfcd97bf97f4ull, 0xef340a98172aace5ull,
+	0xb23867fb2a35b28eull, 0x84c8d4dfd2c63f3bull, 0xc5dd44271ad3cdbaull, 0x936b9fcebb25c996ull,
+	0xdbac6c247d62a584ull, 0xa3ab66580d5fdaf6ull, 0xf3e2f893dec3f126ull, 0xb5b5ada8aaff80b8ull,
+	0x87625f056c7c4a8bull, 0xc9bcff6034c13053ull, 0x964e858c91ba2655ull, 0xdff9772470297ebdull,
+	0xa6dfbd9fb8e5b88full, 0xf8a95fcf88747d94ull, 0xb94470938fa89bcfull, 0x8a08f0f8bf0f156bull,
+	0xcdb02555653131b6ull, 0x993fe2c6d07b7facull, 0xe45c10c42a2b3b06ull, 0xaa242499697392d3ull,
+	0xfd87b5f28300ca0eull, 0xbce5086492111aebull, 0x8cbccc096f5088ccull, 0xd1b71758e219652cull,
+	0x9c40000000000000ull, 0xe8d4a51000000000ull, 0xad78ebc5ac620000ull, 0x813f3978f8940984ull,
+	0xc097ce7bc90715b3ull, 0x8f7e32ce7bea5c70ull, 0xd5d238a4abe98068ull, 0x9f4f2726179a2245ull,
+	0xed63a231d4c4fb27ull, 0xb0de65388cc8ada8ull, 0x83c7088e1aab65dbull, 0xc45d1df942711d9aull,
+	0x924d692ca61be758ull, 0xda01ee641a708deaull, 0xa26da3999aef774aull, 0xf209787bb47d6b85ull,
+	0xb454e4a179dd1877ull, 0x865b86925b9bc5c2ull, 0xc83553c5c8965d3dull, 0x952ab45cfa97a0b3ull,
+	0xde469fbd99a05fe3ull, 0xa59bc234db398c25ull, 0xf6c69a72a3989f5cull, 0xb7dcbf5354e9beceull,
+	0x88fcf317f22241e2ull, 0xcc20ce9bd35c78a5ull, 0x98165af37b2153dfull, 0xe2a0b5dc971f303aull,
+	0xa8d9d1535ce3b396ull, 0xfb9b7cd9a4a7443cull, 0xbb764c4ca7a44410ull, 0x8bab8eefb6409c1aull,
+	0xd01fef10a657842cull, 0x9b10a4e5e9913129ull, 0xe7109bfba19c0c9dull, 0xac2820d9623bf429ull,
+	0x80444b5e7aa7cf85ull, 0xbf21e44003acdd2dull, 0x8e679c2f5e44ff8full, 0xd433179d9c8cb841ull,
+	0x9e19db92b4e31ba9ull, 0xeb96bf6ebadf77d9ull, 0xaf87023b9bf0ee6bull,
+};
+
+static const int16_t fredc_cached_pow_e[] = {
+	-1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+	-954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+	-688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+	-422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+	-157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+	109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+	375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+	641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+	907, 933, 960, 986, 1013, 1039, 1066,
+};
+
+static fredc_diyfp fredc_cached_power(int e, int* K) {
+	double dk = (-61 - e) * 0.30102999566398114 + 347;
+	int k = (int)dk;
+	if (dk - k > 0.0) {
+		k++;
+	}
+
+	unsigned index = (unsigned)((k >> 3) + 1);
+	*K = -(-348 + (int)(index * 8));
+	return (fredc_diyfp){ fredc_cached_pow_f[index], fredc_cached_pow_e[index] };
+}
+
+static const uint64_t fredc_pow10_u64[] = {
+	1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull,
+	100000000ull, 1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull,
+	10000000000000ull, 100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+	100000000000000000ull, 1000000000000000000ull, 10000000000000000000ull
+};
+
+static void fredc_grisu_round(char* buf, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w) {
+	while (rest < wp_w && delta - rest >= ten_kappa &&
+		(rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+		buf[len-1]--;
+		rest += ten_kappa;
+	}
+}
+
+static int fredc_count_digits32(uint32_t n) {
+	int result = 1;
+	while (n >= 10) {
+		n /= 10;
+		result++;
+	}
+	return result;
+}
+
+static void fredc_grisu_digits(fredc_diyfp W, fredc_diyfp Mp, uint64_t delta, char* buf, int* len, int* K) {
+	fredc_diyfp one = { 1ull << -Mp.e, Mp.e };
+	uint64_t wp_w = Mp.f - W.f;
+	uint32_t p1 = (uint32_t)(Mp.f >> -one.e);
+	uint64_t p2 = Mp.f & (one.f - 1);
+	int kappa = fredc_count_digits32(p1);
+	*len = 0;
+
+	while (kappa > 0) {
+		uint32_t div = (uint32_t)fredc_pow10_u64[kappa-1];
+		uint32_t d = p1 / div;
+		p1 %= div;
+		if (d || *len) {
+			buf[(*len)++] = (char)('0' + d);
+		}
+		kappa--;
+
+		uint64_t tmp = ((uint64_t)p1 << -one.e) + p2;
+		if (tmp <= delta) {
+			*K += kappa;
+			fredc_grisu_round(buf, *len, delta, tmp, fredc_pow10_u64[kappa] << -one.e, wp_w);
+			return;
+		}
+	}
+
+	for (;;) {
+		p2 *= 10;
+		delta *= 10;
+		char d = (char)(p2 >> -one.e);
+		if (d || *len) {
+			buf[(*len)++] = (char)('0' + d);
+		}
+		p2 &= one.f - 1;
+		kappa--;
+
+		if (p2 < delta) {
+			*K += kappa;
+			int index = -kappa;
+			fredc_grisu_round(buf, *len, delta, p2, one.f, wp_w * (index < 20 ? fredc_pow10_u64[index] : 0));
+			return;
+		}
+	}
+}
+
+// Writes the shortest(ish) round trip digits of a positive, finite, non
+// zero value: value == buf[0..len) * 10^K
+static void fredc_grisu2(double value, char* buf, int* len, int* K) {
+	fredc_diyfp v = fredc_diyfp_from_double(value);
+	fredc_diyfp w_m, w_p;
+	fredc_diyfp_boundaries(v, &w_m, &w_p);
+
+	fredc_diyfp c_mk = fredc_cached_power(w_p.e, K);
+	fredc_diyfp W = fredc_diyfp_mul(fredc_diyfp_normalize(v), c_mk);
+	fredc_diyfp Wp = fredc_diyfp_mul(w_p, c_mk);
+	fredc_diyfp Wm = fredc_diyfp_mul(w_m, c_mk);
+	Wm.f++;
+	Wp.f--;
+
+	fredc_grisu_digits(W, Wp, Wp.f - Wm.f, buf, len, K);
+}
+
+// Formats like JavaScript's Number.prototype.toString: plain decimal
+// notation for exponents in [-7, 21), scientific notation otherwise.
+// Non finite values have no JSON representation and are written as null.
+// buf: at least FREDC_NUM_BUF bytes
+// returns: number of characters written, buf is not null terminated
+size_t fredc_format_double(double value, char* buf) {
+	if (value != value || value - value != 0.0) {
+		memcpy(buf, "null", 4);
+		return 4;
+	}
+	if (value == 0.0) {
+		buf[0] = '0';
+		return 1;
+	}
+	if (value >= -9007199254740992.0 && value <= 9007199254740992.0 && value == (double)(int64_t)value) {
+		return fredc_format_int((int64_t)value, buf);
+	}
+
+	char* p = buf;
+	if (value < 0) {
+		*p++ = '-';
+		value = -value;
+	}
+
+	char digits[20];
+	int len = 0, K = 0;
+	fredc_grisu2(value, digits, &len, &K);
+	int n = len + K; // value == 0.digits * 10^n
+
+	if (n >= len && n <= 21) {
+		memcpy(p, digits, len);
+		memset(p + len, '0', n - len);
+		p += n;
+	} else if (n > 0 && n <= 21) {
+		memcpy(p, digits, n);
+		p[n] = '.';
+		memcpy(p + n + 1, digits + n, len - n);
+		p += len + 1;
+	} else if (n > -6 && n <= 0) {
+		p[0] = '0';
+		p[1] = '.';
+		memset(p + 2, '0', -n);
+		memcpy(p + 2 - n, digits, len);
+		p += 2 - n + len;
+	} else {
+		*p++ = digits[0];
+		if (len > 1) {
+			*p++ = '.';
+			memcpy(p, digits + 1, len - 1);
+			p += len - 1;
+		}
+		*p++ = 'e';
+		int exp = n - 1;
+		*p++ = exp < 0 ? '-' : '+';
+		p += fredc_format_int(exp < 0 ? -exp : exp, p);
+	}
+
+	return (size_t)(p - buf);
+}
+
+#define INDENT_SIZE 4
+#define FREDC_WRITER_BUF 4096
+
+fredc_writer fredc_writer_buf(char* buf, size_t capacity) {
+	fredc_writer result = { .data = buf, .capacity = capacity, .fixed = true };
+	if (capacity) {
+		buf[0] = '\0';
+	}
+	return result;
+}
+
+fredc_writer fredc_writer_cb(fredc_write_fn write, void* user) {
+	return (fredc_writer) { .write = write, .user = user };
+}
+
+static size_t fredc_writer_fwrite(void* user, const char* data, size_t length) {
+	return fwrite(data, 1, length, (FILE*)user);
+}
+
+fredc_writer fredc_writer_file(FILE* file) {
+	return fredc_writer_cb(fredc_writer_fwrite, file);
+}
+
+// Hands buffered bytes to the callback of a callback writer
+bool fredc_writer_flush(fredc_writer* w) {
+	if (w->write && w->length) {
+		if (w->write(w->user, w->data, w->length) != w->length) {
+			w->error = true;
+		}
+		w->length = 0;
+	}
+	return !w->error;
+}
+
+// Releases the buffer of a growable or callback writer, flushing it first
+void fredc_writer_free(fredc_writer* w) {
+	fredc_writer_flush(w);
+	if (!w->fixed) {
+		FREDC_FREE(w->data);
+	}
+	w->data = 0;
+	w->length = w->capacity = 0;
+}
+
+static void fredc_writer_put_slow(fredc_writer* w, const char* data, size_t length) {
+	if (w->fixed) {
+		// Keep room for the terminator, like snprintf
+		size_t room = w->capacity > w->length ? w->capacity - w->length - 1 : 0;
+		size_t n = length < room ? length : room;
+		if (n) {
+			memcpy(w->data + w->length, data, n);
+			w->length += n;
+		}
+		if (w->capacity) {
+			w->data[w->length] = '\0';
+		}
+	} else if (w->write) {
+		if (w->data == 0) {
+			w->data = (char*)FREDC_MALLOC(FREDC_WRITER_BUF);
+			assert(w->data);
+			w->capacity = FREDC_WRITER_BUF;
+		}
+		fredc_writer_flush(w);
+		if (length >= w->capacity) {
+			if (w->write(w->user, data, length) != length) {
+				w->error = true;
+			}
+		} else {
+			memcpy(w->data, data, length);
+			w->length = length;
+		}
+	} else {
+		size_t cap = w->capacity ? w->capacity : FREDC_WRITER_BUF;
+		while (cap < w->length + length + 1) {
+			cap *= 2;
+		}
+		w->data = (char*)FREDC_REALLOC(w->data, cap);
+		assert(w->data);
+		w->capacity = cap;
+		memcpy(w->data + w->length, data, length);
+		w->length += length;
+		w->data[w->length] = '\0';
+	}
+}
+
+static inline void fredc_writer_put(fredc_writer* w, const char* data, size_t length) {
+	w->total += length;
+	// Fast path leaves one byte spare so buffers can always be terminated
+	if (w->length + length < w->capacity) {
+		memcpy(w->data + w->length, data, length);
+		w->length += length;
+		if (!w->write) {
+			w->data[w->length] = '\0';
+		}
+	} else {
+		fredc_writer_put_slow(w, data, length);
+	}
+}
+
+static void fredc_writer_indent(fredc_writer* w, size_t count) {
+	static const char spaces[] = "                                                                ";
+	while (count) {
+		size_t n = count < sizeof(spaces)-1 ? count : sizeof(spaces)-1;
+		fredc_writer_put(w, spaces, n);
+		count -= n;
+	}
+}
+
+static void fredc_write_val(fredc_writer* w, fredc_val val, fredc_write_opts opts, int depth);
+static void fredc_write_string(fredc_writer* w, str8 s);
+
+static void fredc_write_key(fredc_writer* w, str8 key, fredc_write_opts opts) {
+	fredc_write_string(w, key);
+	if (opts.indent) {
+		fredc_writer_put(w, ": ", 2);
+	} else {
+		fredc_writer_put(w, ":", 1);
+	}
+}
+
+// Compact packed lists are formatted into a local buffer and written in
+// batches, skipping the per-element dispatch of fredc_write_val
+static void fredc_write_packed(fredc_writer* w, const fredc_list* list) {
+	char buf[1024];
+	size_t used = 0;
+	buf[used++] = '[';
+	for (size_t i = 0; i < list->length; i++) {
+		if (used + FREDC_NUM_BUF+2 > sizeof(buf)) { // separator, number and ']'
+			fredc_writer_put(w, buf, used);
+			used = 0;
+		}
+		if (i) {
+			buf[used++] = ',';
+		}
+		switch (list->packed) {
+			case JSON_INT: used += fredc_format_int(list->ints[i], buf+used); break;
+			case JSON_NUM: used += fredc_format_double(list->nums[i], buf+used); break;
+			case JSON_BOOL: {
+				if (list->bools[i]) {
+					memcpy(buf+used, "true", 4);
+					used += 4;
+				} else {
+					memcpy(buf+used, "false", 5);
+					used += 5;
+				}
+			} break;
+		}
+	}
+	buf[used++] = ']';
+	fredc_writer_put(w, buf, used);
+}
+
+static void fredc_write_body(fredc_writer* w, fredc_val val, fredc_write_opts opts, int depth) {
+	// Caches are kept only in headers of one's own, see fredc_val_share
+	if (opts.cache && fredc_val_shares_storage(val)) {
+		opts.cache = false;
+	}
+
+	switch (val.type) {
+		case JSON_NULL: {
+			fredc_writer_put(w, "null", 4);
+		} break;
+
+		case JSON_BOOL: {
+			if (val.boolean) {
+				fredc_writer_put(w, "true", 4);
+			} else {
+				fredc_writer_put(w, "false", 5);
+			}
+		} break;
+
+		case JSON_STRING: {
+			fredc_write_string(w, val.string);
+		} break;
+
+		case JSON_NUM: {
+			char buf[FREDC_NUM_BUF];
+			fredc_writer_put(w, buf, fredc_format_double(val.number, buf));
+		} break;
+
+		case JSON_INT: {
+			char buf[FREDC_NUM_BUF];
+			fredc_writer_put(w, buf, fredc_format_int(val.integer, buf));
+		} break;
+
+		case JSON_OBJ: {
+			if (val.object->length == 0) {
+				fredc_writer_put(w, "{}", 2);
+				break;
+			}
+
+			fredc_writer_put(w, "{", 1);
+			for (size_t i = 0; i < val.object->length; i++) {
+				fredc_node* node = val.object->props+i;
+				if (i) {
+					fredc_writer_put(w, ",", 1);
+				}
+				if (opts.indent) {
+					fredc_writer_put(w, "\n", 1);
+					fredc_writer_indent(w, (size_t)(depth+1) * opts.indent);
+				}
+				fredc_write_key(w, node->key, opts);
+				if (opts.cache) {
+					fredc_val_link(node->val, val.object, 0);
+				}
+				fredc_write_val(w, node->val, opts, depth+1);
+			}
+			if (opts.indent) {
+				fredc_writer_put(w, "\n", 1);
+				fredc_writer_indent(w, (size_t)depth * opts.indent);
+			}
+			fredc_writer_put(w, "}", 1);
+		} break;
+
+		case JSON_LIST: {
+			if (val.list->length == 0) {
+				fredc_writer_put(w, "[]", 2);
+				break;
+			}
+			if (val.list->packed && opts.indent == 0) {
+				fredc_write_packed(w, val.list);
+				break;
+			}
+
+			fredc_writer_put(w, "[", 1);
+			for (size_t i = 0; i < val.list->length; i++) {
+				if (i) {
+					fredc_writer_put(w, ",", 1);
+				}
+				if (opts.indent) {
+					fredc_writer_put(w, "\n", 1);
+					fredc_writer_indent(w, (size_t)(depth+1) * opts.indent);
+				}
+				fredc_val item = fredc_list_get(val.list, i);
+				if (opts.cache) {
+					fredc_val_link(item, 0, val.list);
+				}
+				fredc_write_val(w, item, opts, depth+1);
+			}
+			if (opts.indent) {
+				fredc_writer_put(w, "\n", 1);
+				fredc_writer_indent(w, (size_t)depth * opts.indent);
+			}
+			fredc_writer_put(w, "]", 1);
+		} break;
+
+		default: {
+			fredc_writer_put(w, "undefined", 9);
+		} break;
+	}
+}
+
+// Compact output of containers comes from their cache when they have one.
+// With opts.cache, large containers below the top level keep a copy of what
+// was written for them, as long as it went into the writer's buffer whole.
+// The top level is left out since any change invalidates it.
+static void fredc_write_val(fredc_writer* w, fredc_val val, fredc_write_opts opts, int depth) {
+	fredc_cache** cache = 0;
+	fredc_arena* arena = 0;
+	if (val.type == JSON_OBJ) {
+		cache = &val.object->cache;
+		arena = val.object->arena;
+	} else if (val.type == JSON_LIST) {
+		cache = &val.list->cache;
+		arena = val.list->arena;
+	}
+
+	if (cache && opts.indent == 0) {
+		if (*cache) {
+			fredc_writer_put(w, (*cache)->data, (*cache)->length);
+			return;
+		}
+		if (opts.cache) {
+			size_t start = w->length, total = w->total;
+			fredc_write_body(w, val, opts, depth);
+			size_t length = w->total - total;
+			if (depth > 0 && length >= FREDC_CACHE_MIN && w->write == 0 && w->length - start == length) {
+				fredc_cache_set(arena, cache, w->data + start, length);
+			}
+			return;
+		}
+	}
+
+	fredc_write_body(w, val, opts, depth);
+}
+
+// Serializes val into w in a single walk of the tree.
+// returns: number of bytes produced. For a fixed buffer this is the size
+// the full output needs, which may exceed what was actually stored.
+size_t fredc_val_write(fredc_writer* w, fredc_val val, fredc_write_opts opts) {
+	size_t start = w->total;
+	fredc_write_val(w, val, opts, 0);
+	return w->total - start;
+}
+
+// returns: exact length of the serialized value, without writing it
+size_t fredc_val_measure(fredc_val val, fredc_write_opts opts) {
+	fredc_writer w = fredc_writer_buf(0, 0);
+	return fredc_val_write(&w, val, opts);
+}
+
+// returns: a heap allocated, null terminated string the caller must free
+// with fredc_free
+str8 fredc_val_to_str8(fredc_val val, fredc_write_opts opts) {
+	size_t length = fredc_val_measure(val, opts);
+	fredc_writer w = fredc_writer_buf((char*)FREDC_MALLOC(length+1), length+1);
+	assert(w.data);
+	fredc_val_write(&w, val, opts);
+
+	return (str8){ .data = w.data, .length = w.length };
+}
+
+// Legacy entry points: the result is owned by the calling thread's str8 pool
+static str8 fredc_pool_str8(fredc_writer* w) {
+	str8 result = { .data = w->data, .length = w->length };
+	if (result.data) {
+		fredc_darr_push(pool, str8, result);
+	}
+	return result;
+}
+
+str8 fredc_val_str8ify(fredc_val val, int indent) {
+	fredc_writer w = {};
+	fredc_write_val(&w, val, (fredc_write_opts){ .indent = INDENT_SIZE }, indent);
+	return fredc_pool_str8(&w);
+}
+
+str8 fredc_node_str8ify(fredc_node prop, int indent) {
+	fredc_write_opts opts = { .indent = INDENT_SIZE };
+	fredc_writer w = {};
+	fredc_writer_indent(&w, (size_t)indent * INDENT_SIZE);
+	fredc_write_key(&w, prop.key, opts);
+	fredc_write_val(&w, prop.val, opts, indent);
+	return fredc_pool_str8(&w);
+}
+
+str8 fredc_obj_str8ify(fredc_obj o) {
+	str8 result = fredc_val_str8ify((fredc_val) {.type = JSON_OBJ, .object = &o}, 0);
+	return result;
+}
+
+char* fredc_obj_stringify(fredc_obj o) {
+	str8 result = fredc_val_str8ify((fredc_val) {.type = JSON_OBJ, .object = &o}, 0);
+	return result.data;
+}
+
+// Diffs
+// fredc_diff walks both trees together and only descends into subtrees whose
+// content hashes differ, so the parts that did not change cost one hash
+// comparison each once the trees have been hashed.
+
+typedef struct fredc_differ {
+	fredc_writer path; // JSON Pointer of the values being compared
+	fredc_list ops;
+} fredc_differ;
+
+// Appends key to the path as a reference token, escaping "~" and "/"
+static void fredc_diff_push_key(fredc_writer* path, str8 key) {
+	fredc_writer_put(path, "/", 1);
+	size_t start = 0;
+	for (size_t i = 0; i < key.length; i++) {
+		if (key.data[i] == '~' || key.data[i] == '/') {
+			fredc_writer_put(path, key.data + start, i - start);
+			fredc_writer_put(path, key.data[i] == '~' ? "~0" : "~1", 2);
+			start = i+1;
+		}
+	}
+	fredc_writer_put(path, key.data + start, key.length - start);
+}
+
+static void fredc_diff_push_index(fredc_writer* path, size_t index) {
+	char buf[FREDC_NUM_BUF];
+	fredc_writer_put(path, "/", 1);
+	fredc_writer_put(path, buf, fredc_format_int((int64_t)index, buf));
+}
+
+// Emits an operation on the current path, with a copy of value unless it is 0
+static void fredc_diff_op(fredc_differ* d, const char* op, const fredc_val* value) {
+	fredc_obj obj = new_fredc_obj(value ? 3 : 2);
+	fredc_push_prop(&obj, (str8){ "op", 2 }, fredc_heap_string(op, strlen(op)));
+	fredc_push_prop(&obj, (str8){ "path", 4 }, fredc_heap_string(d->path.data, d->path.length));
+	if (value) {
+		fredc_push_prop(&obj, (str8){ "value", 5 }, fredc_val_clone(*value));
+	}
+	fredc_darr_push(d->ops, fredc_val, fredc_val_obj(obj));
+}
+
+// from_own, to_own: the headers of from and to are the caller's to store
+// hashes in, see fredc_hash_val
+static void fredc_diff_val(fredc_differ* d, fredc_val from, fredc_val to, bool from_own, bool to_own) {
+	if (fredc_val_same(from, to) || fredc_hash_val(from, from_own) == fredc_hash_val(to, to_own)) {
+		return;
+	}
+
+	size_t mark = d->path.length;
+	from_own = from_own && !fredc_val_shares_storage(from);
+	to_own = to_own && !fredc_val_shares_storage(to);
+	if (from.type == JSON_OBJ && to.type == JSON_OBJ) {
+		for (size_t i = 0; i < from.object->length; i++) {
+			fredc_node* node = from.object->props+i;
+			fredc_node* other = fredc_get_node_hashed(to.object, node->key, node->hash);
+			fredc_diff_push_key(&d->path, node->key);
+			if (other) {
+				fredc_diff_val(d, node->val, other->val, from_own, to_own);
+			} else {
+				fredc_diff_op(d, "remove", 0);
+			}
+			d->path.length = mark;
+		}
+		for (size_t i = 0; i < to.object->length; i++) {
+			fredc_node* node = to.object->props+i;
+			if (fredc_get_node_hashed(from.object, node->key, node->hash) == 0) {
+				fredc_diff_push_key(&d->path, node->key);
+				fredc_diff_op(d, "add", &node->val);
+				d->path.length = mark;
+			}
+		}
+		return;
+	}
+
+	if (from.type == JSON_LIST && to.type == JSON_LIST) {
+		// Elements are matched by position once the common head and tail are
+		// skipped, so an insertion or removal costs one operation there
+		fredc_list *a = from.list, *b = to.list;
+		size_t a_length = a->length, b_length = b->length;
+		size_t head = 0, tail = 0;
+		while (head < a_length && head < b_length &&
+			fredc_hash_val(fredc_list_get(a, head), from_own) == fredc_hash_val(fredc_list_get(b, head), to_own)) {
+			head++;
+		}
+		while (tail < a_length - head && tail < b_length - head &&
+			fredc_hash_val(fredc_list_get(a, a_length-1 - tail), from_own) == fredc_hash_val(fredc_list_get(b, b_length-1 - tail), to_own)) {
+			tail++;
+		}
+
+		size_t a_rest = a_length - head - tail, b_rest = b_length - head - tail;
+		size_t common = a_rest < b_rest ? a_rest : b_rest;
+		for (size_t i = 0; i < common; i++) {
+			fredc_diff_push_index(&d->path, head+i);
+			fredc_diff_val(d, fredc_list_get(a, head+i), fredc_list_get(b, head+i), from_own, to_own);
+			d->path.length = mark;
+		}
+		for (size_t i = common; i < a_rest; i++) {
+			fredc_diff_push_index(&d->path, head+common);
+			fredc_diff_op(d, "remove", 0);
+			d->path.length = mark;
+		}
+		for (size_t i = common; i < b_rest; i++) {
+			fredc_diff_push_index(&d->path, head+i);
+			fredc_val added = fredc_list_get(b, head+i);
+			fredc_diff_op(d, "add", &added);
+			d->path.length = mark;
+		}
+		return;
+	}
+
+	fredc_diff_op(d, "replace", &to);
+}
+
+// Subtrees with equal content hashes are taken to be equal.
+// returns: a heap allocated JSON Patch that turns from into to when passed to
+// fredc_patch_apply, to be freed with fredc_val_free
+fredc_val fredc_diff(fredc_val from, fredc_val to) {
+	fredc_differ d = {};
+	fredc_diff_val(&d, from, to, true, true);
+	fredc_writer_free(&d.path);
+
+	return fredc_val_list(d.ops);
+}
+
+// Structural index (parse stage 1)
+// The input is classified 64 bytes at a time into bit masks of quotes,
+// backslashes, structural characters and whitespace. Escapes and string
+// interiors are then resolved with carry-propagating bit arithmetic, and the
+// positions of all token starts (structural characters outside strings,
+// opening quotes and the first byte of every other value) are extracted
+// into a flat index. The parser walks that index instead of the raw bytes.
+// Classification uses AVX2 or SSE2 when available, picked at runtime, with a
+// portable scalar fallback. Define FREDC_NO_SIMD to force the fallback.
+
+#if !defined(FREDC_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__))
+	#define FREDC_SSE2 1
+	#include <emmintrin.h>
+#endif
+#if defined(FREDC_SSE2) && (defined(__GNUC__) || defined(__clang__))
+	#define FREDC_AVX2 1
+	#include <immintrin.h>
+#endif
+
+typedef struct fredc_block_masks {
+	uint64_t quote, backslash, op, space;
+} fredc_block_masks;
+
+typedef void (*fredc_classify_fn)(const char* block, fredc_block_masks* m);
+
+static inline int fredc_ctz64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_ctzll(x);
+#else
+	int result = 0;
+	while (!(x & 1)) {
+		x >>= 1;
+		result++;
+	}
+	return result;
+#endif
+}
+
+// Only picked without SSE2. Define FREDC_TEST to keep it for comparison.
+#if !defined(FREDC_SSE2) || defined(FREDC_TEST)
+static void fredc_classify_scalar(const char* block, fredc_block_masks* m) {
+	*m = (fredc_block_masks){};
+	for (int i = 0; i < 64; i++) {
+		uint64_t bit = 1ull << i;
+		switch (block[i]) {
+			case '\"': m->quote |= bit; break;
+			case '\\': m->backslash |= bit; break;
+			case '{': case '}': case '[': case ']': case ':': case ',': m->op |= bit; break;
+			case ' ': case '\t': case '\n': case '\r': m->space |= bit; break;
+			default: break;
+		}
+	}
+}
+#endif
+
+#ifdef FREDC_SSE2
+static void fredc_classify_sse2(const char* block, fredc_block_masks* m) {
+	*m = (fredc_block_masks){};
+	for (int i = 0; i < 4; i++) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(block + i*16));
+		__m128i op = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('{')), _mm_cmpeq_epi8(v, _mm_set1_epi8('}'))),
+			_mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('[')), _mm_cmpeq_epi8(v, _mm_set1_epi8(']'))),
+				_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(':')), _mm_cmpeq_epi8(v, _mm_set1_epi8(',')))
+			)
+		);
+		__m128i space = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')))
+		);
+		int shift = i*16;
+		m->quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\"'))) << shift;
+		m->backslash |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))) << shift;
+		m->op |= (uint64_t)(uint16_t)_mm_movemask_epi8(op) << shift;
+		m->space |= (uint64_t)(uint16_t)_mm_movemask_epi8(space) << shift;
+	}
+}
+#endif
+
+#ifdef FREDC_AVX2
+__attribute__((target("avx2")))
+static void fredc_classify_avx2(const char* block, fredc_block_masks* m) {
+	*m = (fredc_block_masks){};
+	for (int i = 0; i < 2; i++) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(block + i*32));
+		__m256i op = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('{')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('}'))),
+			_mm256_or_si256(
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('[')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(']'))),
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(',')))
+			)
+		);
+		__m256i space = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')))
+		);
+		int shift = i*32;
+		m->quote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\"'))) << shift;
+		m->backslash |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))) << shift;
+		m->op |= (uint64_t)(uint32_t)_mm256_movemask_epi8(op) << shift;
+		m->space |= (uint64_t)(uint32_t)_mm256_movemask_epi8(space) << shift;
+	}
+}
+#endif
+
+static fredc_classify_fn fredc_select_classifier() {
+#ifdef FREDC_AVX2
+	if (__builtin_cpu_supports("avx2")) {
+		return fredc_classify_avx2;
+	}
+#endif
+#ifdef FREDC_SSE2
+	return fredc_classify_sse2;
+#else
+	return fredc_classify_scalar;
+#endif
+}
+
+// returns: mask of the bytes escaped by an odd-length run of backslashes
+// prev_escaped: carries whether the first byte of the next block is escaped
+static inline uint64_t fredc_find_escaped(uint64_t backslash, uint64_t* prev_escaped) {
+	const uint64_t even_bits = 0x5555555555555555ull;
+
+	backslash &= ~*prev_escaped;
+	uint64_t follows_escape = backslash << 1 | *prev_escaped;
+	uint64_t odd_starts = backslash & ~even_bits & ~follows_escape;
+	uint64_t even_sequences = odd_starts + backslash;
+	*prev_escaped = even_sequences < odd_starts;
+	uint64_t invert_mask = even_sequences << 1;
+
+	return (even_bits ^ invert_mask) & follows_escape;
+}
+
+static inline uint64_t fredc_prefix_xor(uint64_t x) {
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+	return x;
+}
+
+static void fredc_index_build_using(fredc_index* idx, const char* contents, size_t length, fredc_classify_fn classify) {
+	*idx = (fredc_index){};
+	if (length == 0 || length > UINT32_MAX) {
+		return;
+	}
+
+	uint64_t prev_escaped = 0, prev_in_string = 0, prev_scalar = 0;
+	char tail[64];
+
+	for (size_t base = 0; base < length; base += 64) {
+		const char* block = contents + base;
+		uint64_t valid = ~0ull;
+		if (length - base < 64) {
+			memset(tail, ' ', sizeof(tail));
+			memcpy(tail, block, length - base);
+			block = tail;
+			valid = (1ull << (length - base)) - 1;
+		}
+
+		fredc_block_masks m;
+		classify(block, &m);
+
+		uint64_t escaped = 0;
+		if (m.backslash || prev_escaped) {
+			escaped = fredc_find_escaped(m.backslash, &prev_escaped);
+		}
+		uint64_t quote = m.quote & ~escaped;
+		uint64_t in_string = fredc_prefix_xor(quote) ^ prev_in_string;
+		prev_in_string = (uint64_t)((int64_t)in_string >> 63);
+
+		uint64_t scalar = ~(m.op | m.space | quote) & ~in_string;
+		uint64_t scalar_start = scalar & ~((scalar << 1) | prev_scalar);
+		prev_scalar = scalar >> 63;
+
+		uint64_t tokens = ((m.op & ~in_string) | (quote & in_string) | scalar_start) & valid;
+
+		if (idx->length + 64 > idx->capacity) {
+			size_t cap = idx->capacity ? idx->capacity*2 : (length/4 + 64);
+			idx->data = (uint32_t*)FREDC_REALLOC(idx->data, cap * sizeof(uint32_t));
+			assert(idx->data);
+			idx->capacity = cap;
+		}
+		while (tokens) {
+			idx->data[idx->length++] = (uint32_t)(base + fredc_ctz64(tokens));
+			tokens &= tokens-1;
+		}
+	}
+}
+
+// Builds the structural index of contents. Inputs over 4 GiB are not
+// indexed (the returned index is empty) and parse byte by byte instead.
+fredc_index fredc_index_build(const char* contents, size_t length) {
+	fredc_index result;
+	fredc_index_build_using(&result, contents, length, fredc_select_classifier());
+	return result;
+}
+
+void fredc_index_free(fredc_index* idx) {
+	FREDC_FREE(idx->data);
+	*idx = (fredc_index){};
+}
+
+// returns: offset of the first quote or backslash in data, or length
+static size_t fredc_scan_string(const char* data, size_t length) {
+	size_t i = 0;
+#ifdef FREDC_SSE2
+	const __m128i quote = _mm_set1_epi8('\"'), backslash = _mm_set1_epi8('\\');
+	for (; i + 16 <= length; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+		int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)));
+		if (mask) {
+			return i + fredc_ctz64((uint64_t)mask);
+		}
+	}
+#endif
+	for (; i < length; i++) {
+		if (data[i] == '\"' || data[i] == '\\') {
+			break;
+		}
+	}
+	return i;
+}
+
+// Reductions
+// Packed lists are reduced 128 bits at a time. The double accumulators are
+// split into four lanes that the scalar fallback mirrors, so both give the
+// same sums. SSE2 has no 64-bit integer compare, which leaves int min and max
+// to a scalar loop with independent accumulators.
+
+static inline int fredc_popcount(unsigned x) {
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_popcount(x);
+#else
+	int result = 0;
+	for (; x; x &= x-1) {
+		result++;
+	}
+	return result;
+#endif
+}
+
+static double fredc_nums_sum(const double* nums, size_t length) {
+	size_t i = 0;
+	double sum = 0;
+#ifdef FREDC_SSE2
+	__m128d a = _mm_setzero_pd(), b = _mm_setzero_pd();
+	for (; i + 4 <= length; i += 4) {
+		a = _mm_add_pd(a, _mm_loadu_pd(nums + i));
+		b = _mm_add_pd(b, _mm_loadu_pd(nums + i+2));
+	}
+	double lanes[2];
+	_mm_storeu_pd(lanes, _mm_add_pd(a, b));
+	sum = lanes[0] + lanes[1];
+#else
+	double acc[4] = {};
+	for (; i + 4 <= length; i += 4) {
+		for (int j = 0; j < 4; j++) {
+			acc[j] += nums[i+j];
+		}
+	}
+	sum = (acc[0] + acc[2]) + (acc[1] + acc[3]);
+#endif
+	for (; i < length; i++) {
+		sum += nums[i];
+	}
+	return sum;
+}
+
+static int64_t fredc_ints_sum(const int64_t* ints, size_t length) {
+	size_t i = 0;
+	uint64_t sum = 0;
+#ifdef FREDC_SSE2
+	__m128i a = _mm_setzero_si128(), b = _mm_setzero_si128();
+	for (; i + 4 <= length; i += 4) {
+		a = _mm_add_epi64(a, _mm_loadu_si128((const __m128i*)(ints + i)));
+		b = _mm_add_epi64(b, _mm_loadu_si128((const __m128i*)(ints + i+2)));
+	}
+	uint64_t lanes[2];
+	_mm_storeu_si128((__m128i*)lanes, _mm_add_epi64(a, b));
+	sum = lanes[0] + lanes[1];
+#endif
+	for (; i < length; i++) {
+		sum += (uint64_t)ints[i];
+	}
+	return (int64_t)sum;
+}
+
+// list must not be empty
+static double fredc_nums_extreme(const double* nums, size_t length, bool max) {
+	size_t i = 0;
+	double result = nums[0];
+#ifdef FREDC_SSE2
+	if (length >= 4) {
+		__m128d a = _mm_loadu_pd(nums), b = _mm_loadu_pd(nums+2);
+		for (i = 4; i + 4 <= length; i += 4) {
+			__m128d x = _mm_loadu_pd(nums + i), y = _mm_loadu_pd(nums + i+2);
+			a = max ? _mm_max_pd(a, x) : _mm_min_pd(a, x);
+			b = max ? _mm_max_pd(b, y) : _mm_min_pd(b, y);
+		}
+		double lanes[2];
+		_mm_storeu_pd(lanes, max ? _mm_max_pd(a, b) : _mm_min_pd(a, b));
+		result = max ? (lanes[0] > lanes[1] ? lanes[0] : lanes[1]) : (lanes[0] < lanes[1] ? lanes[0] : lanes[1]);
+	}
+#endif
+	for (; i < length; i++) {
+		if (max ? nums[i] > result : nums[i] < result) {
+			result = nums[i];
+		}
+	}
+	return result;
+}
+
+// list must not be empty
+static int64_t fredc_ints_extreme(const int64_t* ints, size_t length, bool max) {
+	int64_t acc[4] = { ints[0], ints[0], ints[0], ints[0] };
+	size_t i = 0;
+	for (; i + 4 <= length; i += 4) {
+		for (int j = 0; j < 4; j++) {
+			int64_t n = ints[i+j];
+			acc[j] = (max ? n > acc[j] : n < acc[j]) ? n : acc[j];
+		}
+	}
+	for (; i < length; i++) {
+		acc[0] = (max ? ints[i] > acc[0] : ints[i] < acc[0]) ? ints[i] : acc[0];
+	}
+	for (int j = 1; j < 4; j++) {
+		acc[0] = (max ? acc[j] > acc[0] : acc[j] < acc[0]) ? acc[j] : acc[0];
+	}
+	return acc[0];
+}
+
+// Ints of packed int lists are added in 64 bits, which wraps on overflow.
+// Other lists are added up as doubles.
+// returns: the sum of the numbers in list, non-numbers are skipped
+double fredc_list_sum(const fredc_list* list) {
+	switch (list->packed) {
+		case JSON_NUM: return fredc_nums_sum(list->nums, list->length);
+		case JSON_INT: return (double)fredc_ints_sum(list->ints, list->length);
+		case JSON_BOOL: return 0;
+	}
+
+	double sum = 0;
+	for (size_t i = 0; i < list->length; i++) {
+		fredc_val v = list->data[i];
+		if (v.type == JSON_INT) {
+			sum += (double)v.integer;
+		} else if (v.type == JSON_NUM) {
+			sum += v.number;
+		}
+	}
+	return sum;
+}
+
+static double fredc_list_extreme(const fredc_list* list, bool max) {
+	if (list->length && list->packed == JSON_NUM) {
+		return fredc_nums_extreme(list->nums, list->length, max);
+	}
+	if (list->length && list->packed == JSON_INT) {
+		return (double)fredc_ints_extreme(list->ints, list->length, max);
+	}
+
+	double result = NAN;
+	for (size_t i = 0; !list->packed && i < list->length; i++) {
+		fredc_val v = list->data[i];
+		if (v.type != JSON_INT && v.type != JSON_NUM) {
+			continue;
+		}
+		double n = v.type == JSON_INT ? (double)v.integer : v.number;
+		if (isnan(result) || (max ? n > result : n < result)) {
+			result = n;
+		}
+	}
+	return result;
+}
+
+// returns: the smallest number in list, non-numbers are skipped, or NAN if
+// there are none
+double fredc_list_min(const fredc_list* list) {
+	return fredc_list_extreme(list, false);
+}
+
+// returns: the largest number in list, non-numbers are skipped, or NAN if
+// there are none
+double fredc_list_max(const fredc_list* list) {
+	return fredc_list_extreme(list, true);
+}
+
+static size_t fredc_nums_count(const double* nums, size_t length, double n) {
+	size_t i = 0, result = 0;
+#ifdef FREDC_SSE2
+	__m128d needle = _mm_set1_pd(n);
+	for (; i + 2 <= length; i += 2) {
+		result += fredc_popcount(_mm_movemask_pd(_mm_cmpeq_pd(_mm_loadu_pd(nums + i), needle)));
+	}
+#endif
+	for (; i < length; i++) {
+		result += nums[i] == n;
+	}
+	return result;
+}
+
+static size_t fredc_ints_count(const int64_t* ints, size_t length, int64_t n) {
+	size_t i = 0, result = 0;
+#ifdef FREDC_SSE2
+	// Both 32-bit halves of an element have to match
+	__m128i needle = _mm_set1_epi64x(n);
+	for (; i + 2 <= length; i += 2) {
+		__m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(ints + i)), needle);
+		eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+		result += fredc_popcount(_mm_movemask_pd(_mm_castsi128_pd(eq)));
+	}
+#endif
+	for (; i < length; i++) {
+		result += ints[i] == n;
+	}
+	return result;
+}
+
+static size_t fredc_bools_count(const bool* bools, size_t length, bool b) {
+	size_t i = 0, result = 0;
+#ifdef FREDC_SSE2
+	__m128i needle = _mm_set1_epi8((char)b);
+	for (; i + 16 <= length; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(bools + i));
+		result += fredc_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)));
+	}
+#endif
+	for (; i < length; i++) {
+		result += bools[i] == b;
+	}
+	return result;
+}
+
+// returns: the number of elements of list equal to val, see fredc_val_equal
+size_t fredc_list_count(const fredc_list* list, fredc_val val) {
+	int64_t integer;
+	switch (list->packed) {
+		case JSON_NUM: {
+			if (val.type == JSON_INT) {
+				// Only ints that a double holds exactly can be equal to one
+				double n = (double)val.integer;
+				if (!fredc_num_to_int(n, &integer) || integer != val.integer) {
+					return 0;
+				}
+				return fredc_nums_count(list->nums, list->length, n);
+			}
+			return val.type == JSON_NUM ? fredc_nums_count(list->nums, list->length, val.number) : 0;
+		}
+		case JSON_INT: {
+			if (val.type == JSON_NUM && fredc_num_to_int(val.number, &integer)) {
+				return fredc_ints_count(list->ints, list->length, integer);
+			}
+			return val.type == JSON_INT ? fredc_ints_count(list->ints, list->length, val.integer) : 0;
+		}
+		case JSON_BOOL: {
+			return val.type == JSON_BOOL ? fredc_bools_count(list->bools, list->length, val.boolean) : 0;
+		}
+	}
+
+	size_t result = 0;
+	for (size_t i = 0; i < list->length; i++) {
+		result += fredc_val_equal(list->data[i], val);
+	}
+	return result;
+}
+
+// String escapes
+// Both directions look for the few bytes that need work 16 at a time and
+// copy the runs between them as a block.
+
+// returns: offset of the first byte in data that must be escaped in JSON
+// output (a quote, a backslash or a control character), or length
+static size_t fredc_scan_unsafe(const char* data, size_t length) {
+	size_t i = 0;
+#ifdef FREDC_SSE2
+	const __m128i quote = _mm_set1_epi8('\"'), backslash = _mm_set1_epi8('\\');
+	const __m128i space = _mm_set1_epi8(0x20), flip = _mm_set1_epi8((char)0x80);
+	for (; i + 16 <= length; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+		// Unsigned v < 0x20, as a signed compare with the sign bits flipped
+		__m128i control = _mm_cmplt_epi8(_mm_xor_si128(v, flip), _mm_xor_si128(space, flip));
+		int mask = _mm_movemask_epi8(_mm_or_si128(control,
+			_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash))));
+		if (mask) {
+			return i + fredc_ctz64((uint64_t)mask);
+		}
+	}
+#endif
+	for (; i < length; i++) {
+		unsigned char c = (unsigned char)data[i];
+		if (c < 0x20 || c == '\"' || c == '\\') {
+			break;
+		}
+	}
+	return i;
+}
+
+// Writes s as a quoted JSON string
+static void fredc_write_string(fredc_writer* w, str8 s) {
+	static const char hex[] = "0123456789abcdef";
+	fredc_writer_put(w, "\"", 1);
+
+	size_t pos = 0;
+	while (pos < s.length) {
+		size_t run = fredc_scan_unsafe(s.data + pos, s.length - pos);
+		if (run) {
+			fredc_writer_put(w, s.data + pos, run);
+			pos += run;
+		}
+		if (pos >= s.length) {
+			break;
+		}
+
+		unsigned char c = (unsigned char)s.data[pos++];
+		char esc[6] = { '\\', 0 };
+		size_t n = 2;
+		switch (c) {
+			case '\"': esc[1] = '\"'; break;
+			case '\\': esc[1] = '\\'; break;
+			case '\b': esc[1] = 'b'; break;
+			case '\f': esc[1] = 'f'; break;
+			case '\n': esc[1] = 'n'; break;
+			case '\r': esc[1] = 'r'; break;
+			case '\t': esc[1] = 't'; break;
+			default: {
+				esc[1] = 'u';
+				esc[2] = '0';
+				esc[3] = '0';
+				esc[4] = hex[c >> 4];
+				esc[5] = hex[c & 15];
+				n = 6;
+			} break;
+		}
+		fredc_writer_put(w, esc, n);
+	}
+
+	fredc_writer_put(w, "\"", 1);
+}
+
+static inline int fredc_hex_value(unsigned char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+static int fredc_hex4(const char* s) {
+	int result = 0;
+	for (int i = 0; i < 4; i++) {
+		int digit = fredc_hex_value((unsigned char)s[i]);
+		if (digit < 0) {
+			return -1;
+		}
+		result = result << 4 | digit;
+	}
+	return result;
+}
+
+// returns: number of bytes written to out, at most 4
+static size_t fredc_utf8_encode(uint32_t cp, char* out) {
+	if (cp < 0x80) {
+		out[0] = (char)cp;
+		return 1;
+	} else if (cp < 0x800) {
+		out[0] = (char)(0xC0 | cp >> 6);
+		out[1] = (char)(0x80 | (cp & 0x3F));
+		return 2;
+	} else if (cp < 0x10000) {
+		out[0] = (char)(0xE0 | cp >> 12);
+		out[1] = (char)(0x80 | (cp >> 6 & 0x3F));
+		out[2] = (char)(0x80 | (cp & 0x3F));
+		return 3;
+	}
+	out[0] = (char)(0xF0 | cp >> 18);
+	out[1] = (char)(0x80 | (cp >> 12 & 0x3F));
+	out[2] = (char)(0x80 | (cp >> 6 & 0x3F));
+	out[3] = (char)(0x80 | (cp & 0x3F));
+	return 4;
+}
+
+// Decodes the escapes of a JSON string body (without its quotes) into dst,
+// which needs room for length bytes and may be src itself: no escape decodes
+// to more bytes than it takes up. Surrogate pairs are joined, unpaired
+// surrogates become U+FFFD and malformed escapes are kept as they are.
+// returns: the decoded length
+size_t fredc_unescape(const char* src, size_t length, char* dst) {
+	size_t in = 0, out = 0;
+	while (in < length) {
+		size_t run = fredc_scan_string(src + in, length - in);
+		if (run) {
+			if (dst + out != src + in) {
+				memmove(dst + out, src + in, run);
+			}
+			in += run;
+			out += run;
+		}
+		if (in >= length) {
+			break;
+		}
+		if (src[in] != '\\' || in+1 >= length) {
+			dst[out++] = src[in++];
+			continue;
+		}
+
+		char c = src[in+1];
+		switch (c) {
+			case 'b': c = '\b'; break;
+			case 'f': c = '\f'; break;
+			case 'n': c = '\n'; break;
+			case 'r': c = '\r'; break;
+			case 't': c = '\t'; break;
+			case '\"': case '\\': case '/': break;
+			case 'u': {
+				int cp = in+6 <= length ? fredc_hex4(src + in+2) : -1;
+				if (cp < 0) {
+					c = 0;
+					break;
+				}
+				in += 6;
+				if (cp >= 0xD800 && cp <= 0xDBFF) {
+					int low = in+6 <= length && src[in] == '\\' && src[in+1] == 'u' ? fredc_hex4(src + in+2) : -1;
+					if (low >= 0xDC00 && low <= 0xDFFF) {
+						cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+						in += 6;
+					} else {
+						cp = 0xFFFD;
+					}
+				} else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+					cp = 0xFFFD;
+				}
+				out += fredc_utf8_encode((uint32_t)cp, dst + out);
+			} continue;
+			default: c = 0; break;
+		}
+
+		if (c == 0) {
+			// Not an escape: keep the backslash, the next byte follows as is
+			dst[out++] = src[in++];
+			continue;
+		}
+		dst[out++] = c;
+		in += 2;
+	}
+
+	return out;
+}
+
+// Single forward pass recursive descent parser.
+// Every byte of the input is visited once; nested objects and lists are parsed
+// in place as they are reached instead of being scanned for and re-parsed.
+// The parser is lenient: trailing commas are accepted and malformed values
+// become JSON_UNDEFINED rather than aborting the whole document.
+
+#define FREDC_MAX_DEPTH 1024
+
+typedef struct fredc_parser {
+	const char* data;
+	size_t length, pos;
+	int depth;
+
+	fredc_index index; // token starts, empty to scan byte by byte
+	size_t token;
+
+	fredc_arena* arena; // destination of the tree, 0 for heap
+	fredc_arena* owner; // arena recorded in containers, when not arena itself
+	bool insitu; // strings point into data, see FREDC_PARSE_INSITU
+	bool intern_keys, intern_strings;
+	bool escaped; // the last string read had escapes
+	bool pack; // see FREDC_PARSE_PACK
+	fredc_intern intern;
+
+	// A container built ahead of time (see fredc_doc_parse_parallel) that is
+	// used as is when the parser reaches its open token
+	bool has_splice;
+	uint32_t splice_open, splice_close;
+	fredc_val splice_val;
+
+	// Members of the containers being parsed are collected here first so
+	// each object and list is allocated once at its final size.
+	fredc_list vals;
+	fredc_node_list nodes;
+	size_t scratch_peak;
+} fredc_parser;
+
+static fredc_val fredc_parser_val(fredc_parser* p);
+
+static void fredc_parser_set_flags(fredc_parser* p, unsigned flags) {
+	p->insitu = (flags & FREDC_PARSE_INSITU) != 0;
+	p->intern_strings = (flags & FREDC_PARSE_INTERN_STRINGS) != 0;
+	p->intern_keys = p->intern_strings || (flags & FREDC_PARSE_INTERN) != 0;
+	p->pack = (flags & FREDC_PARSE_PACK) != 0;
+}
+
+// returns: whether s was decoded into a copy of its own by fredc_parser_text
+static inline bool fredc_parser_decoded(fredc_parser* p, str8 s) {
+	return s.data < p->data || s.data > p->data + p->length;
+}
+
+// returns: raw as it should be stored in the tree, either interned, borrowed
+// from the input or copied to the destination arena
+static str8 fredc_parser_keep(fredc_parser* p, str8 raw, uint64_t hash) {
+	bool decoded = fredc_parser_decoded(p, raw);
+	if (p->intern_keys && p->arena) {
+		return fredc_intern_str8(&p->intern, p->arena, raw, hash, p->insitu || decoded);
+	}
+	if (p->insitu || decoded) {
+		return raw;
+	}
+
+	str8 result = { .data = (char*)fredc_alloc(p->arena, raw.length+1), .length = raw.length };
+	memcpy(result.data, raw.data, raw.length);
+	result.data[raw.length] = '\0';
+	return result;
+}
+
+// Moves p->pos to the next token at or after it
+static void fredc_parser_skip_space(fredc_parser* p) {
+	if (p->index.data) {
+		while (p->token < p->index.length && p->index.data[p->token] < p->pos) {
+			p->token++;
+		}
+		p->pos = p->token < p->index.length ? p->index.data[p->token] : p->length;
+		return;
+	}
+
+	while (p->pos < p->length && isspace((unsigned char)p->data[p->pos])) {
+		p->pos++;
+	}
+}
+
+// Reads the quoted string starting at p->pos.
+// returns: the raw bytes between the quotes (pointing into the input)
+static str8 fredc_parser_string(fredc_parser* p) {
+	str8 result = {};
+	size_t start = ++p->pos;
+	p->escaped = false;
+
+	while (p->pos < p->length) {
+		p->pos += fredc_scan_string(p->data + p->pos, p->length - p->pos);
+		if (p->pos >= p->length || p->data[p->pos] == '\"') {
+			break;
+		}
+		p->escaped = true;
+		p->pos += 2; // backslash and the escaped byte
+	}
+
+	if (p->pos > p->length) {
+		p->pos = p->length;
+	}
+	result = (str8){ .data = (char*)p->data+start, .length = p->pos-start };
+	if (p->pos < p->length) {
+		p->pos++; // closing quote
+	}
+
+	return result;
+}
+
+// Reads the quoted string starting at p->pos with its escapes decoded.
+// returns: the bytes between the quotes in the input when there are no
+// escapes, else a null terminated copy allocated from the arena
+static str8 fredc_parser_text(fredc_parser* p) {
+	str8 raw = fredc_parser_string(p);
+	if (!p->escaped) {
+		return raw;
+	}
+
+	str8 result = { .data = (char*)fredc_alloc(p->arena, raw.length+1) };
+	result.length = fredc_unescape(raw.data, raw.length, result.data);
+	result.data[result.length] = '\0';
+	return result;
+}
+
+static bool fredc_parser_literal(fredc_parser* p, const char* lit, size_t len) {
+	if (p->length - p->pos >= len && memcmp(p->data+p->pos, lit, len) == 0) {
+		p->pos += len;
+		return true;
+	}
+	return false;
+}
+
+static fredc_val fredc_parser_num(fredc_parser* p) {
+	size_t consumed;
+	fredc_val result = fredc_parse_number(p->data + p->pos, p->length - p->pos, &consumed);
+	p->pos += consumed;
+
+	return result;
+}
+
+static void fredc_parser_track_scratch(fredc_parser* p) {
+	size_t bytes = p->vals.capacity * sizeof(fredc_val) + p->nodes.capacity * sizeof(fredc_node) +
+		p->intern.capacity * sizeof(fredc_intern_slot);
+	if (bytes > p->scratch_peak) {
+		p->scratch_peak = bytes;
+	}
+}
+
+static fredc_parser fredc_parser_init(const char* contents, size_t length, fredc_arena* arena) {
+	return (fredc_parser) {
+		.data = contents,
+		.length = length,
+		.index = fredc_index_build(contents, length),
+		.arena = arena,
+	};
+}
+
+static void fredc_parser_free(fredc_parser* p) {
+	fredc_index_free(&p->index);
+	fredc_intern_free(&p->intern);
+	FREDC_FREE(p->vals.data);
+	FREDC_FREE(p->nodes.data);
+	p->vals = (fredc_list){};
+	p->nodes = (fredc_node_list){};
+}
+
+static fredc_obj fredc_parser_obj(fredc_parser* p) {
+	size_t base = p->nodes.length;
+	p->pos++; // '{'
+
+	while (p->pos < p->length) {
+		fredc_parser_skip_space(p);
+		if (p->pos >= p->length) break;
+
+		char c = p->data[p->pos];
+		if (c == '}') {
+			p->pos++;
+			break;
+		} else if (c == ',') {
+			p->pos++;
+			continue;
+		} else if (c != '\"') {
+			// Not a key: skip the stray byte so the loop always makes progress
+			p->pos++;
+			continue;
+		}
+
+		str8 key = fredc_parser_text(p);
+		fredc_parser_skip_space(p);
+		if (p->pos >= p->length || p->data[p->pos] != ':') {
+			if (fredc_parser_decoded(p, key)) {
+				fredc_release(p->arena, key.data);
+			}
+			continue;
+		}
+		p->pos++;
+
+		fredc_node node = {.key = key, .val = fredc_parser_val(p)};
+		fredc_darr_push(p->nodes, fredc_node, node);
+	}
+	fredc_parser_track_scratch(p);
+
+	fredc_obj result = new_fredc_obj_in(p->arena, p->nodes.length - base);
+	for (size_t i = base; i < p->nodes.length; i++) {
+		fredc_node* node = p->nodes.data + i;
+		uint64_t hash = fredc_hash_str8(node->key);
+		fredc_push_prop_hashed(&result, fredc_parser_keep(p, node->key, hash), hash, node->val, true);
+	}
+	p->nodes.length = base;
+	if (p->owner) {
+		result.arena = p->owner;
+	}
+
+	return result;
+}
+
+static fredc_list fredc_parser_list(fredc_parser* p) {
+	size_t base = p->vals.length;
+	p->pos++; // '['
+
+	while (p->pos < p->length) {
+		fredc_parser_skip_space(p);
+		if (p->pos >= p->length) break;
+
+		char c = p->data[p->pos];
+		if (c == ']') {
+			p->pos++;
+			break;
+		} else if (c == ',') {
+			p->pos++;
+			continue;
+		}
+
+		size_t start = p->pos;
+		fredc_val item = fredc_parser_val(p);
+		fredc_darr_push(p->vals, fredc_val, item);
+		if (p->pos == start) {
+			p->pos++;
+		}
+	}
+	fredc_parser_track_scratch(p);
+
+	fredc_list result = { .arena = p->owner ? p->owner : p->arena };
+	size_t count = p->vals.length - base;
+	unsigned char packed = 0;
+	if (count && p->pack) {
+		fredc_pack_scan scan = {};
+		fredc_pack_scan_vals(&scan, p->vals.data + base, count);
+		packed = fredc_pack_type(&scan);
+	}
+	if (packed) {
+		fredc_list_alloc(&result, p->arena, packed, count);
+		fredc_pack_store(&result, 0, p->vals.data + base, count);
+	} else if (count) {
+		result.data = (fredc_val*)fredc_alloc(p->arena, count * sizeof(fredc_val));
+		result.length = result.capacity = count;
+		memcpy(result.data, p->vals.data + base, count * sizeof(fredc_val));
+	}
+	p->vals.length = base;
+
+	return result;
+}
+
+static fredc_val fredc_parser_val(fredc_parser* p) {
+	fredc_val result = {};
+
+	fredc_parser_skip_space(p);
+	if (p->pos >= p->length || p->depth >= FREDC_MAX_DEPTH) {
+		return result;
+	}
+
+	if (p->has_splice && p->token == p->splice_open && p->index.data) {
+		p->pos = p->splice_close < p->index.length ? p->index.data[p->splice_close]+1 : p->length;
+		return p->splice_val;
+	}
+
+	switch (p->data[p->pos]) {
+		case '{': {
+			p->depth++;
+			// The header comes from the parser's own arena, which differs from
+			// the arena recorded in the object when parsing in parallel
+			result.type = JSON_OBJ;
+			result.object = (fredc_obj*)fredc_alloc(p->arena, sizeof(fredc_obj));
+			*result.object = fredc_parser_obj(p);
+			p->depth--;
+		} break;
+
+		case '[': {
+			p->depth++;
+			result.type = JSON_LIST;
+			result.list = (fredc_list*)fredc_alloc(p->arena, sizeof(fredc_list));
+			*result.list = fredc_parser_list(p);
+			p->depth--;
+		} break;
+
+		case '\"': {
+			str8 val = fredc_parser_text(p);
+			bool decoded = fredc_parser_decoded(p, val);
+			result.type = JSON_STRING;
+			if (p->intern_strings && p->arena && val.length <= FREDC_INTERN_MAX_STRING) {
+				result.string = fredc_intern_str8(&p->intern, p->arena, val, fredc_hash_str8(val), p->insitu || decoded);
+				break;
+			}
+			if (p->insitu || decoded) {
+				result.string = val;
+				break;
+			}
+			result.string.length = val.length;
+			result.string.data = (char*)fredc_alloc(p->arena, val.length+1);
+			memcpy(result.string.data, val.data, val.length);
+			result.string.data[val.length] = '\0';
+		} break;
+
+		case 't': {
+			if (fredc_parser_literal(p, "true", 4)) {
+				result.type = JSON_BOOL;
+				result.boolean = true;
+			}
+		} break;
+
+		case 'f': {
+			if (fredc_parser_literal(p, "false", 5)) {
+				result.type = JSON_BOOL;
+				result.boolean = false;
+			}
+		} break;
+
+		case 'n': {
+			if (fredc_parser_literal(p, "null", 4)) {
+				result.type = JSON_NULL;
+			}
+		} break;
+
+		default: {
+			result = fredc_parser_num(p);
+		} break;
+	}
+
+	return result;
+}
+
+fredc_val fredc_parse_val(const char* contents, size_t length) {
+	fredc_parser p = fredc_parser_init(contents, length, 0);
+	fredc_val result = fredc_parser_val(&p);
+	fredc_parser_free(&p);
+	return result;
+}
+
+fredc_list fredc_parse_list_str(const char* contents, size_t length) {
+	fredc_parser p = fredc_parser_init(contents, length, 0);
+
+	fredc_list result = {};
+	fredc_parser_skip_space(&p);
+	if (p.pos < p.length && p.data[p.pos] == '[') {
+		result = fredc_parser_list(&p);
+	}
+	fredc_parser_free(&p);
+	return result;
+}
+
+fredc_obj fredc_parse_obj_str(const char* contents, size_t length) {
+	fredc_parser p = fredc_parser_init(contents, length, 0);
+
+	fredc_obj result = {};
+	fredc_parser_skip_space(&p);
+	if (p.pos < p.length && p.data[p.pos] == '{') {
+		result = fredc_parser_obj(&p);
+	}
+	fredc_parser_free(&p);
+	return result;
+}
+
+// Parses any JSON value into a new document.
+// returns: document owning the whole tree, root is JSON_UNDEFINED on failure
+fredc_doc* fredc_doc_parse(const char* contents, size_t length) {
+	return fredc_doc_parse_ex(contents, length, 0);
+}
+
+fredc_doc* fredc_doc_parse_ex(const char* contents, size_t length, unsigned flags) {
+	unsigned long long start = fredc_now_ns();
+
+	fredc_doc* doc = (fredc_doc*)FREDC_CALLOC(1, sizeof(fredc_doc));
+	assert(doc);
+	// Trees are usually about the size of their source text
+	doc->arena.chunk_size = length < FREDC_ARENA_MAX_CHUNK ? length : FREDC_ARENA_MAX_CHUNK;
+
+	fredc_parser p = fredc_parser_init(contents, length, &doc->arena);
+	fredc_parser_set_flags(&p, flags);
+	doc->root = (fredc_val*)fredc_arena_alloc(&doc->arena, sizeof(fredc_val));
+	*doc->root = fredc_parser_val(&p);
+
+	fredc_parser_track_scratch(&p);
+	doc->stats.bytes_scratch = p.scratch_peak;
+	doc->stats.input_length = length;
+	fredc_parser_free(&p);
+
+	doc->stats.parse_ns = fredc_now_ns() - start;
+	return doc;
+}
+
+fredc_doc_stats fredc_doc_get_stats(fredc_doc* doc) {
+	fredc_doc_stats result = doc->stats;
+	result.bytes_used = doc->arena.bytes_used;
+	result.bytes_reserved = doc->arena.bytes_reserved;
+	result.chunks = doc->arena.chunks;
+	result.allocations = doc->arena.allocations;
+	return result;
+}
+
+fredc_obj_stats fredc_obj_get_stats(fredc_obj* obj) {
+	fredc_obj_stats result = {
+		.length = obj->length,
+		.capacity = obj->capacity,
+		.index_cap = obj->index_cap,
+	};
+	if (obj->index == 0 || obj->index_cap == 0) {
+		return result;
+	}
+
+	// Probe length of every entry: distance from its home slot to its slot
+	size_t mask = obj->index_cap-1, total = 0;
+	for (size_t slot = 0; slot < obj->index_cap; slot++) {
+		if (obj->index[slot]) {
+			size_t home = obj->props[obj->index[slot]-1].hash & mask;
+			size_t probe = ((slot - home) & mask) + 1;
+			total += probe;
+			if (probe > result.max_probe) {
+				result.max_probe = probe;
+			}
+		}
+	}
+	result.load = (double)obj->length / obj->index_cap;
+	result.mean_probe = obj->length ? (double)total / obj->length : 0;
+	return result;
+}
+
+static void fredc_tree_stats_add(fredc_tree_stats* stats, fredc_val* val, size_t depth) {
+	if (depth > stats->max_depth) {
+		stats->max_depth = depth;
+	}
+
+	switch (val->type) {
+		case JSON_STRING: {
+			stats->strings++;
+			stats->string_bytes += val->string.length;
+		} break;
+
+		case JSON_OBJ: {
+			fredc_obj_stats obj = fredc_obj_get_stats(val->object);
+			stats->objects++;
+			stats->members += val->object->length;
+			if (obj.max_probe > stats->max_probe) stats->max_probe = obj.max_probe;
+			if (obj.load > stats->max_load) stats->max_load = obj.load;
+			for (size_t i = 0; i < val->object->length; i++) {
+				stats->string_bytes += val->object->props[i].key.length;
+				fredc_tree_stats_add(stats, &val->object->props[i].val, depth+1);
+			}
+		} break;
+
+		case JSON_LIST: {
+			stats->lists++;
+			stats->members += val->list->length;
+			for (size_t i = 0; i < val->list->length; i++) {
+				fredc_val item = fredc_list_get(val->list, i);
+				fredc_tree_stats_add(stats, &item, depth+1);
+			}
+		} break;
+
+		default: {
+			stats->scalars++;
+		} break;
+	}
+}
+
+fredc_tree_stats fredc_val_get_stats(fredc_val val) {
+	fredc_tree_stats result = {0};
+	fredc_tree_stats_add(&result, &val, 0);
+	return result;
+}
+
+void fredc_doc_free(fredc_doc* doc) {
+	if (doc) {
+		fredc_arena_free(&doc->arena);
+		FREDC_FREE(doc);
+	}
+}
+
+// Parallel parsing
+// Stage 1 runs once over the whole text. The members of the container being
+// split are then found by walking its tokens, starting from the root and
+// descending into a member that holds most of the bytes when the container
+// itself has too few members to spread out. Ranges of members are parsed by
+// workers into arenas of their own, which are spliced into the document
+// arena, and the container is stitched together from their results. The rest
+// of the document is parsed as usual, taking the finished container in place.
+
+#define FREDC_PARALLEL_MIN (1024*1024) // smaller texts are parsed serially
+#define FREDC_PARALLEL_JOB (256*1024)  // smallest range handed to a worker
+#define FREDC_PARALLEL_JOBS_PER_THREAD 4
+
+typedef struct fredc_token_list {
+	uint32_t* data;
+	size_t length, capacity;
+} fredc_token_list;
+
+// Collects the first token of every member (the key, for objects) of the
+// container opening at token open.
+// returns: the token of the matching close, or index->length if unclosed
+static uint32_t fredc_split_members(const char* data, fredc_index* index, uint32_t open, fredc_token_list* members) {
+	members->length = 0;
+	size_t depth = 0;
+	bool expect = true;
+
+	for (uint32_t t = open+1; t < index->length; t++) {
+		char c = data[index->data[t]];
+		if (c == '}' || c == ']') {
+			if (depth == 0) {
+				return t;
+			}
+			depth--;
+			continue;
+		}
+
+		if (depth == 0) {
+			if (c == ',') {
+				expect = true;
+				continue;
+			}
+			if (expect) {
+				fredc_darr_push((*members), uint32_t, t);
+				expect = false;
+			}
+		}
+		if (c == '{' || c == '[') {
+			depth++;
+		}
+	}
+
+	return (uint32_t)index->length;
+}
+
+typedef struct fredc_parse_job {
+	const char* data;
+	size_t length;
+	fredc_index* index;
+	unsigned flags;
+	bool object;
+	int depth;
+	fredc_arena* owner;
+	const uint32_t* members;
+	size_t first, count, bytes;
+
+	fredc_arena arena;
+	fredc_list vals;
+	fredc_node_list nodes;
+	fredc_intern intern; // atoms of this job, merged while stitching
+	size_t scratch_peak;
+} fredc_parse_job;
+
+static void fredc_parse_job_run(fredc_parse_job* job) {
+	job->arena.chunk_size = job->bytes < FREDC_ARENA_MAX_CHUNK ? job->bytes : FREDC_ARENA_MAX_CHUNK;
+
+	fredc_parser p = {
+		.data = job->data,
+		.length = job->length,
+		.index = *job->index,
+		.depth = job->depth,
+		.arena = &job->arena,
+		.owner = job->owner,
+	};
+	fredc_parser_set_flags(&p, job->flags);
+
+	for (size_t i = job->first; i < job->first + job->count; i++) {
+		p.token = job->members[i];
+		p.pos = job->index->data[p.token];
+
+		if (!job->object) {
+			fredc_val val = fredc_parser_val(&p);
+			fredc_darr_push(job->vals, fredc_val, val);
+			continue;
+		}
+
+		if (job->data[p.pos] != '\"') {
+			continue;
+		}
+		str8 key = fredc_parser_text(&p);
+		fredc_parser_skip_space(&p);
+		if (p.pos >= p.length || p.data[p.pos] != ':') {
+			continue;
+		}
+		p.pos++;
+
+		uint64_t hash = fredc_hash_str8(key);
+		fredc_node node = { .key = fredc_parser_keep(&p, key, hash), .val = fredc_parser_val(&p), .hash = hash };
+		fredc_darr_push(job->nodes, fredc_node, node);
+	}
+
+	fredc_parser_track_scratch(&p);
+	job->scratch_peak = p.scratch_peak;
+	job->intern = p.intern;
+	p.intern = (fredc_intern){};
+	p.index = (fredc_index){};
+	fredc_parser_free(&p);
+}
+
+// returns: the atom of t equal to s, or s itself if there is none
+static str8 fredc_intern_find(const fredc_intern* t, str8 s, uint64_t hash) {
+	if (t->capacity == 0) {
+		return s;
+	}
+
+	size_t slot = hash & (t->capacity-1);
+	while (t->slots[slot].s.data) {
+		const fredc_intern_slot* entry = t->slots + slot;
+		if (entry->hash == hash && str8_cmp(entry->s, s)) {
+			return entry->s;
+		}
+		slot = (slot+1) & (t->capacity-1);
+	}
+	return s;
+}
+
+// Points the keys (and short strings, with strings set) under v at the atoms of t
+static void fredc_intern_repoint(const fredc_intern* t, fredc_val* v, bool strings) {
+	if (v->type == JSON_OBJ) {
+		for (size_t i = 0; i < v->object->length; i++) {
+			fredc_node* node = v->object->props + i;
+			node->key = fredc_intern_find(t, node->key, node->hash);
+			fredc_intern_repoint(t, &node->val, strings);
+		}
+	} else if (v->type == JSON_LIST && !v->list->packed) {
+		for (size_t i = 0; i < v->list->length; i++) {
+			fredc_intern_repoint(t, v->list->data + i, strings);
+		}
+	} else if (v->type == JSON_STRING && strings && v->string.length <= FREDC_INTERN_MAX_STRING) {
+		v->string = fredc_intern_find(t, v->string, fredc_hash_str8(v->string));
+	}
+}
+
+// Makes the atoms of every job shared document wide: the first job to see a
+// key provides its atom, and later jobs holding a copy of it are re-pointed.
+// returns: the merged table, which the caller frees
+static fredc_intern fredc_parse_jobs_merge_intern(fredc_parse_job* jobs, size_t job_count, bool strings) {
+	fredc_intern merged = jobs[0].intern;
+	jobs[0].intern = (fredc_intern){};
+
+	for (size_t j = 1; j < job_count; j++) {
+		fredc_intern* t = &jobs[j].intern;
+		bool copies = false;
+		for (size_t i = 0; i < t->capacity; i++) {
+			fredc_intern_slot* entry = t->slots + i;
+			if (entry->s.data) {
+				// Borrowed, as the atom already lives in the document arena
+				copies |= fredc_intern_str8(&merged, 0, entry->s, entry->hash, true).data != entry->s.data;
+			}
+		}
+
+		if (copies) {
+			for (size_t i = 0; i < jobs[j].vals.length; i++) {
+				fredc_intern_repoint(&merged, jobs[j].vals.data + i, strings);
+			}
+			for (size_t i = 0; i < jobs[j].nodes.length; i++) {
+				fredc_node* node = jobs[j].nodes.data + i;
+				node->key = fredc_intern_find(&merged, node->key, node->hash);
+				fredc_intern_repoint(&merged, &node->val, strings);
+			}
+		}
+		fredc_intern_free(t);
+	}
+
+	return merged;
+}
+
+#ifdef FREDC_THREADS
+typedef struct fredc_parse_pool {
+	fredc_parse_job* jobs;
+	size_t count;
+	atomic_size_t next;
+} fredc_parse_pool;
+
+static void* fredc_parse_worker(void* arg) {
+	fredc_parse_pool* pool = (fredc_parse_pool*)arg;
+	size_t i;
+	while ((i = atomic_fetch_add(&pool->next, 1)) < pool->count) {
+		fredc_parse_job_run(pool->jobs + i);
+	}
+	return 0;
+}
+#endif
+
+// Moves every chunk of src behind the head chunk of dest
+static void fredc_arena_splice(fredc_arena* dest, fredc_arena* src) {
+	if (src->head == 0) {
+		return;
+	}
+
+	fredc_arena_chunk* tail = src->head;
+	while (tail->next) {
+		tail = tail->next;
+	}
+	if (dest->head) {
+		tail->next = dest->head->next;
+		dest->head->next = src->head;
+	} else {
+		dest->head = src->head;
+	}
+
+	dest->bytes_used += src->bytes_used;
+	dest->bytes_reserved += src->bytes_reserved;
+	dest->chunks += src->chunks;
+	dest->allocations += src->allocations;
+	*src = (fredc_arena){};
+}
+
+static int fredc_default_threads(void) {
+#ifdef FREDC_HAS_MMAP
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	return cores > 0 ? (int)cores : 1;
+#else
+	return 1;
+#endif
+}
+
+fredc_doc* fredc_doc_parse_parallel(const char* contents, size_t length, unsigned flags, int threads) {
+#ifndef FREDC_THREADS
+	threads = 1;
+#endif
+	if (threads <= 0) {
+		threads = fredc_default_threads();
+	}
+	if (threads <= 1 || length < FREDC_PARALLEL_MIN) {
+		return fredc_doc_parse_ex(contents, length, flags);
+	}
+
+	unsigned long long start = fredc_now_ns();
+	fredc_index index = fredc_index_build(contents, length);
+
+	// Find the container to split
+	fredc_token_list members = {};
+	uint32_t open = 0, close = 0;
+	int depth = 0;
+	bool object = false;
+	while (open < index.length && depth < FREDC_MAX_DEPTH) {
+		char c = contents[index.data[open]];
+		if (c != '{' && c != '[') {
+			break;
+		}
+		object = c == '{';
+		close = fredc_split_members(contents, &index, open, &members);
+		size_t container_end = close < index.length ? index.data[close] : length;
+		if (members.length >= (size_t)threads * FREDC_PARALLEL_JOBS_PER_THREAD) {
+			break;
+		}
+
+		// Descend into the largest member if it holds most of the container
+		size_t largest = 0, largest_bytes = 0;
+		for (size_t i = 0; i < members.length; i++) {
+			size_t member_end = i+1 < members.length ? index.data[members.data[i+1]] : container_end;
+			if (member_end - index.data[members.data[i]] > largest_bytes) {
+				largest = i;
+				largest_bytes = member_end - index.data[members.data[i]];
+			}
+		}
+		uint32_t value = members.length ? members.data[largest] + (object ? 2 : 0) : (uint32_t)index.length;
+		if (object && value < index.length && contents[index.data[value-1]] != ':') {
+			break;
+		}
+		if (largest_bytes * 2 < container_end - index.data[open] || value >= index.length ||
+			(contents[index.data[value]] != '{' && contents[index.data[value]] != '[')) {
+			break;
+		}
+		if (depth+1 >= FREDC_MAX_DEPTH) {
+			break;
+		}
+		open = value;
+		depth++;
+	}
+
+	if (open >= index.length || members.length < 2 || (contents[index.data[open]] != '{' && contents[index.data[open]] != '[')) {
+		FREDC_FREE(members.data);
+		fredc_index_free(&index);
+		return fredc_doc_parse_ex(contents, length, flags);
+	}
+
+	fredc_doc* doc = (fredc_doc*)FREDC_CALLOC(1, sizeof(fredc_doc));
+	assert(doc);
+	doc->arena.chunk_size = FREDC_ARENA_MIN_CHUNK;
+	doc->root = (fredc_val*)fredc_arena_alloc(&doc->arena, sizeof(fredc_val));
+
+	// Cut the members into ranges of roughly equal size
+	size_t split_start = index.data[members.data[0]];
+	size_t split_end = close < index.length ? index.data[close] : length;
+	size_t job_bytes = (split_end - split_start) / ((size_t)threads * FREDC_PARALLEL_JOBS_PER_THREAD) + 1;
+	if (job_bytes < FREDC_PARALLEL_JOB) {
+		job_bytes = FREDC_PARALLEL_JOB;
+	}
+
+	size_t job_count = 0, job_capacity = (split_end - split_start) / job_bytes + 2;
+	fredc_parse_job* jobs = (fredc_parse_job*)FREDC_CALLOC(job_capacity, sizeof(fredc_parse_job));
+	assert(jobs);
+	for (size_t i = 0; i < members.length;) {
+		size_t first = i;
+		size_t limit = index.data[members.data[i]] + job_bytes;
+		do {
+			i++;
+		} while (i < members.length && index.data[members.data[i]] < limit);
+		size_t end = i < members.length ? index.data[members.data[i]] : split_end;
+
+		if (job_count == job_capacity) {
+			job_capacity *= 2;
+			jobs = (fredc_parse_job*)FREDC_REALLOC(jobs, job_capacity * sizeof(fredc_parse_job));
+			assert(jobs);
+		}
+		jobs[job_count++] = (fredc_parse_job) {
+			.data = contents, .length = length, .index = &index, .flags = flags,
+			.object = object, .depth = depth+1, .owner = &doc->arena,
+			.members = members.data, .first = first, .count = i - first,
+			.bytes = end - index.data[members.data[first]],
+		};
+	}
+
+#ifdef FREDC_THREADS
+	if ((size_t)threads > job_count) {
+		threads = (int)job_count;
+	}
+	fredc_parse_pool pool = { .jobs = jobs, .count = job_count };
+	atomic_init(&pool.next, 0);
+	pthread_t* workers = (pthread_t*)FREDC_MALLOC(threads * sizeof(pthread_t));
+	assert(workers);
+	int started = 0;
+	for (int i = 1; i < threads; i++) {
+		if (pthread_create(workers + started, 0, fredc_parse_worker, &pool) == 0) {
+			started++;
+		}
+	}
+	fredc_parse_worker(&pool);
+	for (int i = 0; i < started; i++) {
+		pthread_join(workers[i], 0);
+	}
+	FREDC_FREE(workers);
+#else
+	for (size_t j = 0; j < job_count; j++) {
+		fredc_parse_job_run(jobs + j);
+	}
+#endif
+
+	// Stitch the container together in member order
+	fredc_intern merged = {};
+	if (flags & (FREDC_PARSE_INTERN | FREDC_PARSE_INTERN_STRINGS)) {
+		merged = fredc_parse_jobs_merge_intern(jobs, job_count, (flags & FREDC_PARSE_INTERN_STRINGS) != 0);
+	}
+	fredc_val split;
+	size_t total = 0;
+	for (size_t j = 0; j < job_count; j++) {
+		total += object ? jobs[j].nodes.length : jobs[j].vals.length;
+	}
+
+	if (object) {
+		split = fredc_val_obj(new_fredc_obj_in(&doc->arena, total));
+		for (size_t j = 0; j < job_count; j++) {
+			for (size_t i = 0; i < jobs[j].nodes.length; i++) {
+				fredc_node* node = jobs[j].nodes.data + i;
+				fredc_push_prop_hashed(split.object, node->key, node->hash, node->val, true);
+			}
+		}
+	} else {
+		split = fredc_val_list((fredc_list){ .arena = &doc->arena });
+		fredc_pack_scan scan = {};
+		for (size_t j = 0; (flags & FREDC_PARSE_PACK) && j < job_count; j++) {
+			fredc_pack_scan_vals(&scan, jobs[j].vals.data, jobs[j].vals.length);
+		}
+		if (total) {
+			fredc_list_alloc(split.list, &doc->arena, fredc_pack_type(&scan), total);
+		}
+		size_t at = 0;
+		for (size_t j = 0; j < job_count; j++) {
+			if (split.list->packed) {
+				fredc_pack_store(split.list, at, jobs[j].vals.data, jobs[j].vals.length);
+			} else {
+				memcpy(split.list->data + at, jobs[j].vals.data, jobs[j].vals.length * sizeof(fredc_val));
+			}
+			at += jobs[j].vals.length;
+		}
+	}
+
+	for (size_t j = 0; j < job_count; j++) {
+		doc->stats.bytes_scratch += jobs[j].scratch_peak;
+		fredc_arena_splice(&doc->arena, &jobs[j].arena);
+		FREDC_FREE(jobs[j].vals.data);
+		FREDC_FREE(jobs[j].nodes.data);
+		fredc_intern_free(&jobs[j].intern);
+	}
+	FREDC_FREE(jobs);
+	FREDC_FREE(members.data);
+
+	if (open == 0) {
+		*doc->root = split;
+	} else {
+		fredc_parser p = {
+			.data = contents,
+			.length = length,
+			.index = index,
+			.arena = &doc->arena,
+			.has_splice = true,
+			.splice_open = open,
+			.splice_close = close,
+			.splice_val = split,
+			.intern = merged,
+		};
+		merged = (fredc_intern){};
+		fredc_parser_set_flags(&p, flags);
+		*doc->root = fredc_parser_val(&p);
+		if (p.scratch_peak > doc->stats.bytes_scratch) {
+			doc->stats.bytes_scratch = p.scratch_peak;
+		}
+		p.index = (fredc_index){};
+		fredc_parser_free(&p);
+	}
+	fredc_intern_free(&merged);
+	fredc_index_free(&index);
+
+	doc->stats.input_length = length;
+	doc->stats.parse_ns = fredc_now_ns() - start;
+	return doc;
+}
+
+static bool fredc_file_read(fredc_file* file, FILE* fstream) {
+	struct { char* data; size_t length, capacity; } buf = {};
+	char chunk[64*1024];
+
+	size_t bytes_read;
+	while ((bytes_read = fread(chunk, 1, sizeof(chunk), fstream)) > 0) {
+		fredc_darr_push_arr(buf, char, chunk, bytes_read);
+	}
+	if (ferror(fstream)) {
+		FREDC_FREE(buf.data);
+		return false;
+	}
+
+	file->contents = (str8){ .data = buf.data, .length = buf.length };
+	file->mapped = false;
+	return true;
+}
+
+bool fredc_file_open(fredc_file* file, const char* path) {
+	*file = (fredc_file){};
+	if (strcmp(path, "-") == 0) {
+		return fredc_file_read(file, stdin);
+	}
+
+#ifdef FREDC_HAS_MMAP
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		if (st.st_size == 0) {
+			close(fd);
+			return true;
+		}
+
+		void* data = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED) {
+			close(fd);
+			madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+			file->contents = (str8){ .data = (char*)data, .length = (size_t)st.st_size };
+			file->mapped = true;
+			return true;
+		}
+	}
+
+	FILE* fstream = fdopen(fd, "rb");
+	if (!fstream) {
+		close(fd);
+		return false;
+	}
+#else
+	FILE* fstream = fopen(path, "rb");
+	if (!fstream) {
+		return false;
+	}
+#endif
+
+	bool result = fredc_file_read(file, fstream);
+	fclose(fstream);
 	return result;
 }
 
-#define INDENT_SIZE 4
+void fredc_file_close(fredc_file* file) {
+#ifdef FREDC_HAS_MMAP
+	if (file->mapped) {
+		munmap(file->contents.data, file->contents.length);
+		*file = (fredc_file){};
+		return;
+	}
+#endif
+	FREDC_FREE(file->contents.data);
+	*file = (fredc_file){};
+}
 
-str8 fredc_val_str8ify(fredc_val val, int indent) {
-	str8 result = {};
+// Lazy documents
+// fredc_lazy_parse runs only the structural index pass and records, for every
+// '{' and '[' token, the token of its matching close. Values are located by
+// walking the tape and jumping over whole containers in one step, and
+// nothing is allocated or converted until a value is read or materialized.
+// The input must stay alive and unchanged for the life of the document.
+
+#define FREDC_LAZY_NONE UINT32_MAX
+
+fredc_lazy* fredc_lazy_parse(const char* contents, size_t length) {
+	fredc_lazy* doc = (fredc_lazy*)FREDC_CALLOC(1, sizeof(fredc_lazy));
+	assert(doc);
+	doc->data = contents;
+	doc->length = length;
+	doc->index = fredc_index_build(contents, length);
+
+	size_t count = doc->index.length;
+	if (count) {
+		doc->close = (uint32_t*)FREDC_MALLOC(count * sizeof(uint32_t));
+		assert(doc->close);
+	}
+
+	struct { uint32_t* data; size_t length, capacity; } open = {};
+	for (size_t t = 0; t < count; t++) {
+		char c = contents[doc->index.data[t]];
+		doc->close[t] = FREDC_LAZY_NONE;
+		if (c == '{' || c == '[') {
+			fredc_darr_push(open, uint32_t, (uint32_t)t);
+		} else if ((c == '}' || c == ']') && open.length) {
+			doc->close[open.data[--open.length]] = (uint32_t)t;
+		}
+	}
+	// Unclosed containers extend to the end of the input
+	while (open.length) {
+		doc->close[open.data[--open.length]] = (uint32_t)count;
+	}
+	FREDC_FREE(open.data);
+
+	return doc;
+}
+
+void fredc_lazy_free(fredc_lazy* doc) {
+	if (doc) {
+		fredc_index_free(&doc->index);
+		FREDC_FREE(doc->close);
+		FREDC_FREE(doc);
+	}
+}
+
+static char fredc_lazy_char(fredc_lazy* doc, uint32_t token) {
+	return token < doc->index.length ? doc->data[doc->index.data[token]] : '\0';
+}
+
+// returns: the token following the value at token
+static uint32_t fredc_lazy_skip(fredc_lazy* doc, uint32_t token) {
+	char c = fredc_lazy_char(doc, token);
+	if (c == '{' || c == '[') {
+		uint32_t close = doc->close[token];
+		return close < doc->index.length ? close+1 : close;
+	}
+	return token+1;
+}
+
+// returns: [start, end) byte range of the value at token
+static void fredc_lazy_extent(fredc_lazy* doc, uint32_t token, size_t* start, size_t* end) {
+	*start = doc->index.data[token];
+	char c = doc->data[*start];
+	if ((c == '{' || c == '[') && doc->close[token] < doc->index.length) {
+		*end = doc->index.data[doc->close[token]] + 1;
+		return;
+	}
+
+	uint32_t next = token+1;
+	*end = next < doc->index.length ? doc->index.data[next] : doc->length;
+	while (*end > *start && isspace((unsigned char)doc->data[*end-1])) {
+		(*end)--;
+	}
+}
+
+fredc_lazy_val fredc_lazy_root(fredc_lazy* doc) {
+	return (fredc_lazy_val){ doc, doc->index.length ? 0 : FREDC_LAZY_NONE };
+}
+
+enum fredc_data_types fredc_lazy_type(fredc_lazy_val v) {
+	if (v.doc == 0 || v.token == FREDC_LAZY_NONE) {
+		return JSON_UNDEFINED;
+	}
+
+	switch (fredc_lazy_char(v.doc, v.token)) {
+		case '{': return JSON_OBJ;
+		case '[': return JSON_LIST;
+		case '\"': return JSON_STRING;
+		case 't': case 'f': return JSON_BOOL;
+		case 'n': return JSON_NULL;
+		default: return fredc_lazy_scalar(v).type;
+	}
+}
+
+// returns: the first member value of a list, or the first key of an object
+static uint32_t fredc_lazy_first(fredc_lazy_val v) {
+	uint32_t t = v.token+1;
+	char c = fredc_lazy_char(v.doc, t);
+	return (c == '}' || c == ']' || c == '\0') ? FREDC_LAZY_NONE : t;
+}
+
+// returns: the member after the value at token, skipping the comma
+static uint32_t fredc_lazy_after(fredc_lazy* doc, uint32_t token) {
+	uint32_t t = fredc_lazy_skip(doc, token);
+	if (fredc_lazy_char(doc, t) != ',') {
+		return FREDC_LAZY_NONE;
+	}
+	t++;
+	char c = fredc_lazy_char(doc, t);
+	return (c == '}' || c == ']' || c == '\0') ? FREDC_LAZY_NONE : t;
+}
+
+// returns: whether the raw key, once decoded, equals key
+static bool fredc_lazy_key_equal(str8 raw, str8 key) {
+	if (raw.length < key.length || memchr(raw.data, '\\', raw.length) == 0) {
+		return str8_cmp(raw, key);
+	}
+
+	char buf[256];
+	char* decoded = raw.length <= sizeof(buf) ? buf : (char*)FREDC_MALLOC(raw.length);
+	size_t length = fredc_unescape(raw.data, raw.length, decoded);
+	bool result = length == key.length && memcmp(decoded, key.data, length) == 0;
+	if (decoded != buf) {
+		FREDC_FREE(decoded);
+	}
+	return result;
+}
+
+fredc_lazy_val fredc_lazy_get(fredc_lazy_val obj, const char* key) {
+	fredc_lazy_val result = { obj.doc, FREDC_LAZY_NONE };
+	if (fredc_lazy_type(obj) != JSON_OBJ) {
+		return result;
+	}
+
+	fredc_lazy* doc = obj.doc;
+	str8 key8 = { (char*)key, strlen(key) };
+	uint32_t k = fredc_lazy_first(obj);
+	while (k != FREDC_LAZY_NONE && fredc_lazy_char(doc, k) == '\"' && fredc_lazy_char(doc, k+1) == ':') {
+		uint32_t val = k+2;
+		if (fredc_lazy_key_equal(fredc_lazy_str8((fredc_lazy_val){ doc, k }), key8)) {
+			result.token = val;
+			break;
+		}
+		k = fredc_lazy_after(doc, val);
+	}
+
+	return result;
+}
+
+fredc_lazy_val fredc_lazy_at(fredc_lazy_val list, size_t i) {
+	fredc_lazy_val result = { list.doc, FREDC_LAZY_NONE };
+	if (fredc_lazy_type(list) != JSON_LIST) {
+		return result;
+	}
+
+	uint32_t t = fredc_lazy_first(list);
+	while (t != FREDC_LAZY_NONE && i--) {
+		t = fredc_lazy_after(list.doc, t);
+	}
+	result.token = t;
+
+	return result;
+}
+
+// returns: number of list items or object props
+size_t fredc_lazy_length(fredc_lazy_val v) {
+	enum fredc_data_types type = fredc_lazy_type(v);
+	if (type != JSON_OBJ && type != JSON_LIST) {
+		return 0;
+	}
+
+	size_t result = 0;
+	uint32_t t = fredc_lazy_first(v);
+	while (t != FREDC_LAZY_NONE) {
+		result++;
+		t = fredc_lazy_after(v.doc, type == JSON_OBJ ? t+2 : t);
+	}
+
+	return result;
+}
+
+// Path lookup in the notation of fredc_get_prop_js, e.g. a.b[3]["c.d"]
+fredc_lazy_val fredc_lazy_get_js(fredc_lazy_val v, const char* key) {
+	fredc_path path = fredc_path_compile(key);
+	if (!path.valid) {
+		v.token = FREDC_LAZY_NONE;
+	}
+	for (size_t i = 0; i < path.length && v.token != FREDC_LAZY_NONE; i++) {
+		fredc_path_seg* seg = path.data + i;
+		v = seg->is_index ? fredc_lazy_at(v, seg->index) : fredc_lazy_get(v, seg->key.data);
+	}
+	fredc_path_free(&path);
+
+	return v;
+}
+
+// returns: raw contents of a string value, pointing into the input. Escapes
+// are not decoded, see fredc_unescape.
+str8 fredc_lazy_str8(fredc_lazy_val v) {
+	if (fredc_lazy_char(v.doc, v.token) != '\"') {
+		return (str8){};
+	}
+
+	fredc_parser p = { .data = v.doc->data, .length = v.doc->length, .pos = v.doc->index.data[v.token] };
+	return fredc_parser_string(&p);
+}
+
+// returns: the value at v if it is a number, boolean or null, else undefined
+fredc_val fredc_lazy_scalar(fredc_lazy_val v) {
+	fredc_val result = {};
+	if (v.doc == 0 || v.token >= v.doc->index.length) {
+		return result;
+	}
+
+	size_t start, end;
+	fredc_lazy_extent(v.doc, v.token, &start, &end);
+	char c = v.doc->data[start];
+	if (c == '{' || c == '[' || c == '\"') {
+		return result;
+	}
+
+	fredc_parser p = { .data = v.doc->data + start, .length = end - start };
+	result = fredc_parser_val(&p);
+	if (p.pos != p.length) {
+		result = (fredc_val){};
+	}
+
+	return result;
+}
+
+// Parses the value at v into a heap allocated tree owned by the caller
+fredc_val fredc_lazy_materialize(fredc_lazy_val v) {
+	if (v.doc == 0 || v.token >= v.doc->index.length) {
+		return (fredc_val){};
+	}
+
+	size_t start, end;
+	fredc_lazy_extent(v.doc, v.token, &start, &end);
+	return fredc_parse_val(v.doc->data + start, end - start);
+}
+
+// Binary format
+// All integers are in host byte order, the header records which one.
+//   header:  "FRDB", u32 version, u32 byte order mark, u32 root slot offset
+//   slot:    u8 type, 3 bytes padding, u32 length, 8 byte payload
+//            (number, integer or boolean, else the offset of the contents)
+//   string:  length bytes and a null terminator
+//   list:    length slots
+//   object:  length slots in insertion order, length key entries
+//            (u32 offset, u32 length, u64 hash), then length u32 member
+//            numbers ordered by key hash for binary search
+// Every block starts at a multiple of 8 bytes. Equal keys are stored once.
+
+#define FREDC_BIN_VERSION 1
+#define FREDC_BIN_BOM 0x01020304u
+#define FREDC_BIN_ALIGN 8
+
+typedef struct fredc_bin_header {
+	char magic[4];
+	uint32_t version, bom, root;
+} fredc_bin_header;
+
+typedef struct fredc_bin_slot {
+	uint8_t type;
+	uint8_t pad[3];
+	uint32_t length;
+	union {
+		uint64_t offset;
+		double number;
+		int64_t integer;
+		uint64_t boolean;
+	};
+} fredc_bin_slot;
+
+typedef struct fredc_bin_key_entry {
+	uint32_t offset, length;
+	uint64_t hash;
+} fredc_bin_key_entry;
+
+typedef struct fredc_bin_encoder {
+	struct { char* data; size_t length, capacity; } buf;
+	fredc_bin_key_entry* keys; // written keys by hash, for sharing
+	size_t keys_cap, keys_length;
+	bool overflow;
+} fredc_bin_encoder;
+
+// returns: offset of size zeroed bytes added at the end of the buffer
+static size_t fredc_bin_reserve(fredc_bin_encoder* e, size_t size) {
+	size_t offset = (e->buf.length + FREDC_BIN_ALIGN-1) & ~(size_t)(FREDC_BIN_ALIGN-1);
+	size_t end = offset + size;
+	if (end > UINT32_MAX) {
+		e->overflow = true;
+		return 0;
+	}
+
+	if (end > e->buf.capacity) {
+		size_t capacity = e->buf.capacity ? e->buf.capacity : 4096;
+		while (capacity < end) {
+			capacity *= 2;
+		}
+		fredc_darr_resize(e->buf, char, capacity);
+	}
+	memset(e->buf.data + e->buf.length, 0, end - e->buf.length);
+	e->buf.length = end;
+
+	return offset;
+}
+
+static uint32_t fredc_bin_put_str8(fredc_bin_encoder* e, str8 s) {
+	size_t offset = fredc_bin_reserve(e, s.length+1);
+	if (!e->overflow && s.length) {
+		memcpy(e->buf.data + offset, s.data, s.length);
+	}
+	return (uint32_t)offset;
+}
+
+// returns: offset of key in the buffer, writing it the first time it is seen
+static uint32_t fredc_bin_put_key(fredc_bin_encoder* e, str8 key, uint64_t hash) {
+	if ((e->keys_length+1)*2 > e->keys_cap) {
+		size_t capacity = e->keys_cap ? e->keys_cap*2 : 64;
+		fredc_bin_key_entry* keys = (fredc_bin_key_entry*)FREDC_CALLOC(capacity, sizeof(fredc_bin_key_entry));
+		assert(keys);
+		for (size_t i = 0; i < e->keys_cap; i++) {
+			if (e->keys[i].offset) {
+				size_t slot = e->keys[i].hash & (capacity-1);
+				while (keys[slot].offset) {
+					slot = (slot+1) & (capacity-1);
+				}
+				keys[slot] = e->keys[i];
+			}
+		}
+		FREDC_FREE(e->keys);
+		e->keys = keys;
+		e->keys_cap = capacity;
+	}
+
+	size_t slot = hash & (e->keys_cap-1);
+	while (e->keys[slot].offset) {
+		fredc_bin_key_entry* entry = e->keys + slot;
+		if (entry->hash == hash && entry->length == key.length &&
+			memcmp(e->buf.data + entry->offset, key.data, key.length) == 0) {
+			return entry->offset;
+		}
+		slot = (slot+1) & (e->keys_cap-1);
+	}
+
+	uint32_t offset = fredc_bin_put_str8(e, key);
+	if (!e->overflow) {
+		e->keys[slot] = (fredc_bin_key_entry){ .offset = offset, .length = (uint32_t)key.length, .hash = hash };
+		e->keys_length++;
+	}
+	return offset;
+}
+
+// Sort context for the lookup order of an object block
+static FREDC_THREAD_LOCAL const fredc_bin_key_entry* fredc_bin_sort_keys;
+
+static int fredc_bin_cmp_member(const void* a, const void* b) {
+	uint64_t ha = fredc_bin_sort_keys[*(const uint32_t*)a].hash;
+	uint64_t hb = fredc_bin_sort_keys[*(const uint32_t*)b].hash;
+	return ha < hb ? -1 : ha > hb;
+}
+
+static void fredc_bin_put_val(fredc_bin_encoder* e, fredc_val val, size_t slot_offset) {
+	fredc_bin_slot slot = { .type = (uint8_t)val.type };
 
 	switch (val.type) {
-		case JSON_NULL: {
-			result = new_str8("null", 4, true);
+		case JSON_NUM: slot.number = val.number; break;
+		case JSON_INT: slot.integer = val.integer; break;
+		case JSON_BOOL: slot.boolean = val.boolean; break;
+
+		case JSON_STRING: {
+			slot.length = (uint32_t)val.string.length;
+			slot.offset = fredc_bin_put_str8(e, val.string);
 		} break;
 
-		case JSON_BOOL: {
-			result = new_str8(val.boolean ? "true" : "false", 4 + (size_t)(!val.boolean), true);
+		case JSON_LIST: {
+			size_t count = val.list->length;
+			size_t base = fredc_bin_reserve(e, count * sizeof(fredc_bin_slot));
+			for (size_t i = 0; i < count && !e->overflow; i++) {
+				fredc_bin_put_val(e, fredc_list_get(val.list, i), base + i*sizeof(fredc_bin_slot));
+			}
+			slot.length = (uint32_t)count;
+			slot.offset = base;
+		} break;
+
+		case JSON_OBJ: {
+			size_t count = val.object->length;
+			size_t base = fredc_bin_reserve(e, count * sizeof(fredc_bin_slot));
+			size_t keys = fredc_bin_reserve(e, count * sizeof(fredc_bin_key_entry));
+			size_t order = fredc_bin_reserve(e, count * sizeof(uint32_t));
+
+			for (size_t i = 0; i < count && !e->overflow; i++) {
+				fredc_node* node = val.object->props + i;
+				fredc_bin_key_entry entry = {
+					.offset = fredc_bin_put_key(e, node->key, node->hash),
+					.length = (uint32_t)node->key.length,
+					.hash = node->hash,
+				};
+				if (e->overflow) break;
+				memcpy(e->buf.data + keys + i*sizeof(entry), &entry, sizeof(entry));
+				fredc_bin_put_val(e, node->val, base + i*sizeof(fredc_bin_slot));
+			}
+
+			if (!e->overflow) {
+				uint32_t* members = (uint32_t*)(e->buf.data + order);
+				for (size_t i = 0; i < count; i++) {
+					members[i] = (uint32_t)i;
+				}
+				fredc_bin_sort_keys = (const fredc_bin_key_entry*)(e->buf.data + keys);
+				qsort(members, count, sizeof(uint32_t), fredc_bin_cmp_member);
+			}
+			slot.length = (uint32_t)count;
+			slot.offset = base;
 		} break;
 
+		default: break;
+	}
+
+	if (!e->overflow) {
+		memcpy(e->buf.data + slot_offset, &slot, sizeof(slot));
+	}
+}
+
+// returns: a heap allocated encoding of val the caller must free with
+// fredc_free, empty if it would not fit the 4 GiB the format can address
+str8 fredc_bin_encode(fredc_val val) {
+	fredc_bin_encoder e = {};
+	size_t header = fredc_bin_reserve(&e, sizeof(fredc_bin_header));
+	size_t root = fredc_bin_reserve(&e, sizeof(fredc_bin_slot));
+	fredc_bin_put_val(&e, val, root);
+	FREDC_FREE(e.keys);
+
+	if (e.overflow) {
+		FREDC_FREE(e.buf.data);
+		return (str8){};
+	}
+
+	fredc_bin_header h = { .magic = {'F', 'R', 'D', 'B'}, .version = FREDC_BIN_VERSION,
+		.bom = FREDC_BIN_BOM, .root = (uint32_t)root };
+	memcpy(e.buf.data + header, &h, sizeof(h));
+
+	return (str8){ .data = e.buf.data, .length = e.buf.length };
+}
+
+// Checks the header of an encoded buffer, which must stay alive while bin
+// and values read from it are in use.
+bool fredc_bin_open(fredc_bin* bin, const char* data, size_t length) {
+	*bin = (fredc_bin){};
+	fredc_bin_header h;
+	if (length < sizeof(h) + sizeof(fredc_bin_slot) || ((uintptr_t)data % FREDC_BIN_ALIGN) != 0) {
+		return false;
+	}
+
+	memcpy(&h, data, sizeof(h));
+	if (memcmp(h.magic, "FRDB", 4) != 0 || h.version != FREDC_BIN_VERSION || h.bom != FREDC_BIN_BOM) {
+		return false;
+	}
+
+	*bin = (fredc_bin){ .data = data, .length = length };
+	return true;
+}
+
+// returns: pointer to size bytes at offset, or 0 if they are out of bounds
+static const void* fredc_bin_ptr(const fredc_bin* bin, uint64_t offset, uint64_t size) {
+	if (bin == 0 || offset % FREDC_BIN_ALIGN || offset > bin->length || size > bin->length - offset) {
+		return 0;
+	}
+	return bin->data + offset;
+}
+
+static const fredc_bin_slot* fredc_bin_slot_at(fredc_bin_val v) {
+	return v.slot ? (const fredc_bin_slot*)fredc_bin_ptr(v.bin, v.slot, sizeof(fredc_bin_slot)) : 0;
+}
+
+// returns: the container slot of v if it has the given type and its
+// members are in bounds
+static const fredc_bin_slot* fredc_bin_container(fredc_bin_val v, enum fredc_data_types type) {
+	const fredc_bin_slot* slot = fredc_bin_slot_at(v);
+	// Contents always follow the slot, so damaged offsets cannot form cycles
+	if (slot == 0 || slot->type != type || slot->offset <= v.slot) {
+		return 0;
+	}
+
+	uint64_t entry = sizeof(fredc_bin_slot) + (type == JSON_OBJ ? sizeof(fredc_bin_key_entry) + sizeof(uint32_t) : 0);
+	return fredc_bin_ptr(v.bin, slot->offset, (uint64_t)slot->length * entry) ? slot : 0;
+}
+
+fredc_bin_val fredc_bin_root(const fredc_bin* bin) {
+	fredc_bin_header h;
+	if (bin->data == 0) {
+		return (fredc_bin_val){};
+	}
+	memcpy(&h, bin->data, sizeof(h));
+	return (fredc_bin_val){ bin, h.root };
+}
+
+enum fredc_data_types fredc_bin_type(fredc_bin_val v) {
+	const fredc_bin_slot* slot = fredc_bin_slot_at(v);
+	return slot && slot->type <= JSON_INT ? (enum fredc_data_types)slot->type : JSON_UNDEFINED;
+}
+
+size_t fredc_bin_length(fredc_bin_val v) {
+	const fredc_bin_slot* slot = fredc_bin_slot_at(v);
+	if (slot == 0) {
+		return 0;
+	}
+	switch (slot->type) {
+		case JSON_STRING: case JSON_LIST: case JSON_OBJ: return slot->length;
+		default: return 0;
+	}
+}
+
+// returns: member i of a list, or the value of member i of an object
+fredc_bin_val fredc_bin_at(fredc_bin_val v, size_t i) {
+	const fredc_bin_slot* slot = fredc_bin_slot_at(v);
+	if (slot == 0 || (slot->type != JSON_LIST && slot->type != JSON_OBJ)) {
+		return (fredc_bin_val){ v.bin, 0 };
+	}
+	if (fredc_bin_container(v, (enum fredc_data_types)slot->type) == 0 || i >= slot->length) {
+		return (fredc_bin_val){ v.bin, 0 };
+	}
+
+	return (fredc_bin_val){ v.bin, (uint32_t)(slot->offset + i*sizeof(fredc_bin_slot)) };
+}
+
+static const fredc_bin_key_entry* fredc_bin_keys(const fredc_bin_slot* slot, const fredc_bin* bin) {
+	return (const fredc_bin_key_entry*)(bin->data + slot->offset + slot->length*sizeof(fredc_bin_slot));
+}
+
+static str8 fredc_bin_key_str8(const fredc_bin* bin, const fredc_bin_key_entry* entry) {
+	const char* data = (const char*)fredc_bin_ptr(bin, entry->offset, (uint64_t)entry->length+1);
+	return data ? (str8){ .data = (char*)data, .length = entry->length } : (str8){};
+}
+
+// returns: key of member i of an object, in insertion order
+str8 fredc_bin_key(fredc_bin_val obj, size_t i) {
+	const fredc_bin_slot* slot = fredc_bin_container(obj, JSON_OBJ);
+	if (slot == 0 || i >= slot->length) {
+		return (str8){};
+	}
+	return fredc_bin_key_str8(obj.bin, fredc_bin_keys(slot, obj.bin) + i);
+}
+
+fredc_bin_val fredc_bin_get(fredc_bin_val obj, const char* key) {
+	fredc_bin_val result = { obj.bin, 0 };
+	const fredc_bin_slot* slot = fredc_bin_container(obj, JSON_OBJ);
+	if (slot == 0) {
+		return result;
+	}
+
+	str8 key8 = { .data = (char*)key, .length = strlen(key) };
+	uint64_t hash = fredc_hash_str8(key8);
+	const fredc_bin_key_entry* keys = fredc_bin_keys(slot, obj.bin);
+	const uint32_t* order = (const uint32_t*)(keys + slot->length);
+
+	size_t lo = 0, hi = slot->length;
+	while (lo < hi) {
+		size_t mid = lo + (hi-lo)/2;
+		if (order[mid] >= slot->length || keys[order[mid]].hash < hash) {
+			lo = mid+1;
+		} else {
+			hi = mid;
+		}
+	}
+	// Duplicate keys keep the last member, as when parsing
+	for (; lo < slot->length && order[lo] < slot->length && keys[order[lo]].hash == hash; lo++) {
+		if (str8_cmp(fredc_bin_key_str8(obj.bin, keys + order[lo]), key8)) {
+			result.slot = (uint32_t)(slot->offset + order[lo]*sizeof(fredc_bin_slot));
+		}
+	}
+
+	return result;
+}
+
+// returns: contents of a string value, pointing into the buffer
+str8 fredc_bin_str8(fredc_bin_val v) {
+	const fredc_bin_slot* slot = fredc_bin_slot_at(v);
+	if (slot == 0 || slot->type != JSON_STRING) {
+		return (str8){};
+	}
+	const char* data = (const char*)fredc_bin_ptr(v.bin, slot->offset, (uint64_t)slot->length+1);
+	return data ? (str8){ .data = (char*)data, .length = slot->length } : (str8){};
+}
+
+// returns: the value at v if it is a number, boolean or null, else undefined
+fredc_val fredc_bin_scalar(fredc_bin_val v) {
+	const fredc_bin_slot* slot = fredc_bin_slot_at(v);
+	if (slot == 0) {
+		return (fredc_val){};
+	}
+	switch (slot->type) {
+		case JSON_NULL: return (fredc_val){ .type = JSON_NULL };
+		case JSON_NUM: return (fredc_val){ .type = JSON_NUM, .number = slot->number };
+		case JSON_INT: return (fredc_val){ .type = JSON_INT, .integer = slot->integer };
+		case JSON_BOOL: return (fredc_val){ .type = JSON_BOOL, .boolean = slot->boolean != 0 };
+		default: return (fredc_val){};
+	}
+}
+
+// budget: slots left to visit. A valid buffer visits each slot once, this
+// stops damaged ones that point several slots at the same block.
+static fredc_val fredc_bin_build(fredc_bin_val v, fredc_arena* arena, bool insitu, size_t* budget, int depth) {
+	fredc_val result = {};
+	if (*budget == 0 || depth >= FREDC_MAX_DEPTH) {
+		return result;
+	}
+	(*budget)--;
+
+	switch (fredc_bin_type(v)) {
 		case JSON_STRING: {
-			str8 quote = new_str8("\"", 1, true);
-			str8 list[] = {quote, val.string, quote};
-			result = str8_list_concat((str8_list) { .data = list, .length = 3 });
+			str8 s = fredc_bin_str8(v);
+			if (s.data == 0) break;
+			result.type = JSON_STRING;
+			result.string = s;
+			if (!insitu) {
+				result.string.data = (char*)fredc_alloc(arena, s.length+1);
+				memcpy(result.string.data, s.data, s.length+1);
+			}
 		} break;
 
-		case JSON_NUM: {
-			int len = snprintf(0,0, "%f", val.number);
-			if (len) {
-				result = new_str8(0, len, false);
-				snprintf(result.data, result.length+1, "%f", val.number);
+		case JSON_LIST: {
+			size_t count = fredc_bin_container(v, JSON_LIST) ? fredc_bin_length(v) : 0;
+			result = fredc_val_list((fredc_list){ .arena = arena });
+			if (count) {
+				result.list->data = (fredc_val*)fredc_arena_alloc(arena, count * sizeof(fredc_val));
+				result.list->length = result.list->capacity = count;
+				for (size_t i = 0; i < count; i++) {
+					result.list->data[i] = fredc_bin_build(fredc_bin_at(v, i), arena, insitu, budget, depth+1);
+				}
 			}
 		} break;
 
 		case JSON_OBJ: {
-			int count = 0;
-			str8_list str_list = {};
-			fredc_darr_push(str_list, str8, new_str8("{\n", 2, true));
-
-			for (int i = 0; i < val.object.length; i++) {
-				fredc_node* node = val.object.props+i;
-				while (node) {
-					if (node->key.length) {
-						fredc_darr_push(str_list, str8, fredc_node_str8ify(*node, indent+1)); 
-						fredc_darr_push(str_list, str8, new_str8(",\n", 2, true));
-						count++;
-					}
-					node = node->next;
-				}
+			const fredc_bin_slot* slot = fredc_bin_container(v, JSON_OBJ);
+			size_t count = slot ? slot->length : 0;
+			result = fredc_val_obj(new_fredc_obj_in(arena, count));
+			for (size_t i = 0; i < count; i++) {
+				const fredc_bin_key_entry* entry = fredc_bin_keys(slot, v.bin) + i;
+				str8 key = fredc_bin_key_str8(v.bin, entry);
+				if (key.data == 0) continue;
+				fredc_val member = fredc_bin_build(fredc_bin_at(v, i), arena, insitu, budget, depth+1);
+				fredc_push_prop_hashed(result.object, key, entry->hash, member, insitu);
 			}
+		} break;
 
-			if (count) {
-				// Remove trailing comma
-				str_list.data[str_list.length-1] = (str8) {
-					.data = (char*)"\n",
-					.length = 1
-				};
+		default: {
+			result = fredc_bin_scalar(v);
+		} break;
+	}
 
-				str8 indent_str = new_str8(0, (indent*INDENT_SIZE), false);
-				memset(indent_str.data, ' ', indent_str.length);
-				fredc_darr_push(str_list, str8, indent_str);
-				fredc_darr_push(str_list, str8, new_str8("}", 1, true));
-				
-				result = str8_list_concat(str_list);
-			} else {
-				result = new_str8("{}", 2, true);
-			}
+	return result;
+}
 
-			free(str_list.data);
-		} break;
+// Converts an encoded buffer into a document. With FREDC_PARSE_INSITU keys
+// and strings point into data, which must then outlive the document.
+// returns: document whose root is JSON_UNDEFINED if data is not valid
+fredc_doc* fredc_bin_decode(const char* data, size_t length, unsigned flags) {
+	unsigned long long start = fredc_now_ns();
+
+	fredc_doc* doc = (fredc_doc*)FREDC_CALLOC(1, sizeof(fredc_doc));
+	assert(doc);
+	doc->arena.chunk_size = length < FREDC_ARENA_MAX_CHUNK ? length : FREDC_ARENA_MAX_CHUNK;
+	doc->root = (fredc_val*)fredc_arena_alloc(&doc->arena, sizeof(fredc_val));
+	*doc->root = (fredc_val){};
+
+	fredc_bin bin;
+	if (fredc_bin_open(&bin, data, length)) {
+		size_t budget = length / sizeof(fredc_bin_slot);
+		*doc->root = fredc_bin_build(fredc_bin_root(&bin), &doc->arena, (flags & FREDC_PARSE_INSITU) != 0, &budget, 0);
+	}
 
-		case JSON_LIST: {
-			if (val.list.length) {
-				str8_list str_list = {};
-				fredc_darr_push(str_list, str8, new_str8("[\n", 2, true));
+	doc->stats.input_length = length;
+	doc->stats.parse_ns = fredc_now_ns() - start;
+	return doc;
+}
+
+// Event (SAX) parser
+// A push parser that can be fed the input in chunks of any size. Tokens cut
+// by a chunk boundary are carried over in a small buffer, so memory use only
+// depends on nesting depth and on the longest token split across chunks,
+// never on the size of the document. Strings and keys are passed to the
+// handler pointing into the chunk whenever they are not split.
+// Like the tree parser it accepts trailing commas, and consecutive
+// top-level values are reported one after the other.
+
+enum fredc_sax_state {
+	FREDC_SAX_VALUE,
+	FREDC_SAX_KEY,
+	FREDC_SAX_COLON,
+	FREDC_SAX_NEXT, // ',' or the end of the current container
+};
+
+enum fredc_sax_token {
+	FREDC_SAX_TOKEN_NONE,
+	FREDC_SAX_TOKEN_STRING,
+	FREDC_SAX_TOKEN_KEY,
+	FREDC_SAX_TOKEN_SCALAR,
+};
+
+#define FREDC_SAX_CALL(s, cb, ...) \
+	((s)->handler.cb == 0 || (s)->handler.cb((s)->handler.user, ##__VA_ARGS__))
+
+void fredc_sax_init(fredc_sax* s, fredc_sax_handler handler) {
+	*s = (fredc_sax){ .handler = handler };
+}
+
+void fredc_sax_free(fredc_sax* s) {
+	FREDC_FREE(s->stack);
+	FREDC_FREE(s->token);
+	s->stack = 0;
+	s->token = 0;
+	s->depth = s->stack_cap = s->token_length = s->token_cap = 0;
+}
+
+static bool fredc_sax_fail(fredc_sax* s, size_t offset) {
+	if (!s->error) {
+		s->error = true;
+		s->error_offset = s->offset + offset;
+	}
+	return false;
+}
+
+static void fredc_sax_token_append(fredc_sax* s, const char* data, size_t length) {
+	if (s->token_length + length > s->token_cap) {
+		size_t cap = s->token_cap ? s->token_cap : 64;
+		while (cap < s->token_length + length) {
+			cap *= 2;
+		}
+		s->token = (char*)FREDC_REALLOC(s->token, cap);
+		assert(s->token);
+		s->token_cap = cap;
+	}
+	memcpy(s->token + s->token_length, data, length);
+	s->token_length += length;
+}
+
+static void fredc_sax_push(fredc_sax* s, bool is_obj) {
+	if (s->depth >= s->stack_cap) {
+		s->stack_cap = s->stack_cap ? s->stack_cap*2 : 32;
+		s->stack = (bool*)FREDC_REALLOC(s->stack, s->stack_cap * sizeof(bool));
+		assert(s->stack);
+	}
+	s->stack[s->depth++] = is_obj;
+}
+
+static void fredc_sax_value_done(fredc_sax* s) {
+	s->state = s->depth ? FREDC_SAX_NEXT : FREDC_SAX_VALUE;
+}
+
+static bool fredc_sax_scalar(fredc_sax* s, str8 tok) {
+	if (str8_cmp(tok, (str8){ (char*)"true", 4 })) {
+		return FREDC_SAX_CALL(s, boolean, true);
+	} else if (str8_cmp(tok, (str8){ (char*)"false", 5 })) {
+		return FREDC_SAX_CALL(s, boolean, false);
+	} else if (str8_cmp(tok, (str8){ (char*)"null", 4 })) {
+		return FREDC_SAX_CALL(s, null);
+	}
+
+	size_t consumed;
+	fredc_val num = fredc_parse_number(tok.data, tok.length, &consumed);
+	if (consumed != tok.length || num.type == JSON_UNDEFINED) {
+		return false;
+	}
+	if (num.type == JSON_INT) {
+		return FREDC_SAX_CALL(s, integer, num.integer);
+	}
+	return FREDC_SAX_CALL(s, number, num.number);
+}
+
+// Continues the string token at chunk[*i]. Emits it once the closing quote is found.
+static bool fredc_sax_string(fredc_sax* s, const char* chunk, size_t length, size_t* i) {
+	size_t start = *i, pos = *i;
+	bool found = false;
+
+	if (s->escape && pos < length) {
+		s->escape = false;
+		pos++;
+	}
+	while (pos < length) {
+		pos += fredc_scan_string(chunk + pos, length - pos);
+		if (pos >= length) {
+			break;
+		}
+		if (chunk[pos] == '\"') {
+			found = true;
+			break;
+		}
+		s->escaped = true;
+		if (pos+1 >= length) {
+			s->escape = true;
+			pos = length;
+			break;
+		}
+		pos += 2;
+	}
+
+	if (!found) {
+		fredc_sax_token_append(s, chunk + start, length - start);
+		*i = length;
+		return true;
+	}
+
+	str8 value = { (char*)chunk + start, pos - start };
+	if (s->token_length || s->escaped) {
+		fredc_sax_token_append(s, value.data, value.length);
+		value = (str8){ s->token, s->token_length };
+	}
+	if (s->escaped) {
+		value.length = fredc_unescape(value.data, value.length, value.data);
+		s->escaped = false;
+	}
+	*i = pos+1;
+
+	bool ok;
+	if (s->token_kind == FREDC_SAX_TOKEN_KEY) {
+		ok = FREDC_SAX_CALL(s, key, value);
+		s->state = FREDC_SAX_COLON;
+	} else {
+		ok = FREDC_SAX_CALL(s, string, value);
+		fredc_sax_value_done(s);
+	}
+	s->token_kind = FREDC_SAX_TOKEN_NONE;
+	s->token_length = 0;
+
+	return ok || fredc_sax_fail(s, pos);
+}
+
+static bool fredc_sax_is_delim(char c) {
+	switch (c) {
+		case ' ': case '\t': case '\n': case '\r':
+		case '{': case '}': case '[': case ']': case ':': case ',': case '\"':
+			return true;
+		default:
+			return false;
+	}
+}
+
+// Continues the number or literal token at chunk[*i]
+static bool fredc_sax_scalar_token(fredc_sax* s, const char* chunk, size_t length, size_t* i) {
+	size_t start = *i, pos = *i;
+	while (pos < length && !fredc_sax_is_delim(chunk[pos])) {
+		pos++;
+	}
+
+	if (pos == length) {
+		fredc_sax_token_append(s, chunk + start, length - start);
+		*i = length;
+		return true;
+	}
 
-				str8 indent_str = new_str8(0, (indent+1)*INDENT_SIZE, false);
-				memset(indent_str.data, ' ', indent_str.length);
+	str8 tok = { (char*)chunk + start, pos - start };
+	if (s->token_length) {
+		fredc_sax_token_append(s, tok.data, tok.length);
+		tok = (str8){ s->token, s->token_length };
+	}
+	*i = pos;
+	s->token_kind = FREDC_SAX_TOKEN_NONE;
+	s->token_length = 0;
+
+	if (!fredc_sax_scalar(s, tok)) {
+		return fredc_sax_fail(s, start);
+	}
+	fredc_sax_value_done(s);
+	return true;
+}
+
+// Feeds the next chunk of input. Chunks may split the input anywhere.
+// returns: false once the input is malformed or a handler returned false
+bool fredc_sax_feed(fredc_sax* s, const char* chunk, size_t length) {
+	size_t i = 0;
+	if (s->error) {
+		return false;
+	}
 
-				for (int i = 0; i < val.list.length; i++) {
-					fredc_darr_push(str_list, str8, indent_str);
-					fredc_darr_push(str_list, str8, fredc_val_str8ify(val.list.data[i], indent+1));
-					fredc_darr_push(str_list, str8, new_str8(",\n", 2, true));
+	while (i < length) {
+		if (s->token_kind == FREDC_SAX_TOKEN_STRING || s->token_kind == FREDC_SAX_TOKEN_KEY) {
+			if (!fredc_sax_string(s, chunk, length, &i)) return false;
+			continue;
+		} else if (s->token_kind == FREDC_SAX_TOKEN_SCALAR) {
+			if (!fredc_sax_scalar_token(s, chunk, length, &i)) return false;
+			continue;
+		}
+
+		char c = chunk[i];
+		bool ok = true;
+		switch (c) {
+			case ' ': case '\t': case '\n': case '\r': {
+				i++;
+				continue;
+			}
+
+			case '{':
+			case '[': {
+				if (s->state != FREDC_SAX_VALUE) {
+					return fredc_sax_fail(s, i);
 				}
+				fredc_sax_push(s, c == '{');
+				ok = c == '{' ? FREDC_SAX_CALL(s, start_object) : FREDC_SAX_CALL(s, start_list);
+				s->state = c == '{' ? FREDC_SAX_KEY : FREDC_SAX_VALUE;
+			} break;
+
+			case '}':
+			case ']': {
+				bool is_obj = c == '}';
+				bool state_ok = is_obj ?
+					(s->state == FREDC_SAX_KEY || s->state == FREDC_SAX_NEXT) :
+					(s->state == FREDC_SAX_VALUE || s->state == FREDC_SAX_NEXT);
+				if (s->depth == 0 || s->stack[s->depth-1] != is_obj || !state_ok) {
+					return fredc_sax_fail(s, i);
+				}
+				s->depth--;
+				ok = is_obj ? FREDC_SAX_CALL(s, end_object) : FREDC_SAX_CALL(s, end_list);
+				fredc_sax_value_done(s);
+			} break;
+
+			case ':': {
+				if (s->state != FREDC_SAX_COLON) {
+					return fredc_sax_fail(s, i);
+				}
+				s->state = FREDC_SAX_VALUE;
+			} break;
 
-				// Remove trailing comma
-				str_list.data[str_list.length-1] = (str8) {
-					.data = (char*)"\n",
-					.length = 1
-				};
-				fredc_darr_push(str_list, str8, new_str8(indent_str.data, indent_str.length-INDENT_SIZE, true));
-				fredc_darr_push(str_list, str8, new_str8("]", 1, true));
-				
-				result = str8_list_concat(str_list);
-				free(str_list.data);
-				//free indent_str
-			} else {
-				result = new_str8("[]", 2, true);
+			case ',': {
+				if (s->state != FREDC_SAX_NEXT) {
+					return fredc_sax_fail(s, i);
+				}
+				s->state = s->stack[s->depth-1] ? FREDC_SAX_KEY : FREDC_SAX_VALUE;
+			} break;
+
+			case '\"': {
+				if (s->state == FREDC_SAX_KEY) {
+					s->token_kind = FREDC_SAX_TOKEN_KEY;
+				} else if (s->state == FREDC_SAX_VALUE) {
+					s->token_kind = FREDC_SAX_TOKEN_STRING;
+				} else {
+					return fredc_sax_fail(s, i);
+				}
+			} break;
+
+			default: {
+				if (s->state != FREDC_SAX_VALUE) {
+					return fredc_sax_fail(s, i);
+				}
+				s->token_kind = FREDC_SAX_TOKEN_SCALAR;
+				continue; // the scalar starts at this byte
 			}
-		} break;
+		}
 
-		default: {
-			result = new_str8("undefined", 9, true);
-		} break;
+		if (!ok) {
+			return fredc_sax_fail(s, i);
+		}
+		i++;
 	}
 
-	return result;
+	s->offset += length;
+	return true;
 }
 
-str8 fredc_node_str8ify(fredc_node prop, int indent) {
-	str8 indent_str = new_str8(0, indent*INDENT_SIZE, false);
-	memset(indent_str.data, ' ', indent_str.length);
-
-	str8 str_list[] = {
-		indent_str,
-		new_str8("\"", 1, true),
-		prop.key,
-		new_str8("\": ", 3, true),
-		fredc_val_str8ify(prop.val, indent)
-	};
+// Ends the input, completing a trailing number or literal.
+// returns: true if the input was well formed and every container was closed
+bool fredc_sax_finish(fredc_sax* s) {
+	if (s->error) {
+		return false;
+	}
+
+	if (s->token_kind == FREDC_SAX_TOKEN_SCALAR) {
+		str8 tok = { s->token, s->token_length };
+		s->token_kind = FREDC_SAX_TOKEN_NONE;
+		s->token_length = 0;
+		if (!fredc_sax_scalar(s, tok)) {
+			return fredc_sax_fail(s, 0);
+		}
+		fredc_sax_value_done(s);
+	}
+
+	if (s->token_kind != FREDC_SAX_TOKEN_NONE || s->depth || s->state != FREDC_SAX_VALUE) {
+		return fredc_sax_fail(s, 0);
+	}
+	return true;
+}
 
-	str8 result = str8_list_concat(
-		(str8_list) {
-			.data = str_list,
-			.length = 5,
-			.capacity = 5
+// Tree builder
+// Builds a heap allocated tree from SAX events, collecting container members
+// on scratch stacks like the single pass parser does.
+
+static void fredc_tree_builder_add(fredc_tree_builder* b, fredc_val val) {
+	if (b->depth == 0) {
+		if (b->root.type == JSON_UNDEFINED) {
+			b->root = val;
+		} else {
+			fredc_val_free(&val);
 		}
-	);
+	} else if (b->frames[b->depth-1].is_obj) {
+		b->nodes.data[b->nodes.length-1].val = val;
+	} else {
+		fredc_darr_push(b->vals, fredc_val, val);
+	}
+}
 
-	return result;
+static bool fredc_tree_builder_open(void* user, bool is_obj) {
+	fredc_tree_builder* b = (fredc_tree_builder*)user;
+	if (b->depth >= b->frames_cap) {
+		b->frames_cap = b->frames_cap ? b->frames_cap*2 : 32;
+		b->frames = (fredc_builder_frame*)FREDC_REALLOC(b->frames, b->frames_cap * sizeof(fredc_builder_frame));
+		assert(b->frames);
+	}
+	b->frames[b->depth].is_obj = is_obj;
+	b->frames[b->depth].base = is_obj ? b->nodes.length : b->vals.length;
+	b->depth++;
+	return true;
 }
 
-str8 fredc_obj_str8ify(fredc_obj o) {
-	str8 result = fredc_val_str8ify((fredc_val) {.type = JSON_OBJ, .object = o}, 0);
+static bool fredc_tree_builder_start_object(void* user) {
+	return fredc_tree_builder_open(user, true);
+}
+
+static bool fredc_tree_builder_start_list(void* user) {
+	return fredc_tree_builder_open(user, false);
+}
+
+static bool fredc_tree_builder_end_object(void* user) {
+	fredc_tree_builder* b = (fredc_tree_builder*)user;
+	size_t base = b->frames[--b->depth].base;
+
+	fredc_val val = fredc_val_obj(new_fredc_obj(b->nodes.length - base));
+	for (size_t i = base; i < b->nodes.length; i++) {
+		fredc_push_prop(val.object, b->nodes.data[i].key, b->nodes.data[i].val);
+		FREDC_FREE(b->nodes.data[i].key.data);
+	}
+	b->nodes.length = base;
+
+	fredc_tree_builder_add(b, val);
+	return true;
+}
+
+static bool fredc_tree_builder_end_list(void* user) {
+	fredc_tree_builder* b = (fredc_tree_builder*)user;
+	size_t base = b->frames[--b->depth].base;
+
+	fredc_val val = fredc_val_list((fredc_list){0});
+	size_t count = b->vals.length - base;
+	if (count) {
+		val.list->data = (fredc_val*)FREDC_MALLOC(count * sizeof(fredc_val));
+		assert(val.list->data);
+		memcpy(val.list->data, b->vals.data + base, count * sizeof(fredc_val));
+		val.list->length = val.list->capacity = count;
+	}
+	b->vals.length = base;
+
+	fredc_tree_builder_add(b, val);
+	return true;
+}
+
+static str8 fredc_str8_dup(str8 s) {
+	str8 result = { (char*)FREDC_MALLOC(s.length+1), s.length };
+	assert(result.data);
+	memcpy(result.data, s.data, s.length);
+	result.data[s.length] = '\0';
 	return result;
 }
 
-char* fredc_obj_stringify(fredc_obj o) {
-	str8 result = fredc_val_str8ify((fredc_val) {.type = JSON_OBJ, .object = o}, 0);
-	return result.data;
+static bool fredc_tree_builder_key(void* user, str8 key) {
+	fredc_tree_builder* b = (fredc_tree_builder*)user;
+	fredc_node node = { .key = fredc_str8_dup(key) };
+	fredc_darr_push(b->nodes, fredc_node, node);
+	return true;
 }
 
-fredc_val fredc_parse_val(const char* contents, size_t length) {
-	fredc_val result = {};
-	double num_val = 0;
-
-	str8 valstr = new_str8(contents, length, false);
-	
-	if (contents[0] == '\"' && contents[length-1] == '\"') {
-		str8 val = str8_trim(
-			new_str8((char*)contents, length, true),
-			new_str8("\"", 1, true),
-			true
-		);
+static bool fredc_tree_builder_string(void* user, str8 s) {
+	fredc_tree_builder_add((fredc_tree_builder*)user, (fredc_val){ .type = JSON_STRING, .string = fredc_str8_dup(s) });
+	return true;
+}
+
+static bool fredc_tree_builder_number(void* user, double n) {
+	fredc_tree_builder_add((fredc_tree_builder*)user, (fredc_val){ .type = JSON_NUM, .number = n });
+	return true;
+}
+
+static bool fredc_tree_builder_integer(void* user, int64_t n) {
+	fredc_tree_builder_add((fredc_tree_builder*)user, (fredc_val){ .type = JSON_INT, .integer = n });
+	return true;
+}
+
+static bool fredc_tree_builder_boolean(void* user, bool v) {
+	fredc_tree_builder_add((fredc_tree_builder*)user, (fredc_val){ .type = JSON_BOOL, .boolean = v });
+	return true;
+}
+
+static bool fredc_tree_builder_null(void* user) {
+	fredc_tree_builder_add((fredc_tree_builder*)user, (fredc_val){ .type = JSON_NULL });
+	return true;
+}
+
+// returns: handler that builds into b, which must be zero initialized
+fredc_sax_handler fredc_tree_builder_handler(fredc_tree_builder* b) {
+	return (fredc_sax_handler) {
+		.user = b,
+		.start_object = fredc_tree_builder_start_object,
+		.end_object = fredc_tree_builder_end_object,
+		.start_list = fredc_tree_builder_start_list,
+		.end_list = fredc_tree_builder_end_list,
+		.key = fredc_tree_builder_key,
+		.string = fredc_tree_builder_string,
+		.number = fredc_tree_builder_number,
+		.integer = fredc_tree_builder_integer,
+		.boolean = fredc_tree_builder_boolean,
+		.null = fredc_tree_builder_null,
+	};
+}
 
-		result.type = JSON_STRING;
-		result.string.length = val.length;
-		result.string.data = (char*)malloc(val.length+1);
-		memcpy(result.string.data, val.data, val.length);
-		result.string.data[val.length] = '\0';
-	} else if ( str8_cmp(valstr, new_str8("true", 4, true)) ){
-		result.type = JSON_BOOL;
-		result.boolean = true;
-	} else if ( str8_cmp(valstr, new_str8("false", 5, true)) ){
-		result.type = JSON_BOOL;
-		result.boolean = false;
-	} else if ( str8_cmp(valstr, new_str8("null", 4, true)) ) {
-		result.type = JSON_NULL;
-	} else if ( (num_val = strtod(contents, 0)) ){
-		result.type = JSON_NUM;
-		result.number = num_val;
+// Frees the builder's scratch state, including anything left unfinished.
+// returns: the first complete top-level value, owned by the caller
+fredc_val fredc_tree_builder_finish(fredc_tree_builder* b) {
+	for (size_t i = 0; i < b->vals.length; i++) {
+		fredc_val_free(b->vals.data + i);
+	}
+	for (size_t i = 0; i < b->nodes.length; i++) {
+		fredc_node_free(b->nodes.data + i);
 	}
+	FREDC_FREE(b->vals.data);
+	FREDC_FREE(b->nodes.data);
+	FREDC_FREE(b->frames);
 
+	fredc_val result = b->root;
+	*b = (fredc_tree_builder){};
 	return result;
 }
 
-fredc_list fredc_parse_list_str(const char* contents, size_t length) {
-	fredc_list result = {};	
+// Validation
+// A strict RFC 8259 check in a single pass that never allocates. The kinds of
+// the open containers are kept in a bit stack, one bit per level, and the
+// expected next token in a small state. Inside strings, runs of bytes that
+// need no attention (printable ASCII other than quotes and backslashes) are
+// skipped 16 at a time; everything else, including the UTF-8 encoding of
+// non-ASCII text, is checked byte by byte.
+
+enum fredc_validate_state {
+	FREDC_EXPECT_VALUE,
+	FREDC_EXPECT_VALUE_OR_CLOSE, // after [
+	FREDC_EXPECT_KEY_OR_CLOSE,   // after {
+	FREDC_EXPECT_KEY,            // after a comma in an object
+	FREDC_EXPECT_COLON,
+	FREDC_EXPECT_COMMA_OR_CLOSE,
+};
 
-	if ((contents[0] == '[') && (contents[length-1] == ']')) {
-		str8 cs = str8_trim(
-			new_str8((char*)contents, length, true), 
-			new_str8("[]", 2, true),
-			true
+static inline bool fredc_is_space(unsigned char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// returns: the position of the first non-whitespace byte from pos on
+static inline size_t fredc_skip_space(const unsigned char* s, size_t length, size_t pos) {
+#ifdef FREDC_SSE2
+	// Only indentation comes in runs long enough to be worth it
+	while (pos + 16 <= length && fredc_is_space(s[pos]) && fredc_is_space(s[pos+1])) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(s + pos));
+		__m128i space = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')))
 		);
-		str8_list val_strs = str8_split(cs, ',', true);
-		
-		for (int i = 0; i < val_strs.length; i++) {
-			if (val_strs.data[i].length) {
-				val_strs.data[i] = str8_trim_space(val_strs.data[i], true);	
-				fredc_val item = fredc_parse_val(val_strs.data[i].data, val_strs.data[i].length);
-				fredc_darr_push(result, fredc_val, item);
-			}
+		int mask = ~_mm_movemask_epi8(space) & 0xFFFF;
+		if (mask) {
+			return pos + fredc_ctz64((uint64_t)mask);
 		}
+		pos += 16;
 	}
+#endif
+	while (pos < length && fredc_is_space(s[pos])) {
+		pos++;
+	}
+	return pos;
+}
 
-	return result;
+// returns: length of the well-formed UTF-8 sequence at s, or 0. Overlong
+// forms, surrogates and code points past U+10FFFF are rejected.
+static size_t fredc_utf8_sequence(const unsigned char* s, size_t available) {
+	unsigned char c = s[0];
+	size_t length;
+	unsigned char lo = 0x80, hi = 0xBF; // range of the second byte
+	if (c >= 0xC2 && c <= 0xDF) {
+		length = 2;
+	} else if (c >= 0xE0 && c <= 0xEF) {
+		length = 3;
+		if (c == 0xE0) lo = 0xA0;
+		if (c == 0xED) hi = 0x9F;
+	} else if (c >= 0xF0 && c <= 0xF4) {
+		length = 4;
+		if (c == 0xF0) lo = 0x90;
+		if (c == 0xF4) hi = 0x8F;
+	} else {
+		return 0;
+	}
+
+	if (available < length || s[1] < lo || s[1] > hi) {
+		return 0;
+	}
+	for (size_t i = 2; i < length; i++) {
+		if ((s[i] & 0xC0) != 0x80) {
+			return 0;
+		}
+	}
+	return length;
 }
 
-fredc_obj fredc_parse_obj_str(const char* contents, size_t length) {
-	str8 cs = str8_trim_space(new_str8(contents, length, true), true);
-	if (cs.length == 0 || cs.data[0] != '{' || cs.data[cs.length-1] != '}') {
-		return (fredc_obj){};
-	}
-
-	cs = str8_trim(cs, new_str8("{}", 2, true), true);
-	fredc_obj result = new_fredc_obj(0);
-
-	int start = 0;
-	str8* vals;
-	for (int i = 0; i < cs.length; i++) {
-		if (cs.data[i] == '{') {
-			int nesting_level = 1;
-			int end;
-			for (end = i+1;end < cs.length;end++) {
-				if (cs.data[end] == '{') nesting_level++; 
-				else if (cs.data[end] == '}') {
-					nesting_level--;
-					if (nesting_level == 0) {
-						break;
-					}
-				}
-	 		}
-				
-			vals = str8_cut(new_str8(cs.data+start, end-start+1, true), ':', true);
-			if (vals) {
-				str8 key = str8_trim(
-					str8_trim_space(vals[0], true),
-					new_str8("\"", 1, true),
-					true
-				);
-				str8 objstr = str8_trim_space(vals[1], true);
-
-				fredc_val new_obj = {
-					.type = JSON_OBJ,
-					.object = fredc_parse_obj_str(objstr.data, objstr.length),
-				};
-				fredc_push_prop(&result, key, new_obj);
+// Scans the string whose opening quote is at pos
+// returns: the position after the closing quote, or 0 with *error set
+static size_t fredc_validate_string(const unsigned char* s, size_t length, size_t pos, size_t* error_pos, const char** error) {
+	pos++;
+	for (;;) {
+#ifdef FREDC_SSE2
+		while (pos + 16 <= length) {
+			__m128i v = _mm_loadu_si128((const __m128i*)(s + pos));
+			// Signed compare: bytes from 0x80 up count as negative, so this
+			// also stops at non-ASCII bytes
+			__m128i special = _mm_or_si128(_mm_cmplt_epi8(v, _mm_set1_epi8(0x20)),
+				_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))));
+			int mask = _mm_movemask_epi8(special);
+			if (mask) {
+				pos += fredc_ctz64((uint64_t)mask);
+				break;
+			}
+			pos += 16;
+		}
+#endif
+		while (pos < length && s[pos] >= 0x20 && s[pos] < 0x80 && s[pos] != '\"' && s[pos] != '\\') {
+			pos++;
+		}
+		if (pos >= length) {
+			*error_pos = length;
+			*error = "unterminated string";
+			return 0;
+		}
 
-				free(vals);
+		unsigned char c = s[pos];
+		if (c == '\"') {
+			return pos+1;
+		} else if (c == '\\') {
+			if (pos+1 >= length) {
+				*error_pos = length;
+				*error = "unterminated string";
+				return 0;
 			}
-			i = end+1;
-			start = i+1;
-		} else if (cs.data[i] == '[') {
-			int nesting_level = 1;
-			int end;
-			for (end = i+1;end < cs.length;end++) {
-				if (cs.data[end] == '[') nesting_level++;
-				else if (cs.data[end] == ']') {
-					nesting_level--;
-					if (nesting_level == 0) {
-						break;
+			switch (s[pos+1]) {
+				case '\"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't': {
+					pos += 2;
+				} break;
+				case 'u': {
+					for (size_t i = 2; i < 6; i++) {
+						if (pos+i >= length || fredc_hex_value(s[pos+i]) < 0) {
+							*error_pos = pos+i < length ? pos+i : length;
+							*error = "invalid \\u escape";
+							return 0;
+						}
 					}
+					pos += 6;
+				} break;
+				default: {
+					*error_pos = pos+1;
+					*error = "invalid escape";
+					return 0;
 				}
-	 		}
-			
-			vals = str8_cut(new_str8(cs.data+start, end-start+1, true), ':', true);
-			if (vals) {
-				str8 key = str8_trim(
-					str8_trim_space(vals[0], true),
-					new_str8("\"", 1, true),
-					true
-				);
-				str8 liststr = str8_trim_space(vals[1], true);
-
-				fredc_val new_list = {
-					.type = JSON_LIST,
-					.list = fredc_parse_list_str(liststr.data, liststr.length)
-				};
-				fredc_push_prop(&result, key, new_list);
-				free(vals);
 			}
-			
-			i = end+1;
-			start = i+1;
-		} else if (cs.data[i] == ',' || i == cs.length-1) {
-			vals = str8_cut(new_str8(cs.data+start, i-start+1, true), ':', true);
-			if (vals) {
-				if (vals[0].length && vals[1].length) {
-					str8 key = str8_trim(
-						str8_trim_space(vals[0], true),
-						new_str8("\",", 2, true),
-						true
-					);
-					str8 valstr = str8_trim(
-						str8_trim_space(vals[1], true),
-						new_str8(",", 1, true),
-						true
-					);
-					fredc_val val = fredc_parse_val(valstr.data, valstr.length);
-
-					fredc_push_prop(&result, key, val); 
-				}
-				free(vals);
+		} else if (c < 0x20) {
+			*error_pos = pos;
+			*error = "control character in string";
+			return 0;
+		} else {
+			size_t n = fredc_utf8_sequence(s + pos, length - pos);
+			if (n == 0) {
+				*error_pos = pos;
+				*error = "invalid UTF-8";
+				return 0;
 			}
+			pos += n;
+		}
+	}
+}
 
-			start = i+1;
+// returns: the position after the number at pos, or 0 with *error set
+static size_t fredc_validate_number(const unsigned char* s, size_t length, size_t pos, size_t* error_pos, const char** error) {
+	if (s[pos] == '-') {
+		pos++;
+	}
+	if (pos < length && s[pos] == '0') {
+		pos++;
+	} else if (pos < length && s[pos] >= '1' && s[pos] <= '9') {
+		while (pos < length && fredc_is_digit(s[pos])) pos++;
+	} else {
+		*error_pos = pos;
+		*error = "invalid number";
+		return 0;
+	}
+
+	if (pos < length && s[pos] == '.') {
+		pos++;
+		if (pos >= length || !fredc_is_digit(s[pos])) {
+			*error_pos = pos;
+			*error = "invalid number";
+			return 0;
 		}
+		while (pos < length && fredc_is_digit(s[pos])) pos++;
 	}
 
-	
-	return result;
+	if (pos < length && (s[pos] == 'e' || s[pos] == 'E')) {
+		pos++;
+		if (pos < length && (s[pos] == '+' || s[pos] == '-')) {
+			pos++;
+		}
+		if (pos >= length || !fredc_is_digit(s[pos])) {
+			*error_pos = pos;
+			*error = "invalid number";
+			return 0;
+		}
+		while (pos < length && fredc_is_digit(s[pos])) pos++;
+	}
+
+	return pos;
 }
 
-bool fredc_validate_json(const char* contents, size_t length) {
-	if ( (contents == 0) || (length == 0) )  {
-		fprintf(stderr, "invalid json: empty\n");
-		return false;
+fredc_validate_result fredc_validate(const char* contents, size_t length, unsigned flags) {
+	const unsigned char* s = (const unsigned char*)contents;
+	bool trailing_commas = (flags & FREDC_VALIDATE_TRAILING_COMMAS) != 0;
+	uint64_t is_object[FREDC_MAX_DEPTH / 64] = {0};
+	size_t depth = 0, pos = 0;
+	enum fredc_validate_state state = FREDC_EXPECT_VALUE;
+	size_t error_pos = 0;
+	const char* error = 0;
+
+	if (s == 0) {
+		length = 0;
 	}
 
-	size_t start = 0, end = length;
-	while (contents[start] != '{' && start < end) start++;
-	while (contents[end] != '}' && end > start) end--;
+	for (;;) {
+		pos = fredc_skip_space(s, length, pos);
+		if (pos >= length) {
+			if (depth || state != FREDC_EXPECT_COMMA_OR_CLOSE) {
+				error_pos = length;
+				error = length ? "unexpected end of input" : "empty input";
+			}
+			break;
+		}
+
+		unsigned char c = s[pos];
+		bool in_object = depth && (is_object[(depth-1) / 64] >> ((depth-1) % 64) & 1);
 
-	if ( start >= end) {
-		fprintf(stderr, "invalid json: no top level object\n");
-		return false;
+		if (state == FREDC_EXPECT_COMMA_OR_CLOSE) {
+			if (depth == 0) {
+				error_pos = pos;
+				error = "unexpected data after the value";
+				break;
+			}
+			if (c == ',') {
+				state = in_object ? FREDC_EXPECT_KEY : FREDC_EXPECT_VALUE;
+				pos++;
+				continue;
+			}
+			if (c != (in_object ? '}' : ']')) {
+				error_pos = pos;
+				error = in_object ? "expected , or }" : "expected , or ]";
+				break;
+			}
+		} else if (state == FREDC_EXPECT_COLON) {
+			if (c != ':') {
+				error_pos = pos;
+				error = "expected :";
+				break;
+			}
+			state = FREDC_EXPECT_VALUE;
+			pos++;
+			continue;
+		} else if (state == FREDC_EXPECT_KEY || state == FREDC_EXPECT_KEY_OR_CLOSE) {
+			bool may_close = state == FREDC_EXPECT_KEY_OR_CLOSE || trailing_commas;
+			if (c != '\"' && !(c == '}' && may_close)) {
+				error_pos = pos;
+				error = "expected a key";
+				break;
+			}
+			if (c == '\"') {
+				pos = fredc_validate_string(s, length, pos, &error_pos, &error);
+				if (pos == 0) {
+					break;
+				}
+				state = FREDC_EXPECT_COLON;
+				continue;
+			}
+		} else if (c == ']' && in_object == false && depth &&
+			(state == FREDC_EXPECT_VALUE_OR_CLOSE || trailing_commas)) {
+			// Closed below
+		} else {
+			// A value
+			switch (c) {
+				case '{': case '[': {
+					if (depth >= FREDC_MAX_DEPTH) {
+						error_pos = pos;
+						error = "nested too deeply";
+						break;
+					}
+					uint64_t bit = 1ull << (depth % 64);
+					if (c == '{') {
+						is_object[depth / 64] |= bit;
+					} else {
+						is_object[depth / 64] &= ~bit;
+					}
+					depth++;
+					state = c == '{' ? FREDC_EXPECT_KEY_OR_CLOSE : FREDC_EXPECT_VALUE_OR_CLOSE;
+					pos++;
+				} break;
+
+				case '\"': {
+					pos = fredc_validate_string(s, length, pos, &error_pos, &error);
+					state = FREDC_EXPECT_COMMA_OR_CLOSE;
+				} break;
+
+				case 't': case 'f': case 'n': {
+					const char* literal = c == 't' ? "true" : c == 'f' ? "false" : "null";
+					size_t n = strlen(literal);
+					if (length - pos < n || memcmp(s + pos, literal, n) != 0) {
+						error_pos = pos;
+						error = "invalid literal";
+						break;
+					}
+					pos += n;
+					state = FREDC_EXPECT_COMMA_OR_CLOSE;
+				} break;
+
+				default: {
+					if (c == '-' || fredc_is_digit(c)) {
+						pos = fredc_validate_number(s, length, pos, &error_pos, &error);
+						state = FREDC_EXPECT_COMMA_OR_CLOSE;
+					} else {
+						error_pos = pos;
+						error = "expected a value";
+					}
+				} break;
+			}
+			if (error) {
+				break;
+			}
+			continue;
+		}
+
+		// Closing bracket of the innermost container
+		depth--;
+		state = FREDC_EXPECT_COMMA_OR_CLOSE;
+		pos++;
 	}
-	
-	return true;
+
+	return (fredc_validate_result){
+		.valid = error == 0,
+		.offset = error ? error_pos : 0,
+		.error = error,
+	};
+}
+
+// Validates like fredc_validate with trailing commas allowed, so everything
+// it accepts parses, and reports the first error on stderr.
+bool fredc_validate_json(const char* contents, size_t length) {
+	fredc_validate_result result = fredc_validate(contents, length, FREDC_VALIDATE_TRAILING_COMMAS);
+	if (!result.valid) {
+		fprintf(stderr, "invalid json: %s at byte %zu\n", result.error, result.offset);
+	}
+	return result.valid;
 }
 
+// Values owned by a fredc_doc are released with the document, see fredc_doc_free
 void fredc_val_free(fredc_val* v) {
 	switch(v->type) {
-		JSON_STRING: {
-			free(v->string.data);
+		case JSON_STRING: {
+			FREDC_FREE(v->string.data);
 		} break;
-		JSON_OBJ: {
-			fredc_obj_free(&v->object);
+		case JSON_OBJ: {
+			if (v->object->arena == 0) {
+				fredc_obj_free(v->object);
+				FREDC_FREE(v->object);
+			}
 		} break;
-		JSON_LIST: {
-			free(v->list.data);
+		case JSON_LIST: {
+			if (v->list->arena == 0) {
+				fredc_cache_drop(0, &v->list->cache);
+				if (!fredc_share_release(&v->list->share)) {
+					for (size_t i = 0; !v->list->packed && i < v->list->length; i++) {
+						fredc_val_free(v->list->data + i);
+					}
+					FREDC_FREE(v->list->data);
+				}
+				FREDC_FREE(v->list);
+			}
 		} break;
 		
 		default: break;
@@ -771,20 +6658,26 @@ void fredc_val_free(fredc_val* v) {
 
 void fredc_node_free(fredc_node* n) {
 	fredc_val_free(&n->val);
-	free(n->key.data);
+	FREDC_FREE(n->key.data);
 }
 
 void fredc_obj_free(fredc_obj* o) {
-	for (int i = 0; i < o->length; i++) {
-		fredc_node* node = o->props+i;
-		while(node) {
-			fredc_node_free(node);
-			node = node->next;
-		}
+	if (o->arena) {
+		*o = (fredc_obj){0};
+		return;
+	}
+
+	fredc_cache_drop(0, &o->cache);
+	if (fredc_share_release(&o->share)) {
+		*o = (fredc_obj){0};
+		return;
+	}
+	for (size_t i = 0; i < o->length; i++) {
+		fredc_node_free(o->props+i);
 	}
-	free(o->props);
-	free(o->pool.data);
-	o->pool = (fredc_node_list){0};
+	FREDC_FREE(o->props);
+	FREDC_FREE(o->index);
+	*o = (fredc_obj){0};
 }
 
 #endif
@@ -1,64 +1,280 @@
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #define FREDC_IMPLEMENTATION
+#define FREDC_THREADS
 #include "fredc.h"
 
-str8 read_all(char* filename) {
-	char buf[1024];
-	struct char_list {
-		char* data;
-		size_t length, capacity;
-	} result = {};
-
-	FILE* fstream = fopen(filename, "r");
-	if (!fstream) {
-		perror("(read_all) fread");
-		goto cleanup;
+// --lines: records are grouped into batches of about this many bytes, each
+// parsed and re-emitted by one worker into its own buffer
+#define LINES_BATCH_SIZE (256*1024)
+// Batches that may be in flight ahead of the one being written out
+#define LINES_RING_PER_THREAD 4
+
+typedef struct lines_batch {
+	size_t seq;
+	bool done;
+	fredc_writer out;
+	size_t records, errors;
+} lines_batch;
+
+typedef struct lines_state {
+	str8 input;
+	size_t pos;      // start of the next unclaimed batch
+	size_t next_seq; // sequence number of the next unclaimed batch
+	size_t written;  // batches handed to stdout so far
+
+	lines_batch* ring;
+	size_t ring_size;
+
+	pthread_mutex_t lock;
+	pthread_cond_t claimable, finished;
+} lines_state;
+
+static bool is_blank(const char* data, size_t length) {
+	for (size_t i = 0; i < length; i++) {
+		if (!isspace((unsigned char)data[i])) {
+			return false;
+		}
 	}
+	return true;
+}
+
+static void lines_process(lines_batch* batch, const char* data, size_t length) {
+	size_t pos = 0;
+	while (pos < length) {
+		const char* end = (const char*)memchr(data+pos, '\n', length-pos);
+		size_t line_length = end ? (size_t)(end - (data+pos)) : length-pos;
+		const char* line = data+pos;
+		pos += line_length + 1;
 
-	size_t bytes_read = 0;
-	while ((bytes_read = fread(buf, 1, sizeof(buf), fstream)) > 0){
-		darr_push_arr(result, buf, bytes_read);
+		if (is_blank(line, line_length)) {
+			continue;
+		}
+
+		batch->records++;
+		fredc_doc* doc = fredc_doc_parse_ex(line, line_length, FREDC_PARSE_INSITU | FREDC_PARSE_PACK);
+		if (doc->root->type == JSON_UNDEFINED) {
+			batch->errors++;
+		} else {
+			fredc_val_write(&batch->out, *doc->root, (fredc_write_opts){0});
+			fredc_writer_put(&batch->out, "\n", 1);
+		}
+		fredc_doc_free(doc);
 	}
+}
+
+static void* lines_worker(void* arg) {
+	lines_state* s = (lines_state*)arg;
+
+	pthread_mutex_lock(&s->lock);
+	for (;;) {
+		while (s->pos < s->input.length && s->next_seq - s->written >= s->ring_size) {
+			pthread_cond_wait(&s->claimable, &s->lock);
+		}
+		if (s->pos >= s->input.length) {
+			break;
+		}
+
+		// Claim everything up to the first newline past the batch size
+		size_t start = s->pos, end = s->input.length;
+		if (end - start > LINES_BATCH_SIZE) {
+			const char* nl = (const char*)memchr(s->input.data + start + LINES_BATCH_SIZE, '\n',
+				end - start - LINES_BATCH_SIZE);
+			if (nl) {
+				end = (size_t)(nl - s->input.data) + 1;
+			}
+		}
+		s->pos = end;
+
+		lines_batch* batch = s->ring + (s->next_seq % s->ring_size);
+		batch->seq = s->next_seq++;
+		pthread_mutex_unlock(&s->lock);
+
+		lines_process(batch, s->input.data + start, end - start);
+
+		pthread_mutex_lock(&s->lock);
+		batch->done = true;
+		pthread_cond_broadcast(&s->finished);
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	return 0;
+}
+
+// Parses every line of input as its own document on a pool of threads and
+// writes the records back out compact, one per line, in input order.
+static int run_lines(str8 input, int threads) {
+	unsigned long long start = fredc_now_ns();
+
+	lines_state s = {
+		.input = input,
+		.ring_size = (size_t)threads * LINES_RING_PER_THREAD,
+	};
+	s.ring = (lines_batch*)calloc(s.ring_size, sizeof(lines_batch));
+	assert(s.ring);
+	pthread_mutex_init(&s.lock, 0);
+	pthread_cond_init(&s.claimable, 0);
+	pthread_cond_init(&s.finished, 0);
+
+	pthread_t* workers = (pthread_t*)malloc(threads * sizeof(pthread_t));
+	assert(workers);
+	for (int i = 0; i < threads; i++) {
+		pthread_create(workers + i, 0, lines_worker, &s);
+	}
+
+	// Reorder buffer: batches finish in any order but are written by sequence
+	size_t records = 0, errors = 0;
+	bool ok = true;
+	pthread_mutex_lock(&s.lock);
+	for (;;) {
+		lines_batch* batch = s.ring + (s.written % s.ring_size);
+		while (!(batch->done && batch->seq == s.written) &&
+			!(s.pos >= s.input.length && s.written == s.next_seq)) {
+			pthread_cond_wait(&s.finished, &s.lock);
+		}
+		if (s.written == s.next_seq) {
+			break;
+		}
+		pthread_mutex_unlock(&s.lock);
+
+		if (batch->out.length && fwrite(batch->out.data, 1, batch->out.length, stdout) != batch->out.length) {
+			ok = false;
+		}
+		records += batch->records;
+		errors += batch->errors;
+		batch->out.length = 0;
+		batch->records = batch->errors = 0;
 
-	if (feof(fstream) || !ferror(fstream)) {
-		darr_resize(result, sizeof(result.data[0]), result.length);
+		pthread_mutex_lock(&s.lock);
+		batch->done = false;
+		s.written++;
+		pthread_cond_broadcast(&s.claimable);
+	}
+	pthread_mutex_unlock(&s.lock);
+
+	for (int i = 0; i < threads; i++) {
+		pthread_join(workers[i], 0);
+	}
+	free(workers);
+	for (size_t i = 0; i < s.ring_size; i++) {
+		fredc_writer_free(&s.ring[i].out);
+	}
+	free(s.ring);
+	pthread_cond_destroy(&s.finished);
+	pthread_cond_destroy(&s.claimable);
+	pthread_mutex_destroy(&s.lock);
+
+	fflush(stdout);
+	double seconds = (fredc_now_ns() - start) / 1e9;
+	if (seconds <= 0) {
+		seconds = 1e-9;
+	}
+	fprintf(stderr, "%zu records (%zu failed), %d threads, %.3f s, %.0f records/s, %.1f MB/s\n",
+		records, errors, threads, seconds, records / seconds, input.length / seconds / 1e6);
+
+	return ok && errors == 0 ? 0 : 1;
+}
+
+enum output_format {
+	OUTPUT_JSON,
+	OUTPUT_BIN,
+};
+
+static int run_single(str8 input, int threads, bool from_bin, enum output_format format) {
+	// The tree borrows its strings from the file, which stays open until
+	// the output has been written.
+	fredc_doc* doc;
+	if (from_bin) {
+		doc = fredc_bin_decode(input.data, input.length, FREDC_PARSE_INSITU);
+		if (doc->root->type == JSON_UNDEFINED) {
+			fprintf(stderr, "not a fredc binary file\n");
+			fredc_doc_free(doc);
+			return 1;
+		}
 	} else {
-		free(result.data);
-		result = (struct char_list){};
+		if (!fredc_validate_json(input.data, input.length)) {
+			return 1;
+		}
+		doc = fredc_doc_parse_parallel(input.data, input.length, FREDC_PARSE_INSITU | FREDC_PARSE_PACK, threads);
+	}
+
+	if (format == OUTPUT_BIN) {
+		str8 bin = fredc_bin_encode(*doc->root);
+		bool ok = bin.length && fwrite(bin.data, 1, bin.length, stdout) == bin.length;
+		fredc_free(bin.data);
+		fredc_doc_free(doc);
+		return ok ? 0 : 1;
 	}
-	fclose(fstream);
 
-	cleanup:
-		return (str8){
-			.data = result.data,
-			.length = result.length > 0 ? result.length-1 : 0,
-		};
+	fredc_writer w = fredc_writer_file(stdout);
+	fredc_val_write(&w, *doc->root, (fredc_write_opts){ .indent = INDENT_SIZE });
+	bool ok = fredc_writer_flush(&w);
+	fredc_writer_free(&w);
+	printf("\n");
+
+	fredc_doc_free(doc);
+
+	return ok ? 0 : 1;
+}
+
+static void usage(void) {
+	fprintf(stderr, "usage: fredc [--lines | --to-bin | --from-bin] [-j threads] [filename]\n");
+	fprintf(stderr, "  --lines     treat every line as a separate JSON record (NDJSON)\n");
+	fprintf(stderr, "  --to-bin    write the document in the fredc binary format\n");
+	fprintf(stderr, "  --from-bin  read a document in the fredc binary format\n");
+	fprintf(stderr, "  -j threads  worker threads (default: all cores)\n");
+	fprintf(stderr, "  filename    a file, or - for stdin\n");
 }
 
 int main(int argc, char** argv) {
-	if (argc < 2) {
-		fprintf(stderr, "usage: fredc [filename]\n");		
-		return 1;
+	bool lines = false, from_bin = false;
+	enum output_format format = OUTPUT_JSON;
+	int threads = 0;
+	const char* filename = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--lines") == 0) {
+			lines = true;
+		} else if (strcmp(argv[i], "--to-bin") == 0) {
+			format = OUTPUT_BIN;
+		} else if (strcmp(argv[i], "--from-bin") == 0) {
+			from_bin = true;
+		} else if (strcmp(argv[i], "-j") == 0 && i+1 < argc) {
+			threads = atoi(argv[++i]);
+		} else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2]) {
+			threads = atoi(argv[i]+2);
+		} else if (argv[i][0] == '-' && argv[i][1]) {
+			usage();
+			return 1;
+		} else {
+			filename = argv[i];
+		}
 	}
-	str8 c = read_all(argv[1]);
-	if (c.length == 0) {
+	if (!filename || (lines && (from_bin || format != OUTPUT_JSON))) {
+		usage();
 		return 1;
 	}
+	if (threads <= 0) {
+		threads = fredc_default_threads();
+	}
 
-	if (!fredc_validate_json(c.data, c.length)) {
-		fprintf(stderr, "%s\n", c.data);
+	fredc_file file;
+	if (!fredc_file_open(&file, filename)) {
+		perror("(main) fredc_file_open");
+		return 1;
+	}
+	if (file.contents.length == 0) {
+		fredc_file_close(&file);
 		return 1;
 	}
 
-	fredc_obj obj = fredc_parse_obj_str(c.data, c.length);
-	free(c.data);
-
-	printf("%s\n", fredc_obj_stringify(obj));
-
-	str8_free_pool();
-	fredc_obj_free(&obj);
+	int result = lines ? run_lines(file.contents, threads) : run_single(file.contents, threads, from_bin, format);
+	fredc_file_close(&file);
 
-	return 0;
+	return result;
 }
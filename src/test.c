@@ -1,8 +1,12 @@
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #define FREDC_IMPLEMENTATION
+#define FREDC_THREADS
+#define FREDC_TEST
 #include "fredc.h"
 
 #define arr_len(arr) sizeof(arr) / sizeof(arr[0])
@@ -32,6 +36,15 @@ const char* json_strs[] = {
 "	\"key-l\": [\"value1\", \"value2\", \"value3\"]\n"
 "}\n",
 
+"{\n"
+"	\"list-o\": [{\"a\": 1, \"b\": [true, false]}, {\"c\": \"}{][,:\"}],\n"
+"	\"list-l\": [[1, 2], [], [[null]]],\n"
+"	\"str-o\": {\"d\": \"{\\\"e\\\": [1]}\"},\n"
+"	\"zero\": 0,\n"
+"}\n",
+
+"{\"\": 1, \"a\": {\"\": [\"\"]}, \"b\": 2}\n",
+
 };
 
 bool validate_fredc_obj(fredc_obj* obj, const char* key) {
@@ -41,42 +54,1520 @@ bool validate_fredc_obj(fredc_obj* obj, const char* key) {
 		(str8){}
 	};
 	bool result = true;
-	for (int e = 0; e < obj->length; e++) {
+	for (size_t e = 0; e < obj->length; e++) {
 		fredc_node* node = obj->props + e;
-		while(node) {
-			if (node->key.length == 0){
-				node = node->next;
-				continue;
+		key_list[2] = node->key;
+		if (node->val.type == JSON_OBJ) {
+			str8 label = str8_list_concat(
+				(str8_list) {
+					.data = key_list,
+					.capacity = 3,
+					.length = 3,
+				}
+			);
+
+			result = result && validate_fredc_obj(node->val.object, label.data);
+		} else if (node->val.type == JSON_UNDEFINED) {
+			str8 label = str8_list_concat(
+				(str8_list) {
+					.data = key_list,
+					.capacity = 3,
+					.length = 3,
+				}
+			);
+			fprintf(stderr, "%s undefined\n", label.data);
+			result = false;
+		}
+	}
+
+	return result;
+}
+
+#define STRESS_THREADS 8
+#define STRESS_DOCS 500
+
+typedef struct stress_job {
+	str8* expected; // stringified json_strs, one per entry
+	int failures;
+} stress_job;
+
+// Parses and stringifies every test document STRESS_DOCS times on its own thread
+void* stress_thread(void* arg) {
+	stress_job* job = (stress_job*)arg;
+	size_t num_strs = arr_len(json_strs);
+
+	for (int d = 0; d < STRESS_DOCS; d++) {
+		size_t i = d % num_strs;
+		size_t len = strlen(json_strs[i]);
+
+		if (d & 1) {
+			fredc_doc* doc = fredc_doc_parse(json_strs[i], len);
+			if (!str8_cmp(fredc_val_str8ify(*doc->root, 0), job->expected[i])) {
+				job->failures++;
+			}
+			fredc_doc_free(doc);
+		} else {
+			fredc_obj obj = fredc_parse_obj_str(json_strs[i], len);
+			if (!str8_cmp(fredc_obj_str8ify(obj), job->expected[i])) {
+				job->failures++;
 			}
+			fredc_obj_free(&obj);
+		}
+
+		if (i == num_strs-1) {
+			str8_free_pool();
+		}
+	}
+	str8_free_pool();
+
+	return 0;
+}
 
-			key_list[2] = node->key;
-			if (node->val.type == JSON_OBJ) {
-				str8 label = str8_list_concat(
-					(str8_list) {
-						.data = key_list,
-						.capacity = 3,
-						.length = 3,
-					}
-				);
-
-				result = result && validate_fredc_obj(&node->val.object, label.data);
-			} else if (node->val.type == JSON_UNDEFINED) {
-				str8 label = str8_list_concat(
-					(str8_list) {
-						.data = key_list,
-						.capacity = 3,
-						.length = 3,
-					}
-				);
-				fprintf(stderr, "%s undefined\n", label.data);
-				result = false;
+int stress_test(void) {
+	size_t num_strs = arr_len(json_strs);
+	str8 expected[arr_len(json_strs)];
+	for (size_t i = 0; i < num_strs; i++) {
+		fredc_obj obj = fredc_parse_obj_str(json_strs[i], strlen(json_strs[i]));
+		str8 s = fredc_obj_str8ify(obj);
+		expected[i] = (str8){ .data = strdup(s.data ? s.data : ""), .length = s.length };
+		fredc_obj_free(&obj);
+	}
+
+	pthread_t threads[STRESS_THREADS];
+	stress_job jobs[STRESS_THREADS] = {};
+	for (int t = 0; t < STRESS_THREADS; t++) {
+		jobs[t].expected = expected;
+		pthread_create(threads + t, 0, stress_thread, jobs + t);
+	}
+
+	int failures = 0;
+	for (int t = 0; t < STRESS_THREADS; t++) {
+		pthread_join(threads[t], 0);
+		failures += jobs[t].failures;
+	}
+	for (size_t i = 0; i < num_strs; i++) {
+		free(expected[i].data);
+	}
+
+	printf("Stress test: %i threads x %i documents, %i failures\n", STRESS_THREADS, STRESS_DOCS, failures);
+	return failures;
+}
+
+// Byte at a time reference for the structural index.
+// Backslashes escape the next byte even outside strings, as in the bit logic.
+size_t reference_index(const char* s, size_t len, uint32_t* out) {
+	size_t count = 0;
+	bool in_string = false, in_scalar = false, escaped = false;
+	for (size_t i = 0; i < len; i++) {
+		char c = s[i];
+		bool quote = c == '"' && !escaped;
+		escaped = c == '\\' && !escaped;
+		if (in_string) {
+			if (quote) in_string = false;
+			continue;
+		}
+		bool space = c == ' ' || c == '\t' || c == '\n' || c == '\r';
+		bool op = c && strchr("{}[]:,", c);
+		if (quote) {
+			in_string = true;
+			out[count++] = i;
+		} else if (op) {
+			out[count++] = i;
+		} else if (!space && !in_scalar) {
+			out[count++] = i;
+		}
+		in_scalar = !space && !op && !quote;
+	}
+	return count;
+}
+
+// Every classifier must produce the same index as the reference on random input
+int index_test(void) {
+	const char alphabet[] = "{}[]:,\"\\ a1\n";
+	fredc_classify_fn classifiers[] = {
+		fredc_classify_scalar,
+#ifdef FREDC_SSE2
+		fredc_classify_sse2,
+#endif
+#ifdef FREDC_AVX2
+		__builtin_cpu_supports("avx2") ? fredc_classify_avx2 : fredc_classify_scalar,
+#endif
+	};
+
+	int failures = 0;
+	char buf[300];
+	uint32_t expected[300];
+	srand(7);
+	for (int round = 0; round < 20000; round++) {
+		size_t len = 1 + rand() % sizeof(buf);
+		for (size_t i = 0; i < len; i++) {
+			buf[i] = alphabet[rand() % (sizeof(alphabet)-1)];
+		}
+		size_t count = reference_index(buf, len, expected);
+
+		for (size_t c = 0; c < arr_len(classifiers); c++) {
+			fredc_index idx;
+			fredc_index_build_using(&idx, buf, len, classifiers[c]);
+			if (idx.length != count || memcmp(idx.data, expected, count * sizeof(uint32_t))) {
+				failures++;
 			}
+			fredc_index_free(&idx);
+		}
+	}
+
+	// Parsers rejecting the type of their input still free the index
+	fredc_obj not_obj = fredc_parse_obj_str("[1, 2]", 6);
+	fredc_list not_list = fredc_parse_list_str(" {\"a\": 1}", 9);
+	if (not_obj.length || not_list.length) {
+		failures++;
+	}
+
+	printf("Index test: %i failures\n", failures);
+	return failures;
+}
+
+// Feeding documents through the event parser in chunks of any size must
+// build the same tree as parsing them in one piece
+int sax_test(void) {
+	int failures = 0;
+	size_t chunk_sizes[] = {1, 2, 3, 7, 64};
+	fredc_write_opts compact = {0};
 
-			node = node->next;
+	for (size_t i = 0; i < arr_len(json_strs); i++) {
+		size_t len = strlen(json_strs[i]);
+		fredc_doc* doc = fredc_doc_parse(json_strs[i], len);
+		str8 expected = fredc_val_to_str8(*doc->root, compact);
+
+		for (size_t c = 0; c < arr_len(chunk_sizes); c++) {
+			fredc_tree_builder builder = {};
+			fredc_sax sax;
+			fredc_sax_init(&sax, fredc_tree_builder_handler(&builder));
+			for (size_t at = 0; at < len; at += chunk_sizes[c]) {
+				size_t n = len - at < chunk_sizes[c] ? len - at : chunk_sizes[c];
+				fredc_sax_feed(&sax, json_strs[i] + at, n);
+			}
+			bool ok = fredc_sax_finish(&sax);
+			fredc_sax_free(&sax);
+
+			fredc_val val = fredc_tree_builder_finish(&builder);
+			str8 out = fredc_val_to_str8(val, compact);
+			if (!ok || !str8_cmp(out, expected)) {
+				fprintf(stderr, "sax doc %zu chunk %zu: %s\n", i+1, chunk_sizes[c], out.data);
+				failures++;
+			}
+			fredc_free(out.data);
+			fredc_val_free(&val);
 		}
+
+		fredc_free(expected.data);
+		fredc_doc_free(doc);
 	}
 
-	return result;
+	const char* bad = "{\"a\": 1 \"b\": 2}";
+	fredc_sax sax;
+	fredc_sax_init(&sax, (fredc_sax_handler){0});
+	fredc_sax_feed(&sax, bad, 5);
+	fredc_sax_feed(&sax, bad+5, strlen(bad)-5);
+	if (fredc_sax_finish(&sax) || sax.error_offset != 8) {
+		failures++;
+	}
+	fredc_sax_free(&sax);
+
+	printf("SAX test: %i failures\n", failures);
+	return failures;
+}
+
+// Lazy lookups must find the same values as the full parse
+int lazy_test(void) {
+	int failures = 0;
+	fredc_lazy* doc = fredc_lazy_parse(json_strs[3], strlen(json_strs[3]));
+	fredc_lazy_val root = fredc_lazy_root(doc);
+
+	str8 inner = fredc_lazy_str8(fredc_lazy_get_js(root, "key-o.inner key-o.inner inner key"));
+	if (!str8_cmp(inner, (str8){ "inner inner value", 17 })) failures++;
+	if (!str8_cmp(fredc_lazy_str8(fredc_lazy_get_js(root, "key-l[2]")), (str8){ "value3", 6 })) failures++;
+	if (fredc_lazy_type(fredc_lazy_get_js(root, "[\"key-o\"].inner key-o")) != JSON_OBJ) failures++;
+	if (fredc_lazy_type(fredc_lazy_get_js(root, "key-l[3]")) != JSON_UNDEFINED) failures++;
+	if (fredc_lazy_type(fredc_lazy_get_js(root, "key-n.x")) != JSON_UNDEFINED) failures++;
+	if (fredc_lazy_type(fredc_lazy_get_js(root, "key-l[")) != JSON_UNDEFINED) failures++;
+
+	fredc_val n = fredc_lazy_scalar(fredc_lazy_get(root, "key-n"));
+	if (n.type != JSON_INT || n.integer != 101) failures++;
+
+	fredc_lazy_val list = fredc_lazy_get(root, "key-l");
+	if (fredc_lazy_length(list) != 3 || fredc_lazy_length(root) != 4) failures++;
+	if (!str8_cmp(fredc_lazy_str8(fredc_lazy_at(list, 2)), (str8){ "value3", 6 })) failures++;
+	if (fredc_lazy_type(fredc_lazy_at(list, 3)) != JSON_UNDEFINED) failures++;
+	if (fredc_lazy_type(fredc_lazy_get(root, "missing")) != JSON_UNDEFINED) failures++;
+
+	fredc_val obj = fredc_lazy_materialize(fredc_lazy_get(root, "key-o"));
+	fredc_obj full = fredc_parse_obj_str(json_strs[3], strlen(json_strs[3]));
+	fredc_val expected = fredc_get_prop(&full, "key-o");
+	str8 a = fredc_val_to_str8(obj, (fredc_write_opts){0});
+	str8 b = fredc_val_to_str8(expected, (fredc_write_opts){0});
+	if (!str8_cmp(a, b)) failures++;
+
+	fredc_free(a.data);
+	fredc_free(b.data);
+	fredc_val_free(&obj);
+	fredc_obj_free(&full);
+	fredc_lazy_free(doc);
+
+	printf("Lazy test: %i failures\n", failures);
+	return failures;
+}
+
+// Numbers must keep their type and format back to the shortest round trip form
+int number_test(void) {
+	const char* cases[][2] = {
+		{"0", "0"}, {"-0", "0"}, {"101", "101"}, {"1.5", "1.5"}, {"0.1", "0.1"},
+		{"-12.25e3", "-12250"}, {"1e21", "1e+21"}, {"1e-7", "1e-7"}, {"123e-2", "1.23"},
+		{"9223372036854775807", "9223372036854775807"},
+		{"-9223372036854775808", "-9223372036854775808"},
+		{"3.141592653589793238462643383279", "3.141592653589793"},
+		{"5e-324", "5e-324"}, {"1.7976931348623157e308", "1.7976931348623157e+308"},
+	};
+
+	int failures = 0;
+	for (size_t i = 0; i < arr_len(cases); i++) {
+		size_t consumed;
+		fredc_val v = fredc_parse_number(cases[i][0], strlen(cases[i][0]), &consumed);
+		str8 out = fredc_val_to_str8(v, (fredc_write_opts){0});
+		if (consumed != strlen(cases[i][0]) || strcmp(out.data, cases[i][1]) != 0) {
+			fprintf(stderr, "%s -> %s, expected %s\n", cases[i][0], out.data, cases[i][1]);
+			failures++;
+		}
+		fredc_free(out.data);
+	}
+
+	printf("Number test: %i failures\n", failures);
+	return failures;
+}
+
+// Sets, overwrites and reads back 20000 props to exercise index growth
+// Small objects are flat until they outgrow FREDC_OBJ_FLAT props
+int small_object_test(void) {
+	int failures = 0;
+	char key[32];
+
+	fredc_mem_stats before = fredc_mem_get_stats();
+	fredc_obj empty = new_fredc_obj(0);
+	if (fredc_mem_get_stats().allocations != before.allocations || fredc_get_prop(&empty, "a").type) {
+		failures++;
+	}
+	fredc_obj_free(&empty);
+
+	fredc_obj obj = new_fredc_obj(0);
+	for (int i = 0; i < FREDC_OBJ_FLAT*2; i++) {
+		snprintf(key, sizeof(key), "k%i", i);
+		fredc_set_prop(&obj, key, (fredc_val){ .type = JSON_INT, .integer = i });
+		fredc_set_prop(&obj, "k0", (fredc_val){ .type = JSON_INT, .integer = -1 });
+		if ((obj.index != 0) != (obj.length > FREDC_OBJ_FLAT)) {
+			failures++;
+		}
+		for (int j = 1; j <= i; j++) {
+			snprintf(key, sizeof(key), "k%i", j);
+			if (fredc_get_prop(&obj, key).integer != j) {
+				failures++;
+			}
+		}
+	}
+	if (obj.length != FREDC_OBJ_FLAT*2 || fredc_get_prop(&obj, "k0").integer != -1) {
+		failures++;
+	}
+	fredc_obj_free(&obj);
+
+	// Parsed objects are allocated at their exact size
+	const char* text = "{\"a\": {}, \"b\": {\"x\": 1, \"y\": 2}}";
+	fredc_doc* doc = fredc_doc_parse(text, strlen(text));
+	fredc_val b = fredc_get_prop(doc->root->object, "b");
+	fredc_val a = fredc_get_prop(doc->root->object, "a");
+	if (b.object->capacity != 2 || b.object->index || a.object->props || fredc_get_prop(b.object, "y").integer != 2) {
+		failures++;
+	}
+	fredc_doc_free(doc);
+
+	// The empty key is a key like any other
+	text = "{\"\":1,\"a\":{\"\":[2]}}";
+	fredc_obj empty_keys = fredc_parse_obj_str(text, strlen(text));
+	str8 out = fredc_val_to_str8((fredc_val){ .type = JSON_OBJ, .object = &empty_keys }, (fredc_write_opts){0});
+	if (strcmp(out.data, text) != 0 || fredc_get_prop(&empty_keys, "").integer != 1 ||
+		fredc_get_prop_js(&empty_keys, "a[\"\"][0]").integer != 2) {
+		failures++;
+	}
+	fredc_free(out.data);
+	fredc_obj_free(&empty_keys);
+
+	// Containers are out of line, so values stay small
+	if (sizeof(fredc_val) != 24 || sizeof(fredc_node) != 48) {
+		failures++;
+	}
+
+	printf("Small object test: %i failures\n", failures);
+	return failures;
+}
+
+int large_object_test(void) {
+	int failures = 0;
+	char key[32];
+	fredc_obj obj = new_fredc_obj(0);
+
+	for (int i = 0; i < 20000; i++) {
+		snprintf(key, sizeof(key), "k%i", i);
+		fredc_set_prop(&obj, key, (fredc_val){ .type = JSON_NUM, .number = i });
+	}
+	for (int i = 0; i < 20000; i += 2) {
+		snprintf(key, sizeof(key), "k%i", i);
+		fredc_set_prop(&obj, key, (fredc_val){ .type = JSON_NUM, .number = -i });
+	}
+	for (int i = 0; i < 20000; i++) {
+		snprintf(key, sizeof(key), "k%i", i);
+		fredc_val v = fredc_get_prop(&obj, key);
+		if (v.type != JSON_NUM || v.number != ((i & 1) ? i : -i)) {
+			failures++;
+		}
+	}
+	if (obj.length != 20000 || fredc_get_prop(&obj, "k20000").type != JSON_UNDEFINED) {
+		failures++;
+	}
+	fredc_obj_free(&obj);
+
+	printf("Large object test: %i failures\n", failures);
+	return failures;
+}
+
+// Compiled paths: keys, indices, quoted keys, sets through lists and objects
+int path_test(void) {
+	int failures = 0;
+	const char* src = "{\"a\": {\"b\": [1, {\"c\": \"x\"}]}, \"k.d\": 2}";
+	fredc_doc* doc = fredc_doc_parse(src, strlen(src));
+	fredc_obj* root = doc->root->object;
+
+	fredc_path path = fredc_path_compile("a.b[1].c");
+	if (!path.valid || path.length != 4 || !path.data[2].is_index || path.data[2].index != 1) {
+		failures++;
+	}
+	for (int i = 0; i < 3; i++) {
+		fredc_val c = fredc_path_get(*doc->root, &path);
+		if (c.type != JSON_STRING || !str8_cmp(c.string, (str8){ "x", 1 })) {
+			failures++;
+		}
+	}
+	fredc_path_free(&path);
+
+	const char* invalid[] = { "", ".a", "a.", "a..b", "a[", "a[x]", "a[1", "[\"a]", "a]",
+		"a[99999999999999999999]", "a[18446744073709551616]" };
+	for (int i = 0; i < arr_len(invalid); i++) {
+		path = fredc_path_compile(invalid[i]);
+		if (path.valid) {
+			fprintf(stderr, "path \"%s\" should not compile\n", invalid[i]);
+			failures++;
+		}
+		fredc_path_free(&path);
+	}
+
+	if (fredc_get_prop_js(root, "[\"k.d\"]").integer != 2 || fredc_get_prop_js(root, "a.b[0]").integer != 1 ||
+		fredc_get_prop_js(root, "a.b[2]").type != JSON_UNDEFINED || fredc_get_prop_js(root, "a.b.c").type != JSON_UNDEFINED) {
+		failures++;
+	}
+
+	fredc_set_prop_js(root, "a.b[1].c", (fredc_val){ .type = JSON_BOOL, .boolean = true });
+	fredc_set_prop_js(root, "a.b[2]", (fredc_val){ .type = JSON_NULL });
+	fredc_set_prop_js(root, "x.y.z", (fredc_val){ .type = JSON_INT, .integer = 7 });
+	if (fredc_set_prop_js(root, "n[0]", (fredc_val){ .type = JSON_NULL }).type != JSON_UNDEFINED ||
+		fredc_set_prop_js(root, "a.b[4]", (fredc_val){ .type = JSON_NULL }).type != JSON_UNDEFINED) {
+		failures++;
+	}
+
+	str8 out = fredc_val_to_str8(*doc->root, (fredc_write_opts){0});
+	const char* expected = "{\"a\":{\"b\":[1,{\"c\":true},null]},\"k.d\":2,\"x\":{\"y\":{\"z\":7}}}";
+	if (strcmp(out.data, expected) != 0) {
+		fprintf(stderr, "path set output: %s\n", out.data);
+		failures++;
+	}
+	fredc_free(out.data);
+	fredc_doc_free(doc);
+
+	printf("Path test: %i failures\n", failures);
+	return failures;
+}
+
+// Interned documents share keys (and short strings) between records
+int intern_test(void) {
+	int failures = 0;
+	fredc_writer text = {};
+	char buf[256];
+
+	fredc_writer_put(&text, "[", 1);
+	for (int i = 0; i < 2000; i++) {
+		int n = snprintf(buf, sizeof(buf), "%s{\"identifier\": %i, \"category\": \"c%i\", \"description\": \"%0100i\"}",
+			i ? ", " : "", i, i % 3, i);
+		fredc_writer_put(&text, buf, n);
+	}
+	fredc_writer_put(&text, "]", 1);
+
+	fredc_doc* plain = fredc_doc_parse(text.data, text.length);
+	str8 expected = fredc_val_to_str8(*plain->root, (fredc_write_opts){0});
+
+	unsigned flag_sets[] = {
+		FREDC_PARSE_INTERN,
+		FREDC_PARSE_INTERN | FREDC_PARSE_INSITU,
+		FREDC_PARSE_INTERN_STRINGS,
+	};
+	for (int f = 0; f < arr_len(flag_sets); f++) {
+		fredc_doc* doc = fredc_doc_parse_ex(text.data, text.length, flag_sets[f]);
+		str8 out = fredc_val_to_str8(*doc->root, (fredc_write_opts){0});
+		if (!str8_cmp(expected, out)) {
+			failures++;
+		}
+		fredc_free(out.data);
+
+		fredc_list records = *doc->root->list;
+		fredc_node* a = records.data[0].object->props;
+		fredc_node* b = records.data[1999].object->props;
+		if (a[0].key.data != b[0].key.data || a[2].key.data != b[2].key.data) {
+			failures++;
+		}
+		bool shared = a[1].val.string.data == records.data[3].object->props[1].val.string.data;
+		if (shared != ((flag_sets[f] & FREDC_PARSE_INTERN_STRINGS) != 0) ||
+			a[2].val.string.data == b[2].val.string.data) {
+			failures++;
+		}
+		if (!(flag_sets[f] & FREDC_PARSE_INSITU) &&
+			fredc_doc_get_stats(doc).bytes_used >= fredc_doc_get_stats(plain).bytes_used) {
+			failures++;
+		}
+		if (fredc_get_prop(records.data[1234].object, "category").type != JSON_STRING) {
+			failures++;
+		}
+		fredc_doc_free(doc);
+	}
+
+	fredc_free(expected.data);
+	fredc_doc_free(plain);
+	fredc_writer_free(&text);
+
+	printf("Intern test: %i failures\n", failures);
+	return failures;
+}
+
+// Binary round trips, in place reads and damaged buffers
+int bin_test(void) {
+	int failures = 0;
+
+	for (int i = 0; i < arr_len(json_strs); i++) {
+		fredc_doc* doc = fredc_doc_parse(json_strs[i], strlen(json_strs[i]));
+		str8 expected = fredc_val_to_str8(*doc->root, (fredc_write_opts){0});
+		str8 bin = fredc_bin_encode(*doc->root);
+
+		for (unsigned flags = 0; flags <= FREDC_PARSE_INSITU; flags += FREDC_PARSE_INSITU) {
+			fredc_doc* decoded = fredc_bin_decode(bin.data, bin.length, flags);
+			str8 out = fredc_val_to_str8(*decoded->root, (fredc_write_opts){0});
+			if (!str8_cmp(expected, out)) {
+				fprintf(stderr, "bin_%i decoded: %s\n", i+1, out.data);
+				failures++;
+			}
+			fredc_free(out.data);
+			fredc_doc_free(decoded);
+		}
+
+		// Flip bytes one at a time: reads must stay in bounds
+		for (size_t at = 0; at < bin.length; at += 3) {
+			bin.data[at] ^= 0x5a;
+			fredc_doc* damaged = fredc_bin_decode(bin.data, bin.length, 0);
+			fredc_doc_free(damaged);
+			bin.data[at] ^= 0x5a;
+		}
+
+		fredc_free(bin.data);
+		fredc_free(expected.data);
+		fredc_doc_free(doc);
+	}
+
+	const char* src = "{\"a\": {\"b\": [1, 2.5, \"three\", null, false]}, \"a\": {\"b\": [1, 2.5, \"three\", null, false]}, \"z\": {}}";
+	fredc_doc* doc = fredc_doc_parse(src, strlen(src));
+	str8 encoded = fredc_bin_encode(*doc->root);
+	fredc_bin bin;
+	if (!fredc_bin_open(&bin, encoded.data, encoded.length) || fredc_bin_open(&bin, encoded.data, 16)) {
+		failures++;
+	}
+	fredc_bin_open(&bin, encoded.data, encoded.length);
+	fredc_bin_val root = fredc_bin_root(&bin);
+	fredc_bin_val list = fredc_bin_get(fredc_bin_get(root, "a"), "b");
+	if (fredc_bin_type(root) != JSON_OBJ || fredc_bin_length(root) != 2 || !str8_cmp(fredc_bin_key(root, 1), (str8){ "z", 1 }) ||
+		fredc_bin_type(list) != JSON_LIST || fredc_bin_length(list) != 5 ||
+		fredc_bin_scalar(fredc_bin_at(list, 0)).integer != 1 || fredc_bin_scalar(fredc_bin_at(list, 1)).number != 2.5 ||
+		!str8_cmp(fredc_bin_str8(fredc_bin_at(list, 2)), (str8){ "three", 5 }) ||
+		fredc_bin_type(fredc_bin_at(list, 3)) != JSON_NULL || fredc_bin_type(fredc_bin_at(list, 5)) != JSON_UNDEFINED ||
+		fredc_bin_type(fredc_bin_get(root, "missing")) != JSON_UNDEFINED || fredc_bin_length(fredc_bin_get(root, "z")) != 0) {
+		failures++;
+	}
+	fredc_free(encoded.data);
+	fredc_doc_free(doc);
+
+	printf("Binary format test: %i failures\n", failures);
+	return failures;
+}
+
+// Documents split across threads must match a serial parse
+int parallel_test(void) {
+	int failures = 0;
+	fredc_writer big_list = {}, big_obj = {};
+	char buf[128];
+
+	fredc_writer_put(&big_list, "[", 1);
+	const char* head = "{\"meta\": {\"v\": 1}, \"data\": {";
+	const char* tail = "}, \"tail\": [true,],}";
+	fredc_writer_put(&big_obj, head, strlen(head));
+	for (int i = 0; i < 60000; i++) {
+		int n = snprintf(buf, sizeof(buf), "%s{\"id\": %i, \"s\": \"x,]}\\\"%i\", \"l\": [%i, {}]}",
+			i ? ", " : "", i, i, -i);
+		fredc_writer_put(&big_list, buf, n);
+		n = snprintf(buf, sizeof(buf), "%s\"k%i\": [%i, \"{\"]", i ? ", " : "", i % 59000, i);
+		fredc_writer_put(&big_obj, buf, n);
+	}
+	fredc_writer_put(&big_list, "]", 1);
+	fredc_writer_put(&big_obj, tail, strlen(tail));
+
+	fredc_writer* texts[] = { &big_list, &big_obj };
+	for (int t = 0; t < arr_len(texts); t++) {
+		str8 text = { texts[t]->data, texts[t]->length };
+		fredc_doc* serial = fredc_doc_parse(text.data, text.length);
+		str8 expected = fredc_val_to_str8(*serial->root, (fredc_write_opts){0});
+
+		unsigned flag_sets[] = { 0, FREDC_PARSE_INSITU, FREDC_PARSE_INTERN, FREDC_PARSE_INTERN_STRINGS };
+		for (int f = 0; f < arr_len(flag_sets); f++) {
+			unsigned flags = flag_sets[f];
+			fredc_doc* doc = fredc_doc_parse_parallel(text.data, text.length, flags, 4);
+			str8 out = fredc_val_to_str8(*doc->root, (fredc_write_opts){0});
+			if (!str8_cmp(expected, out)) {
+				fprintf(stderr, "parallel parse %i (flags %u) differs\n", t, flags);
+				failures++;
+			}
+			fredc_free(out.data);
+
+			// Atoms are shared across the whole document, not per worker
+			if (t == 0 && (flags & (FREDC_PARSE_INTERN | FREDC_PARSE_INTERN_STRINGS))) {
+				fredc_list* records = doc->root->list;
+				fredc_obj* first = records->data[0].object;
+				fredc_obj* last = records->data[records->length-1].object;
+				if (first->props[0].key.data != last->props[0].key.data || first->props[2].key.data != last->props[2].key.data) {
+					failures++;
+				}
+			}
+			if (t == 1 && (flags & FREDC_PARSE_INTERN_STRINGS)) {
+				fredc_obj* data = fredc_get_prop(doc->root->object, "data").object;
+				fredc_list* first = data->props[1000].val.list; // the first not overwritten by a later duplicate
+				fredc_list* last = data->props[data->length-1].val.list;
+				if (first->data[1].string.data != last->data[1].string.data) {
+					failures++;
+				}
+			}
+
+			if (t == 1) {
+				// Overwritten duplicates keep their first position, lookups use the stitched index
+				fredc_val data = fredc_get_prop(doc->root->object, "data");
+				fredc_val k5 = fredc_get_prop(data.object, "k5");
+				if (data.object->length != 59000 || k5.type != JSON_LIST || k5.list->data[0].integer != 59005) {
+					failures++;
+				}
+				fredc_set_prop(data.object, "added", (fredc_val){ .type = JSON_NULL });
+				if (fredc_get_prop(data.object, "added").type != JSON_NULL) {
+					failures++;
+				}
+			}
+			fredc_doc_free(doc);
+		}
+
+		fredc_free(expected.data);
+		fredc_doc_free(serial);
+	}
+
+	fredc_writer_free(&big_list);
+	fredc_writer_free(&big_obj);
+
+	printf("Parallel parse test: %i failures\n", failures);
+	return failures;
+}
+// Escapes are decoded by every parser and written back on output
+int escape_test(void) {
+	int failures = 0;
+	const char* text = "{\"k\\\"ey\": \"q\\\"b\\\\s\\/n\\nt\\tu\\u00e9p\\ud83d\\ude00x\\ud800y\", \"plain\": \"abc\"}";
+	const char decoded[] = "q\"b\\s/n\nt\tu\xc3\xa9p\xf0\x9f\x98\x80x\xef\xbf\xbdy";
+	const char* expected = "{\"k\\\"ey\":\"q\\\"b\\\\s/n\\nt\\tu\xc3\xa9p\xf0\x9f\x98\x80x\xef\xbf\xbdy\",\"plain\":\"abc\"}";
+	str8 want = { (char*)decoded, sizeof(decoded)-1 };
+	size_t len = strlen(text);
+
+	unsigned flags[] = { 0, FREDC_PARSE_INSITU, FREDC_PARSE_INTERN_STRINGS };
+	for (size_t f = 0; f < arr_len(flags); f++) {
+		fredc_doc* doc = fredc_doc_parse_ex(text, len, flags[f]);
+		fredc_val v = fredc_get_prop(doc->root->object, "k\"ey");
+		str8 out = fredc_val_to_str8(*doc->root, (fredc_write_opts){0});
+		if (v.type != JSON_STRING || !str8_cmp(v.string, want) || strcmp(out.data, expected) != 0) {
+			fprintf(stderr, "escape flags %u: %s\n", flags[f], out.data);
+			failures++;
+		}
+		// Strings without escapes are still borrowed in place
+		if ((flags[f] & FREDC_PARSE_INSITU) && fredc_get_prop(doc->root->object, "plain").string.data != strstr(text, "abc")) {
+			failures++;
+		}
+		fredc_free(out.data);
+		fredc_doc_free(doc);
+	}
+
+	fredc_val heap = fredc_parse_val(text, len);
+	if (!str8_cmp(fredc_get_prop(heap.object, "k\"ey").string, want)) {
+		failures++;
+	}
+	fredc_val_free(&heap);
+
+	// Split at every byte, so escapes straddle chunks
+	fredc_tree_builder builder = {};
+	fredc_sax sax;
+	fredc_sax_init(&sax, fredc_tree_builder_handler(&builder));
+	for (size_t i = 0; i < len; i++) {
+		fredc_sax_feed(&sax, text + i, 1);
+	}
+	fredc_sax_finish(&sax);
+	fredc_sax_free(&sax);
+	fredc_val streamed = fredc_tree_builder_finish(&builder);
+	if (!str8_cmp(fredc_get_prop(streamed.object, "k\"ey").string, want)) {
+		failures++;
+	}
+	fredc_val_free(&streamed);
+
+	fredc_lazy* lazy = fredc_lazy_parse(text, len);
+	if (fredc_lazy_type(fredc_lazy_get(fredc_lazy_root(lazy), "k\"ey")) != JSON_STRING) {
+		failures++;
+	}
+	fredc_lazy_free(lazy);
+
+	// Control characters come out as \u escapes, and parse back
+	char raw[] = "a\x01" "b\x1f" "c\"";
+	fredc_val ctl = { .type = JSON_STRING, .string = { raw, sizeof(raw)-1 } };
+	str8 out = fredc_val_to_str8(ctl, (fredc_write_opts){0});
+	fredc_doc* back = fredc_doc_parse(out.data, out.length);
+	if (strcmp(out.data, "\"a\\u0001b\\u001fc\\\"\"") != 0 || !str8_cmp(back->root->string, ctl.string)) {
+		fprintf(stderr, "control characters: %s\n", out.data);
+		failures++;
+	}
+	fredc_doc_free(back);
+	fredc_free(out.data);
+
+	// Decoding in place, with malformed escapes kept
+	char buf[] = "x\\u12zz\\q\\u0041";
+	size_t n = fredc_unescape(buf, strlen(buf), buf);
+	if (n != 10 || memcmp(buf, "x\\u12zz\\qA", n) != 0) {
+		failures++;
+	}
+
+	printf("Escape test: %i failures\n", failures);
+	return failures;
+}
+
+// Strict validation: what is accepted, and where the first error is found
+int validate_test(void) {
+	int failures = 0;
+	const char* valid[] = {
+		"0", "-0.5e+3", " [true, false, null] ", "{}", "[[]]",
+		"{\"a\": [1, {\"b\": null}], \"c\": \"\\u00e9\\n\xc3\xa9\xf0\x9f\x98\x80\"}",
+		"\"a string long enough to take the sixteen byte steps\"",
+	};
+	struct { const char* text; size_t offset; } invalid[] = {
+		{ "", 0 }, { "01", 1 }, { "[1,]", 3 }, { "{\"a\":1,}", 7 }, { "{\"a\" 1}", 5 },
+		{ "[1 2]", 3 }, { "\"\\x\"", 2 }, { "\"tab\there\"", 4 }, { "\"\xc0\xaf\"", 1 },
+		{ "\"\xed\xa0\x80\"", 1 }, { "tru", 0 }, { "1.", 2 }, { "{}x", 2 }, { "[", 1 },
+		{ "\"sixteen bytes and then some, unterminated", 42 }, { "{1:2}", 1 }, { "[1]]", 3 },
+	};
+
+	for (size_t i = 0; i < arr_len(valid); i++) {
+		if (!fredc_validate(valid[i], strlen(valid[i]), 0).valid) {
+			fprintf(stderr, "valid %zu rejected\n", i);
+			failures++;
+		}
+	}
+	for (size_t i = 0; i < arr_len(invalid); i++) {
+		fredc_validate_result r = fredc_validate(invalid[i].text, strlen(invalid[i].text), 0);
+		if (r.valid || r.error == 0 || r.offset != invalid[i].offset) {
+			fprintf(stderr, "invalid %zu: %s at %zu\n", i, r.error ? r.error : "accepted", r.offset);
+			failures++;
+		}
+	}
+
+	// Trailing commas are opt-in, and on for fredc_validate_json
+	if (!fredc_validate("[1,]", 4, FREDC_VALIDATE_TRAILING_COMMAS).valid ||
+		!fredc_validate("{\"a\":1,}", 8, FREDC_VALIDATE_TRAILING_COMMAS).valid ||
+		fredc_validate("[,]", 3, FREDC_VALIDATE_TRAILING_COMMAS).valid) {
+		failures++;
+	}
+
+	// Nesting is limited like in the parser
+	char deep[FREDC_MAX_DEPTH + 2];
+	memset(deep, '[', sizeof(deep));
+	fredc_validate_result r = fredc_validate(deep, sizeof(deep), 0);
+	if (r.valid || r.offset != FREDC_MAX_DEPTH) {
+		failures++;
+	}
+
+	printf("Validate test: %i failures\n", failures);
+	return failures;
+}
+
+// Allocator hooks see every allocation, and the stats add up
+typedef struct counting_allocator {
+	size_t allocs, reallocs, frees;
+	size_t bytes;
+} counting_allocator;
+
+static void* counting_alloc(void* user, size_t size) {
+	((counting_allocator*)user)->allocs++;
+	((counting_allocator*)user)->bytes += size;
+	return malloc(size);
+}
+
+static void* counting_realloc(void* user, void* ptr, size_t old_size, size_t new_size) {
+	((counting_allocator*)user)->reallocs++;
+	((counting_allocator*)user)->bytes += new_size - old_size;
+	return realloc(ptr, new_size);
+}
+
+static void counting_free(void* user, void* ptr) {
+	((counting_allocator*)user)->frees++;
+	free(ptr);
+}
+
+int alloc_test(void) {
+	int failures = 0;
+	counting_allocator counts = {0};
+
+	// Without an allocator results are plain C library blocks
+	const char* plain = "[1, \"two\", {}]";
+	fredc_val parsed = fredc_parse_val(plain, strlen(plain));
+	str8 text_out = fredc_val_to_str8(parsed, (fredc_write_opts){0});
+	if (strcmp(text_out.data, "[1,\"two\",{}]") != 0) {
+		failures++;
+	}
+	free(text_out.data);
+	fredc_val_free(&parsed);
+
+	// alloc and free only come in pairs
+	if (fredc_set_allocator(&(fredc_allocator){ counting_alloc, counting_realloc, 0, &counts }) ||
+		fredc_set_allocator(&(fredc_allocator){ 0, 0, counting_free, &counts }) || !fredc_set_allocator(0)) {
+		failures++;
+	}
+
+	if (!fredc_set_allocator(&(fredc_allocator){ counting_alloc, counting_realloc, counting_free, &counts })) {
+		failures++;
+	}
+	fredc_mem_stats before = fredc_mem_get_stats();
+
+	const char* text = "{\"a\": [1, 2, {\"b\": \"c\"}], \"d\": {\"e\": true}}";
+	fredc_val val = fredc_parse_val(text, strlen(text));
+	str8 out = fredc_val_to_str8(val, (fredc_write_opts){0});
+	fredc_free(out.data);
+
+	fredc_tree_stats tree = fredc_val_get_stats(val);
+	if (tree.objects != 3 || tree.lists != 1 || tree.strings != 1 || tree.scalars != 3 ||
+		tree.members != 7 || tree.string_bytes != 5 || tree.max_depth != 3) {
+		failures++;
+	}
+
+	fredc_mem_stats during = fredc_mem_get_stats();
+	if (counts.allocs == 0 || counts.allocs != during.allocations - before.allocations ||
+		counts.reallocs != during.reallocations - before.reallocations ||
+		during.bytes_live <= before.bytes_live || during.bytes_peak < during.bytes_live) {
+		failures++;
+	}
+
+	fredc_val_free(&val);
+	fredc_mem_stats after = fredc_mem_get_stats();
+	if (counts.allocs != counts.frees || after.live != before.live || after.bytes_live != before.bytes_live) {
+		failures++;
+	}
+
+	// Duplicate keys, escaped or not, keep the last value and free the other key copies
+	const char* dups = "{\"a\": 1, \"a\": 2, \"b\\n\": 3, \"b\\n\": 4, \"a\": {\"c\": 5, \"c\": 6}}";
+	val = fredc_parse_val(dups, strlen(dups));
+	if (val.object->length != 2 || fredc_get_prop(val.object, "b\n").integer != 4 ||
+		fredc_get_prop(fredc_get_prop(val.object, "a").object, "c").integer != 6) {
+		failures++;
+	}
+	fredc_val_free(&val);
+	after = fredc_mem_get_stats();
+	if (counts.allocs != counts.frees || after.live != before.live || after.bytes_live != before.bytes_live) {
+		failures++;
+	}
+	fredc_set_allocator(0);
+
+	// A healthy table stays under 3/4 full with short probes
+	char key[32];
+	fredc_obj obj = new_fredc_obj(0);
+	for (int i = 0; i < 5000; i++) {
+		snprintf(key, sizeof(key), "key%i", i);
+		fredc_set_prop(&obj, key, (fredc_val){ .type = JSON_INT, .integer = i });
+	}
+	fredc_obj_stats stats = fredc_obj_get_stats(&obj);
+	if (stats.length != 5000 || stats.index_cap < 5000 || stats.load > 0.75 ||
+		stats.max_probe < 1 || stats.mean_probe < 1 || stats.mean_probe > 4) {
+		failures++;
+	}
+	fredc_obj_free(&obj);
+
+	printf("Allocator test: %i failures\n", failures);
+	return failures;
+}
+
+
+// JSON Patch and Merge Patch, mostly the examples of RFC 6902 and RFC 7386,
+// applied to parsed documents and to heap copies of them
+typedef struct patch_case {
+	const char *doc, *patch, *expected;
+	int failed_op; // -1 if the patch applies
+} patch_case;
+
+static int patch_check(const patch_case* c, bool merge, bool heap) {
+	fredc_doc* doc = fredc_doc_parse(c->doc, strlen(c->doc));
+	fredc_doc* patch = fredc_doc_parse(c->patch, strlen(c->patch));
+	fredc_doc* expected = fredc_doc_parse(c->expected, strlen(c->expected));
+	fredc_val root = heap ? fredc_val_clone(*doc->root) : *doc->root;
+
+	int failures = 0;
+	if (merge) {
+		fredc_merge_patch(&root, *patch->root);
+	} else {
+		fredc_patch_result result = fredc_patch_apply(&root, *patch->root);
+		if (result.ok != (c->failed_op < 0) || (!result.ok && result.op != (size_t)c->failed_op)) {
+			fprintf(stderr, "patch %s: %s at op %zu\n", c->patch, result.error ? result.error : "ok", result.op);
+			failures++;
+		}
+	}
+	if (!fredc_val_equal(root, *expected->root)) {
+		str8 out = fredc_val_to_str8(root, (fredc_write_opts){0});
+		fprintf(stderr, "%s %s gave %s\n", c->doc, c->patch, out.data);
+		fredc_free(out.data);
+		failures++;
+	}
+
+	if (heap) {
+		fredc_val_free(&root);
+	}
+	fredc_doc_free(expected);
+	fredc_doc_free(patch);
+	fredc_doc_free(doc);
+	return failures;
+}
+
+int patch_test(void) {
+	int failures = 0;
+
+	const patch_case patches[] = {
+		{ "{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/baz\",\"value\":\"qux\"}]", "{\"baz\":\"qux\",\"foo\":\"bar\"}", -1 },
+		{ "{\"foo\":[\"bar\",\"baz\"]}", "[{\"op\":\"add\",\"path\":\"/foo/1\",\"value\":\"qux\"}]", "{\"foo\":[\"bar\",\"qux\",\"baz\"]}", -1 },
+		{ "{\"baz\":\"qux\",\"foo\":\"bar\"}", "[{\"op\":\"remove\",\"path\":\"/baz\"}]", "{\"foo\":\"bar\"}", -1 },
+		{ "{\"foo\":[\"bar\",\"qux\",\"baz\"]}", "[{\"op\":\"remove\",\"path\":\"/foo/1\"}]", "{\"foo\":[\"bar\",\"baz\"]}", -1 },
+		{ "{\"baz\":\"qux\",\"foo\":\"bar\"}", "[{\"op\":\"replace\",\"path\":\"/baz\",\"value\":\"boo\"}]", "{\"baz\":\"boo\",\"foo\":\"bar\"}", -1 },
+		{ "{\"foo\":{\"bar\":\"baz\",\"waldo\":\"fred\"},\"qux\":{\"corge\":\"grault\"}}",
+			"[{\"op\":\"move\",\"from\":\"/foo/waldo\",\"path\":\"/qux/thud\"}]",
+			"{\"foo\":{\"bar\":\"baz\"},\"qux\":{\"corge\":\"grault\",\"thud\":\"fred\"}}", -1 },
+		{ "{\"foo\":[\"all\",\"grass\",\"cows\",\"eat\"]}", "[{\"op\":\"move\",\"from\":\"/foo/1\",\"path\":\"/foo/3\"}]",
+			"{\"foo\":[\"all\",\"cows\",\"eat\",\"grass\"]}", -1 },
+		{ "{\"baz\":\"qux\",\"foo\":[\"a\",2,\"c\"]}",
+			"[{\"op\":\"test\",\"path\":\"/baz\",\"value\":\"qux\"},{\"op\":\"test\",\"path\":\"/foo/1\",\"value\":2.0}]",
+			"{\"baz\":\"qux\",\"foo\":[\"a\",2,\"c\"]}", -1 },
+		{ "{\"baz\":\"qux\"}", "[{\"op\":\"test\",\"path\":\"/baz\",\"value\":\"bar\"}]", "{\"baz\":\"qux\"}", 0 },
+		{ "{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/child\",\"value\":{\"grandchild\":{}}}]",
+			"{\"foo\":\"bar\",\"child\":{\"grandchild\":{}}}", -1 },
+		{ "{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/baz/bat\",\"value\":\"qux\"}]", "{\"foo\":\"bar\"}", 0 },
+		{ "{\"/\":9,\"~1\":10}", "[{\"op\":\"test\",\"path\":\"/~01\",\"value\":10},{\"op\":\"remove\",\"path\":\"/~1\"}]", "{\"~1\":10}", -1 },
+		{ "{\"/\":9,\"~1\":10}", "[{\"op\":\"test\",\"path\":\"/~01\",\"value\":\"10\"}]", "{\"/\":9,\"~1\":10}", 0 },
+		{ "{\"foo\":[\"bar\"]}", "[{\"op\":\"add\",\"path\":\"/foo/-\",\"value\":[\"abc\",\"def\"]}]", "{\"foo\":[\"bar\",[\"abc\",\"def\"]]}", -1 },
+		{ "{\"a\":{\"b\":1}}", "[{\"op\":\"copy\",\"from\":\"/a\",\"path\":\"/c\"},{\"op\":\"replace\",\"path\":\"/c/b\",\"value\":2}]",
+			"{\"a\":{\"b\":1},\"c\":{\"b\":2}}", -1 },
+		{ "{\"a\":{\"b\":1}}", "[{\"op\":\"copy\",\"from\":\"/a/b\",\"path\":\"\"}]", "1", -1 },
+		{ "{\"a\":1}", "[{\"op\":\"replace\",\"path\":\"\",\"value\":[1]}]", "[1]", -1 },
+		{ "{\"a\":{\"b\":1}}", "[{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/a/c\"}]", "{\"a\":{\"b\":1}}", 0 },
+		{ "{\"a\":[1,2]}", "[{\"op\":\"remove\",\"path\":\"/a/01\"}]", "{\"a\":[1,2]}", 0 },
+		{ "{\"a\":[1,2]}", "[{\"op\":\"replace\",\"path\":\"/a/2\",\"value\":3}]", "{\"a\":[1,2]}", 0 },
+		{ "{}", "[{\"op\":\"add\",\"path\":\"/x\",\"value\":1},{\"op\":\"remove\",\"path\":\"/nope\"}]", "{\"x\":1}", 1 },
+		{ "{}", "[{\"op\":\"frobnicate\",\"path\":\"/x\"}]", "{}", 0 },
+		{ "{\"d\":{\"x\":1},\"e\":2}", "[{\"op\":\"move\",\"from\":\"/d\",\"path\":\"/nope/x\"}]", "{\"d\":{\"x\":1},\"e\":2}", 0 },
+		{ "{\"a\":[1,2,3]}", "[{\"op\":\"move\",\"from\":\"/a/0\",\"path\":\"/a/9\"}]", "{\"a\":[1,2,3]}", 0 },
+		{ "{\"a\":[1,2,3],\"b\":5}", "[{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/b/c\"}]", "{\"a\":[1,2,3],\"b\":5}", 0 },
+		{ "{\"a\":1}", "[{\"op\":\"move\",\"from\":\"/zzz\",\"path\":\"/zzz\"}]", "{\"a\":1}", 0 },
+		{ "{\"a\":1}", "[{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/a\"}]", "{\"a\":1}", -1 },
+	};
+	for (int i = 0; i < arr_len(patches); i++) {
+		failures += patch_check(patches + i, false, false);
+		failures += patch_check(patches + i, false, true);
+	}
+
+	const patch_case merges[] = {
+		{ "{\"a\":\"b\"}", "{\"a\":\"c\"}", "{\"a\":\"c\"}" },
+		{ "{\"a\":\"b\"}", "{\"b\":\"c\"}", "{\"a\":\"b\",\"b\":\"c\"}" },
+		{ "{\"a\":\"b\"}", "{\"a\":null}", "{}" },
+		{ "{\"a\":\"b\",\"b\":\"c\"}", "{\"a\":null}", "{\"b\":\"c\"}" },
+		{ "{\"a\":[\"b\"]}", "{\"a\":\"c\"}", "{\"a\":\"c\"}" },
+		{ "{\"a\":\"c\"}", "{\"a\":[\"b\"]}", "{\"a\":[\"b\"]}" },
+		{ "{\"a\":{\"b\":\"c\"}}", "{\"a\":{\"b\":\"d\",\"c\":null}}", "{\"a\":{\"b\":\"d\"}}" },
+		{ "{\"a\":[{\"b\":\"c\"}]}", "{\"a\":[1]}", "{\"a\":[1]}" },
+		{ "[\"a\",\"b\"]", "[\"c\",\"d\"]", "[\"c\",\"d\"]" },
+		{ "{\"a\":\"b\"}", "[\"c\"]", "[\"c\"]" },
+		{ "{\"a\":\"foo\"}", "null", "null" },
+		{ "{\"a\":\"foo\"}", "\"bar\"", "\"bar\"" },
+		{ "{\"e\":null}", "{\"a\":1}", "{\"e\":null,\"a\":1}" },
+		{ "[1,2]", "{\"a\":\"b\",\"c\":null}", "{\"a\":\"b\"}" },
+		{ "{}", "{\"a\":{\"bb\":{\"ccc\":null}}}", "{\"a\":{\"bb\":{}}}" },
+	};
+	for (int i = 0; i < arr_len(merges); i++) {
+		failures += patch_check(merges + i, true, false);
+		failures += patch_check(merges + i, true, true);
+	}
+
+	// Large containers keep their output, changes drop it along their path
+	fredc_writer text = {};
+	fredc_writer_put(&text, "{\"meta\":{\"v\":1},\"items\":[", 25);
+	for (int i = 0; i < 500; i++) {
+		char buf[64];
+		fredc_writer_put(&text, buf, snprintf(buf, sizeof(buf), "%s{\"id\":%d,\"name\":\"item\"}", i ? "," : "", i));
+	}
+	fredc_writer_put(&text, "]}", 2);
+	fredc_doc* doc = fredc_doc_parse(text.data, text.length);
+	fredc_obj* root = doc->root->object;
+	fredc_list* items = fredc_get_prop(root, "items").list;
+
+	fredc_writer first = {};
+	fredc_val_write(&first, *doc->root, (fredc_write_opts){ .cache = true });
+	if (root->cache != 0 || items->cache == 0 || fredc_get_prop(root, "meta").object->cache != 0 ||
+		first.length != text.length || memcmp(first.data, text.data, text.length) != 0) {
+		failures++;
+	}
+
+	if (fredc_pointer_get(*doc->root, "/items/7/name").type != JSON_STRING ||
+		fredc_pointer_get(*doc->root, "/items/500").type != JSON_UNDEFINED ||
+		fredc_pointer_get(*doc->root, "items").type != JSON_UNDEFINED) {
+		failures++;
+	}
+
+	const char* change = "[{\"op\":\"replace\",\"path\":\"/items/7/name\",\"value\":\"seven\"}]";
+	fredc_doc* patch = fredc_doc_parse(change, strlen(change));
+	if (!fredc_patch_apply(doc->root, *patch->root).ok || root->cache != 0 || items->cache != 0) {
+		failures++;
+	}
+	fredc_doc_free(patch);
+
+	fredc_val copy = fredc_val_clone(*doc->root);
+	str8 cached = fredc_val_to_str8(*doc->root, (fredc_write_opts){ .cache = true });
+	str8 fresh = fredc_val_to_str8(copy, (fredc_write_opts){0});
+	if (!str8_cmp(cached, fresh) || strstr(fresh.data, "\"seven\"") == 0 || items->cache == 0) {
+		failures++;
+	}
+	fredc_free(cached.data);
+	fredc_free(fresh.data);
+	fredc_val_free(&copy);
+
+	// Direct edits are only seen once the container is touched
+	items->data[0] = (fredc_val){ .type = JSON_INT, .integer = 42 };
+	fredc_val_touch(fredc_get_prop(root, "items"));
+	cached = fredc_val_to_str8(*doc->root, (fredc_write_opts){ .cache = true });
+	if (strstr(cached.data, "\"items\":[42,{") == 0) {
+		failures++;
+	}
+	fredc_free(cached.data);
+
+	fredc_writer_free(&first);
+	fredc_writer_free(&text);
+	fredc_doc_free(doc);
+
+	printf("Patch test: %i failures\n", failures);
+	return failures;
+}
+
+// Content hashes ignore member order, and diffs turn one document into the
+// other with as few operations as the matching allows
+int diff_test(void) {
+	int failures = 0;
+
+	const char* same[][2] = {
+		{ "{\"a\":1,\"b\":[true,null,\"x\"]}", "{\"b\":[true,null,\"x\"],\"a\":1.0}" },
+		{ "[0,-0.0,1e2]", "[0,0,100]" },
+		{ "{}", "{}" },
+	};
+	for (int i = 0; i < arr_len(same); i++) {
+		fredc_val a = fredc_parse_val(same[i][0], strlen(same[i][0]));
+		fredc_val b = fredc_parse_val(same[i][1], strlen(same[i][1]));
+		if (fredc_val_hash(a) != fredc_val_hash(b) || !fredc_val_equal(a, b)) {
+			fprintf(stderr, "%s and %s should be equal\n", same[i][0], same[i][1]);
+			failures++;
+		}
+		fredc_val_free(&a);
+		fredc_val_free(&b);
+	}
+
+	fredc_val big = { .type = JSON_INT, .integer = (1ll << 53) + 1 };
+	fredc_val rounded = { .type = JSON_NUM, .number = (double)(1ll << 53) };
+	if (fredc_val_equal(big, rounded) || fredc_val_hash(big) == fredc_val_hash(rounded)) {
+		failures++;
+	}
+
+	const struct { const char *from, *to; size_t ops; } diffs[] = {
+		{ "{\"a\":1,\"b\":{\"c\":[1,2,3]}}", "{\"a\":1,\"b\":{\"c\":[1,2,3]}}", 0 },
+		{ "{\"a\":1,\"b\":2}", "{\"b\":2,\"a\":1}", 0 },
+		{ "{\"a\":1,\"b\":{\"c\":[1,2,3],\"d\":\"x\"}}", "{\"a\":1,\"b\":{\"c\":[1,2,3],\"d\":\"y\"}}", 1 },
+		{ "{\"a\":1,\"gone\":true}", "{\"a\":1,\"new\":{\"x\":[]}}", 2 },
+		{ "[1,2,3,4,5]", "[1,2,9,4,5]", 1 },
+		{ "[1,2,3,4,5]", "[1,2,4,5]", 1 },
+		{ "[1,2,3]", "[0,1,2,3]", 1 },
+		{ "[1,2,3]", "[1,7,8,3]", 2 },
+		{ "[1,2,3,4]", "[1,4]", 2 },
+		{ "{\"a/b\":{\"~\":1}}", "{\"a/b\":{\"~\":2}}", 1 },
+		{ "{\"a\":[1]}", "[1]", 1 },
+		{ "[{\"id\":1,\"tags\":[\"a\"]},{\"id\":2}]", "[{\"id\":1,\"tags\":[\"a\",\"b\"]},{\"id\":2}]", 1 },
+	};
+	for (int i = 0; i < arr_len(diffs); i++) {
+		fredc_doc* from = fredc_doc_parse(diffs[i].from, strlen(diffs[i].from));
+		fredc_doc* to = fredc_doc_parse(diffs[i].to, strlen(diffs[i].to));
+		fredc_val patch = fredc_diff(*from->root, *to->root);
+		fredc_patch_result result = fredc_patch_apply(from->root, patch);
+		if (patch.list->length != diffs[i].ops || !result.ok || !fredc_val_equal(*from->root, *to->root)) {
+			str8 out = fredc_val_to_str8(patch, (fredc_write_opts){0});
+			fprintf(stderr, "diff %s -> %s: %s\n", diffs[i].from, diffs[i].to, out.data);
+			fredc_free(out.data);
+			failures++;
+		}
+		fredc_val_free(&patch);
+		fredc_doc_free(to);
+		fredc_doc_free(from);
+	}
+
+	// Hashes follow changes made through the library
+	const char* text = "{\"a\":{\"b\":[1,2]}}";
+	fredc_doc* doc = fredc_doc_parse(text, strlen(text));
+	fredc_val copy = fredc_val_clone(*doc->root);
+	uint64_t before = fredc_val_hash(*doc->root);
+	fredc_set_prop_js(doc->root->object, "a.b[1]", (fredc_val){ .type = JSON_INT, .integer = 3 });
+	if (fredc_val_hash(*doc->root) == before || fredc_val_equal(*doc->root, copy)) {
+		failures++;
+	}
+	fredc_set_prop_js(doc->root->object, "a.b[1]", (fredc_val){ .type = JSON_INT, .integer = 2 });
+	if (fredc_val_hash(*doc->root) != before || !fredc_val_equal(*doc->root, copy)) {
+		failures++;
+	}
+	fredc_val_free(&copy);
+	fredc_doc_free(doc);
+
+	// Edits through a child reached with fredc_get_prop reach every parent,
+	// as do edits below a container with cached output
+	text = "{\"a\":{\"b\":{\"c\":1},\"big\":[\"xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx\"]}}";
+	fredc_val root = fredc_parse_val(text, strlen(text));
+	fredc_val wide = fredc_get_prop(fredc_get_prop(root.object, "a").object, "big");
+	for (int i = 0; i < 1000; i++) {
+		fredc_list_insert(wide.list, 0, (fredc_val){ .type = JSON_INT, .integer = i });
+	}
+	copy = fredc_val_clone(root);
+	before = fredc_val_hash(root);
+	str8 warm = fredc_val_to_str8(root, (fredc_write_opts){ .cache = true });
+	fredc_obj* b = fredc_get_prop(fredc_get_prop(root.object, "a").object, "b").object;
+	fredc_set_prop(b, "c", (fredc_val){ .type = JSON_INT, .integer = 2 });
+	fredc_list_take(wide.list, 0);
+
+	fredc_val patch = fredc_diff(copy, root);
+	str8 out = fredc_val_to_str8(root, (fredc_write_opts){ .cache = true });
+	fredc_val fresh = fredc_val_clone(root);
+	str8 expected = fredc_val_to_str8(fresh, (fredc_write_opts){0});
+	if (fredc_val_hash(root) == before || fredc_val_equal(root, copy) || patch.list->length != 2 ||
+		wide.list->cache || strcmp(out.data, expected.data) != 0 || strcmp(out.data, warm.data) == 0) {
+		fprintf(stderr, "nested edit: %s\n", out.data);
+		failures++;
+	}
+	fredc_free(warm.data);
+	fredc_free(out.data);
+	fredc_free(expected.data);
+	fredc_val_free(&patch);
+	fredc_val_free(&fresh);
+	fredc_val_free(&copy);
+	fredc_val_free(&root);
+
+	printf("Diff test: %i failures\n", failures);
+	return failures;
+}
+
+// Snapshots keep their contents while the tree they were taken from changes,
+// and share every container the changes did not reach
+typedef struct share_job {
+	fredc_val snapshot, older;
+	const char* expected;
+	const char* expected_diff;
+	uint64_t hash;
+	int failures;
+} share_job;
+
+// Hashes, diffs and cached writes leave the storage the readers share alone
+static void* share_reader(void* arg) {
+	share_job* job = (share_job*)arg;
+	if (fredc_get_prop(job->snapshot.object, "a").type != JSON_OBJ || fredc_val_hash(job->snapshot) != job->hash) {
+		job->failures++;
+	}
+	fredc_val patch = fredc_diff(job->older, job->snapshot);
+	str8 diff = fredc_val_to_str8(patch, (fredc_write_opts){0});
+	if (strcmp(diff.data, job->expected_diff) != 0) {
+		job->failures++;
+	}
+	fredc_free(diff.data);
+	fredc_val_free(&patch);
+
+	for (int i = 0; i < 200; i++) {
+		str8 out = fredc_val_to_str8(job->snapshot, (fredc_write_opts){ .cache = true });
+		if (strcmp(out.data, job->expected) != 0) {
+			job->failures++;
+		}
+		fredc_free(out.data);
+	}
+	fredc_val_free(&job->snapshot);
+	fredc_val_free(&job->older);
+	return 0;
+}
+
+int share_test(void) {
+	int failures = 0;
+	const char* text = "{\"a\":{\"b\":[1,2,{\"c\":\"x\"}]},\"other\":{\"d\":[true,null],\"e\":\"y\"},\"n\":1}";
+	fredc_val live = fredc_parse_val(text, strlen(text));
+	fredc_val snap = fredc_val_share(live);
+
+	fredc_set_prop_js(live.object, "a.b[2].c", (fredc_val){ .type = JSON_INT, .integer = 9 });
+	fredc_set_prop(live.object, "n", (fredc_val){ .type = JSON_NULL });
+	fredc_obj_remove(fredc_get_prop(live.object, "a").object, "missing");
+
+	str8 before = fredc_val_to_str8(snap, (fredc_write_opts){0});
+	str8 after = fredc_val_to_str8(live, (fredc_write_opts){0});
+	if (strcmp(before.data, text) != 0 ||
+		strcmp(after.data, "{\"a\":{\"b\":[1,2,{\"c\":9}]},\"other\":{\"d\":[true,null],\"e\":\"y\"},\"n\":null}") != 0) {
+		fprintf(stderr, "snapshot %s, live %s\n", before.data, after.data);
+		failures++;
+	}
+	fredc_free(before.data);
+	fredc_free(after.data);
+
+	// Lookups on a shared tree copy nothing: what they return is a view of
+	// storage both trees see, changed through the root or once its parent is
+	// one's own
+	fredc_val tree = fredc_parse_val(text, strlen(text));
+	fredc_val nested = fredc_val_share(tree);
+	fredc_path path = fredc_path_compile("a.b[2].c");
+	fredc_mem_stats mem = fredc_mem_get_stats();
+	fredc_val a = fredc_get_prop(nested.object, "a");
+	fredc_val c = fredc_path_get(nested, &path);
+	fredc_val other = fredc_get_prop(nested.object, "other");
+	if (fredc_mem_get_stats().allocations != mem.allocations || a.object != fredc_get_prop(tree.object, "a").object ||
+		c.type != JSON_STRING || other.object != fredc_get_prop(tree.object, "other").object) {
+		failures++;
+	}
+	fredc_path_free(&path);
+
+	fredc_set_prop_js(tree.object, "a.b", (fredc_val){ .type = JSON_INT, .integer = 99 });
+	fredc_val_touch(tree);
+	fredc_val_touch(fredc_get_prop(tree.object, "other"));
+	fredc_list_take(fredc_get_prop_js(tree.object, "other.d").list, 0);
+	fredc_val_touch(nested);
+	fredc_set_prop(fredc_get_prop(nested.object, "other").object, "e", (fredc_val){ .type = JSON_NULL });
+	before = fredc_val_to_str8(nested, (fredc_write_opts){0});
+	after = fredc_val_to_str8(tree, (fredc_write_opts){0});
+	if (strcmp(before.data, "{\"a\":{\"b\":[1,2,{\"c\":\"x\"}]},\"other\":{\"d\":[true,null],\"e\":null},\"n\":1}") != 0 ||
+		strcmp(after.data, "{\"a\":{\"b\":99},\"other\":{\"d\":[null],\"e\":\"y\"},\"n\":1}") != 0) {
+		fprintf(stderr, "nested edits: snapshot %s, live %s\n", before.data, after.data);
+		failures++;
+	}
+	fredc_free(before.data);
+	fredc_free(after.data);
+	fredc_val_free(&nested);
+	fredc_val_free(&tree);
+
+	// Only the changed path was copied
+	fredc_obj* other_live = fredc_get_prop(live.object, "other").object;
+	fredc_obj* other_snap = fredc_get_prop(snap.object, "other").object;
+	if (other_live->props != other_snap->props || live.object->props == snap.object->props ||
+		!fredc_val_equal(fredc_get_prop(live.object, "other"), fredc_get_prop(snap.object, "other"))) {
+		failures++;
+	}
+
+	// Patches copy on write too, and either side may be freed first
+	fredc_val second = fredc_val_share(live);
+	const char* change = "[{\"op\":\"remove\",\"path\":\"/other/d/0\"},{\"op\":\"add\",\"path\":\"/a/b/-\",\"value\":3}]";
+	fredc_doc* patch = fredc_doc_parse(change, strlen(change));
+	fredc_patch_apply(&second, *patch->root);
+	fredc_doc_free(patch);
+	patch = fredc_doc_parse("{\"other\":null}", 14);
+	fredc_merge_patch(&live, *patch->root);
+	fredc_doc_free(patch);
+	fredc_val_free(&snap);
+
+	after = fredc_val_to_str8(second, (fredc_write_opts){0});
+	if (strcmp(after.data, "{\"a\":{\"b\":[1,2,{\"c\":9},3]},\"other\":{\"d\":[null],\"e\":\"y\"},\"n\":null}") != 0 ||
+		fredc_get_prop(live.object, "other").type != JSON_UNDEFINED) {
+		fprintf(stderr, "shared patch: %s\n", after.data);
+		failures++;
+	}
+	fredc_free(after.data);
+	fredc_val_free(&second);
+
+	// Readers on other threads while the tree keeps changing, with a member
+	// large enough to be cached
+	fredc_writer big = {};
+	fredc_writer_put(&big, "[0", 2);
+	for (int i = 1; i < 1000; i++) {
+		char buf[16];
+		fredc_writer_put(&big, buf, snprintf(buf, sizeof(buf), ",%i", i));
+	}
+	fredc_writer_put(&big, "]", 1);
+	fredc_set_prop(live.object, "big", fredc_parse_val(big.data, big.length));
+	fredc_writer_free(&big);
+	fredc_val older = fredc_val_share(live);
+	fredc_set_prop_js(live.object, "a.b[1]", (fredc_val){ .type = JSON_INT, .integer = 5 });
+
+	str8 expected = fredc_val_to_str8(live, (fredc_write_opts){0});
+	uint64_t hash = fredc_val_hash(live);
+	pthread_t threads[4];
+	share_job jobs[4];
+	for (int t = 0; t < 4; t++) {
+		jobs[t] = (share_job){ fredc_val_share(live), fredc_val_share(older), expected.data,
+			"[{\"op\":\"replace\",\"path\":\"/a/b/1\",\"value\":5}]", hash };
+		pthread_create(threads + t, 0, share_reader, jobs + t);
+	}
+	for (int i = 0; i < 1000; i++) {
+		fredc_set_prop_js(live.object, "a.b[0]", (fredc_val){ .type = JSON_INT, .integer = i });
+	}
+	for (int t = 0; t < 4; t++) {
+		pthread_join(threads[t], 0);
+		failures += jobs[t].failures;
+	}
+	fredc_free(expected.data);
+	fredc_val_free(&older);
+	fredc_val_free(&live);
+
+	// Document containers are copied to the heap instead
+	fredc_doc* doc = fredc_doc_parse(text, strlen(text));
+	fredc_val copy = fredc_val_share(*doc->root);
+	fredc_doc_free(doc);
+	before = fredc_val_to_str8(copy, (fredc_write_opts){0});
+	if (strcmp(before.data, text) != 0) {
+		failures++;
+	}
+	fredc_free(before.data);
+	fredc_val_free(&copy);
+
+	printf("Share test: %i failures\n", failures);
+	return failures;
+}
+
+// Packed lists read, write, reduce and change like regular ones
+int pack_test(void) {
+	int failures = 0;
+
+	const struct { const char* text; unsigned char packed; } lists[] = {
+		{ "[1,2,-3,4,5,6,7,8,9]", JSON_INT },
+		{ "[1.5,2,-3e2,0.25,7]", JSON_NUM },
+		{ "[true,false,true,true,false,true,true,true,true,true,true,true,true,true,true,true,false]", JSON_BOOL },
+		{ "[1,9007199254740993,2.5]", 0 },
+		{ "[1,true]", 0 },
+		{ "[1,null]", 0 },
+		{ "[]", 0 },
+	};
+	for (int i = 0; i < arr_len(lists); i++) {
+		const char* text = lists[i].text;
+		fredc_doc* plain = fredc_doc_parse(text, strlen(text));
+		fredc_doc* doc = fredc_doc_parse_ex(text, strlen(text), FREDC_PARSE_PACK);
+		fredc_list* list = doc->root->list;
+		str8 expected = fredc_val_to_str8(*plain->root, (fredc_write_opts){0});
+		str8 out = fredc_val_to_str8(*doc->root, (fredc_write_opts){0});
+		str8 pretty = fredc_val_to_str8(*doc->root, (fredc_write_opts){ .indent = 2 });
+		str8 pretty_expected = fredc_val_to_str8(*plain->root, (fredc_write_opts){ .indent = 2 });
+		if (list->packed != lists[i].packed || !str8_cmp(expected, out) || !str8_cmp(pretty, pretty_expected) ||
+			!fredc_val_equal(*doc->root, *plain->root) || fredc_val_hash(*doc->root) != fredc_val_hash(*plain->root)) {
+			fprintf(stderr, "packed %s: %s\n", text, out.data);
+			failures++;
+		}
+		fredc_free(expected.data);
+		fredc_free(out.data);
+		fredc_free(pretty.data);
+		fredc_free(pretty_expected.data);
+
+		// Reductions agree with the unpacked list
+		fredc_list* ref = plain->root->list;
+		fredc_val one = { .type = JSON_INT, .integer = 1 };
+		fredc_val yes = { .type = JSON_BOOL, .boolean = true };
+		double sum = fredc_list_sum(list), min = fredc_list_min(list), max = fredc_list_max(list);
+		if (sum != fredc_list_sum(ref) || (min != fredc_list_min(ref) && !(isnan(min) && isnan(fredc_list_min(ref)))) ||
+			(max != fredc_list_max(ref) && !(isnan(max) && isnan(fredc_list_max(ref)))) ||
+			fredc_list_count(list, one) != fredc_list_count(ref, one) ||
+			fredc_list_count(list, yes) != fredc_list_count(ref, yes)) {
+			fprintf(stderr, "packed reductions of %s\n", text);
+			failures++;
+		}
+		fredc_doc_free(plain);
+		fredc_doc_free(doc);
+	}
+
+	const char* text = "{\"xs\":[3,1,4,1,5,9,2,6,5,3,5],\"ds\":[0.5,-1,2.25,1]}";
+	fredc_doc* doc = fredc_doc_parse_ex(text, strlen(text), FREDC_PARSE_PACK);
+	fredc_list* xs = fredc_get_prop(doc->root->object, "xs").list;
+	fredc_list* ds = fredc_get_prop(doc->root->object, "ds").list;
+	if (fredc_list_sum(xs) != 44 || fredc_list_min(xs) != 1 || fredc_list_max(xs) != 9 ||
+		fredc_list_count(xs, (fredc_val){ .type = JSON_INT, .integer = 5 }) != 3 ||
+		fredc_list_count(xs, (fredc_val){ .type = JSON_NUM, .number = 1.0 }) != 2 ||
+		fredc_list_count(xs, (fredc_val){ .type = JSON_NUM, .number = 1.5 }) != 0 ||
+		fredc_list_sum(ds) != 2.75 || fredc_list_min(ds) != -1 || fredc_list_max(ds) != 2.25 ||
+		fredc_list_count(ds, (fredc_val){ .type = JSON_INT, .integer = 1 }) != 1 ||
+		fredc_list_get(ds, 1).type != JSON_NUM || fredc_list_get(ds, 4).type != JSON_UNDEFINED ||
+		fredc_pointer_get(*doc->root, "/xs/5").integer != 9) {
+		failures++;
+	}
+
+	// Shared and cloned copies keep the packed storage until changed
+	fredc_val clone = fredc_val_clone(*doc->root);
+	fredc_val snap = fredc_val_share(clone);
+	if (fredc_get_prop(snap.object, "xs").list->packed != JSON_INT) {
+		failures++;
+	}
+	const char* change = "[{\"op\":\"replace\",\"path\":\"/xs/0\",\"value\":\"three\"},{\"op\":\"test\",\"path\":\"/ds/2\",\"value\":2.25}]";
+	fredc_doc* patch = fredc_doc_parse(change, strlen(change));
+	fredc_patch_result result = fredc_patch_apply(&clone, *patch->root);
+	fredc_doc_free(patch);
+	fredc_set_prop_js(doc->root->object, "ds[0]", (fredc_val){ .type = JSON_NULL });
+
+	str8 live = fredc_val_to_str8(clone, (fredc_write_opts){0});
+	str8 before = fredc_val_to_str8(snap, (fredc_write_opts){0});
+	str8 changed = fredc_val_to_str8(*doc->root, (fredc_write_opts){0});
+	if (!result.ok || strcmp(before.data, text) != 0 ||
+		strcmp(live.data, "{\"xs\":[\"three\",1,4,1,5,9,2,6,5,3,5],\"ds\":[0.5,-1,2.25,1]}") != 0 ||
+		strcmp(changed.data, "{\"xs\":[3,1,4,1,5,9,2,6,5,3,5],\"ds\":[null,-1,2.25,1]}") != 0 ||
+		fredc_get_prop(clone.object, "xs").list->packed || ds->packed) {
+		fprintf(stderr, "packed changes: %s, %s, %s\n", live.data, before.data, changed.data);
+		failures++;
+	}
+	fredc_free(live.data);
+	fredc_free(before.data);
+	fredc_free(changed.data);
+	fredc_val_free(&snap);
+	fredc_val_free(&clone);
+	fredc_doc_free(doc);
+
+	// Lists split across parallel jobs are packed once stitched
+	fredc_writer big = {};
+	char buf[64];
+	fredc_writer_put(&big, "[", 1);
+	double expected_sum = 0;
+	for (int i = 0; i < 200000; i++) {
+		int n = snprintf(buf, sizeof(buf), "%s%i.5", i ? "," : "", i % 1000);
+		fredc_writer_put(&big, buf, n);
+		expected_sum += i % 1000 + 0.5;
+	}
+	fredc_writer_put(&big, "]", 1);
+	fredc_doc* serial = fredc_doc_parse(big.data, big.length);
+	fredc_doc* parallel = fredc_doc_parse_parallel(big.data, big.length, FREDC_PARSE_PACK, 4);
+	str8 expected = fredc_val_to_str8(*serial->root, (fredc_write_opts){0});
+	str8 out = fredc_val_to_str8(*parallel->root, (fredc_write_opts){0});
+	if (parallel->root->list->packed != JSON_NUM || !str8_cmp(expected, out) ||
+		fredc_list_sum(parallel->root->list) != expected_sum ||
+		fredc_list_count(parallel->root->list, (fredc_val){ .type = JSON_NUM, .number = 999.5 }) != 200) {
+		failures++;
+	}
+	fredc_free(expected.data);
+	fredc_free(out.data);
+	fredc_doc_free(parallel);
+	fredc_doc_free(serial);
+	fredc_writer_free(&big);
+
+	printf("Pack test: %i failures\n", failures);
+	return failures;
+}
+
+// Compact, fixed buffer, measured and FILE* output must all agree
+int writer_test(void) {
+	int failures = 0;
+	const char* src = json_strs[4];
+	const char* expected = "{\"list-o\":[{\"a\":1,\"b\":[true,false]},{\"c\":\"}{][,:\"}],"
+		"\"list-l\":[[1,2],[],[[null]]],\"str-o\":{\"d\":\"{\\\"e\\\": [1]}\"},\"zero\":0}";
+
+	fredc_doc* doc = fredc_doc_parse(src, strlen(src));
+	fredc_write_opts compact = {0};
+
+	str8 out = fredc_val_to_str8(*doc->root, compact);
+	if (strcmp(out.data, expected) != 0 || out.length != fredc_val_measure(*doc->root, compact)) {
+		fprintf(stderr, "compact output: %s\n", out.data);
+		failures++;
+	}
+
+	char small[16];
+	fredc_writer fixed = fredc_writer_buf(small, sizeof(small));
+	if (fredc_val_write(&fixed, *doc->root, compact) != out.length || strncmp(small, expected, 15) || small[15]) {
+		failures++;
+	}
+
+	FILE* file = tmpfile();
+	fredc_writer fw = fredc_writer_file(file);
+	fredc_val_write(&fw, *doc->root, compact);
+	fredc_writer_free(&fw);
+	char file_buf[256] = {};
+	rewind(file);
+	size_t read = fread(file_buf, 1, sizeof(file_buf)-1, file);
+	if (read != out.length || strcmp(file_buf, expected) != 0) {
+		failures++;
+	}
+	fclose(file);
+
+	fredc_free(out.data);
+	fredc_doc_free(doc);
+
+	printf("Writer test: %i failures\n", failures);
+	return failures;
+}
+
+// A mapped file parsed in place must serialize like a copying parse
+int insitu_test(void) {
+	int failures = 0;
+	const char* src = json_strs[4];
+
+	char path[] = "/tmp/fredc_insitu_XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0 || write(fd, src, strlen(src)) != (ssize_t)strlen(src)) {
+		printf("In-situ test: could not create %s\n", path);
+		return 1;
+	}
+	close(fd);
+
+	fredc_file file;
+	if (!fredc_file_open(&file, path) || file.contents.length != strlen(src)) {
+		unlink(path);
+		printf("In-situ test: 1 failures\n");
+		return 1;
+	}
+
+	fredc_doc* copied = fredc_doc_parse(src, strlen(src));
+	fredc_doc* insitu = fredc_doc_parse_ex(file.contents.data, file.contents.length, FREDC_PARSE_INSITU);
+
+	str8 expected = fredc_val_to_str8(*copied->root, (fredc_write_opts){0});
+	str8 out = fredc_val_to_str8(*insitu->root, (fredc_write_opts){0});
+	if (!str8_cmp(expected, out)) {
+		fprintf(stderr, "in-situ output: %s\n", out.data);
+		failures++;
+	}
+
+	fredc_node* node = fredc_get_node(insitu->root->object, (str8){ "zero", 4 });
+	if (!node || node->key.data < file.contents.data || node->key.data >= file.contents.data + file.contents.length) {
+		failures++;
+	}
+	if (fredc_doc_get_stats(insitu).bytes_used >= fredc_doc_get_stats(copied).bytes_used) {
+		failures++;
+	}
+
+	fredc_free(expected.data);
+	fredc_free(out.data);
+	fredc_doc_free(copied);
+	fredc_doc_free(insitu);
+	fredc_file_close(&file);
+	unlink(path);
+
+	printf("In-situ test: %i failures\n", failures);
+	return failures;
 }
 
 int main(void) {
@@ -96,17 +1587,136 @@ int main(void) {
 		}
 	}
 
+	int failures = 0;
 	char label[64];
 	for (int i = 0; i < num_objects; i++) {
 		snprintf(label, arr_len(label), "obj_%i", i+1);
 		if (!validate_fredc_obj(objects + i, label)) {
 			fprintf(stderr, "obj_%i validation FAIL\n", i+1);
+			failures++;
+		}
+	}
+
+	for (int i = 0; i < num_objects; i++) {
+		len = strlen(json_strs[i]);
+		fredc_doc* doc = fredc_doc_parse(json_strs[i], len);
+		str8 doc_str = fredc_val_str8ify(*doc->root, 0);
+		str8 obj_str = fredc_obj_str8ify(objects[i]);
+		if (!str8_cmp(doc_str, obj_str)) {
+			fprintf(stderr, "doc_%i stringify FAIL\n", i+1);
+			failures++;
 		}
+
+		fredc_doc_stats stats = fredc_doc_get_stats(doc);
+		printf("doc_%i: %zu bytes used, %zu reserved, %zu allocations, %llu ns\n",
+			i+1, stats.bytes_used, stats.bytes_reserved, stats.allocations, stats.parse_ns);
+		fredc_doc_free(doc);
 		fredc_obj_free(objects +i);
 	}
+	free(objects);
+
+	if (index_test()) {
+		fprintf(stderr, "structural index test FAIL\n");
+		failures++;
+	}
+
+	if (sax_test()) {
+		fprintf(stderr, "SAX test FAIL\n");
+		failures++;
+	}
+
+	if (lazy_test()) {
+		fprintf(stderr, "lazy document test FAIL\n");
+		failures++;
+	}
+
+	if (number_test()) {
+		fprintf(stderr, "number test FAIL\n");
+		failures++;
+	}
+
+	if (writer_test()) {
+		fprintf(stderr, "writer test FAIL\n");
+		failures++;
+	}
+
+	if (insitu_test()) {
+		fprintf(stderr, "in-situ parse test FAIL\n");
+		failures++;
+	}
+
+	if (small_object_test()) {
+		fprintf(stderr, "small object test FAIL\n");
+		failures++;
+	}
+
+	if (large_object_test()) {
+		fprintf(stderr, "large object test FAIL\n");
+		failures++;
+	}
+
+	if (path_test()) {
+		fprintf(stderr, "path test FAIL\n");
+		failures++;
+	}
+
+	if (intern_test()) {
+		fprintf(stderr, "intern test FAIL\n");
+		failures++;
+	}
+
+	if (bin_test()) {
+		fprintf(stderr, "binary format test FAIL\n");
+		failures++;
+	}
+
+	if (parallel_test()) {
+		fprintf(stderr, "parallel parse test FAIL\n");
+		failures++;
+	}
+
+	if (escape_test()) {
+		fprintf(stderr, "escape test FAIL\n");
+		failures++;
+	}
+
+	if (validate_test()) {
+		fprintf(stderr, "validate test FAIL\n");
+		failures++;
+	}
+
+	if (patch_test()) {
+		fprintf(stderr, "patch test FAIL\n");
+		failures++;
+	}
+
+	if (diff_test()) {
+		fprintf(stderr, "diff test FAIL\n");
+		failures++;
+	}
+
+	if (share_test()) {
+		fprintf(stderr, "share test FAIL\n");
+		failures++;
+	}
+
+	if (pack_test()) {
+		fprintf(stderr, "pack test FAIL\n");
+		failures++;
+	}
+
+	if (alloc_test()) {
+		fprintf(stderr, "allocator test FAIL\n");
+		failures++;
+	}
+
+	if (stress_test()) {
+		fprintf(stderr, "multi-threaded stress test FAIL\n");
+		failures++;
+	}
 
 	printf("str8 pool size: %lu\n", pool.length);
 	str8_free_pool();
 
-	return 0;
+	return failures ? 1 : 0;
 }